@@ -0,0 +1,302 @@
+#include "AnsiSurface.h"
+
+#ifndef _WIN32
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+	// Upper and lower half blocks (UTF-8)
+static const char szUpperHalf[] = "\xE2\x96\x80";
+static const char szLowerHalf[] = "\xE2\x96\x84";
+
+	// Switching back is written by the signal handler too, so it is a plain string
+static const char szRestore[] = "\x1b[0m\x1b[?25h\x1b[?1049l";
+static int iRestoreFd = -1;
+
+static void RestoreOnSignal(int sig)
+{
+	if (iRestoreFd >= 0)
+	{
+		ssize_t n = write(iRestoreFd, szRestore, sizeof(szRestore) - 1);
+		(void)n;
+	}
+	_exit(128 + sig);
+}
+
+AnsiSurface::AnsiSurface(int fd) : fd(fd)
+{
+	bStarted = false;
+	bDelta = true;
+	nBytesLastFrame = nBytesTotal = 0;
+	nFramesPresented = 0;
+
+	// Colours of the Windows console, so frames look the same on both backends
+	const uint32_t console_palette[16] =
+	{
+		0x000000, 0x000080, 0x008000, 0x008080, 0x800000, 0x800080, 0x808000, 0xC0C0C0,
+		0x808080, 0x0000FF, 0x00FF00, 0x00FFFF, 0xFF0000, 0xFF00FF, 0xFFFF00, 0xFFFFFF
+	};
+	std::copy(console_palette, console_palette + 16, palette);
+
+	for (int32_t i = 0; i < 256; i++)
+		nNumberLength[i] = static_cast<uint8_t>(std::snprintf(szNumbers[i], 4, "%d", i));
+}
+
+AnsiSurface::~AnsiSurface()
+{
+	Restore();
+}
+
+int16_t AnsiSurface::Create(int16_t width, int16_t height, int16_t font_w, int16_t font_h, const std::wstring& name)
+{
+	int16_t rows = (height + 1) / 2;
+	vecRowX1.assign(rows, 0);
+	vecRowX2.assign(rows, -1);
+
+	// Frame of solid colours: about 40 bytes per cell in the worst case
+	sFrame.clear();
+	sFrame.reserve(static_cast<size_t>(width) * rows * 40 + 16 * rows);
+	tracker.Invalidate();
+
+	if (fd >= 0 && !bStarted)
+	{
+		// Alternate screen, hidden cursor, and the way back on Ctrl+C
+		const char start[] = "\x1b[?1049h\x1b[?25l\x1b[2J";
+		Write(start, sizeof(start) - 1);
+		bStarted = true;
+
+		iRestoreFd = fd;
+		std::signal(SIGINT, RestoreOnSignal);
+		std::signal(SIGTERM, RestoreOnSignal);
+	}
+
+	SetTitle(name.c_str());
+
+	return 0;
+}
+
+void AnsiSurface::Present(const Framebuffer& framebuffer)
+{
+	int16_t width = framebuffer.width;
+	int16_t rows = static_cast<int16_t>(vecRowX1.size());
+	const sCell* cells = framebuffer.cells.data();
+
+	// Changed part of every terminal row is the union of its two framebuffer rows
+	tracker.Update(framebuffer);
+	std::fill(vecRowX1.begin(), vecRowX1.end(), width);
+	std::fill(vecRowX2.begin(), vecRowX2.end(), -1);
+	if (bDelta)
+	{
+		for (auto& span : tracker.GetSpans())
+		{
+			int16_t row = span.y / 2;
+			if (row >= rows)
+				continue;
+			vecRowX1[row] = std::min(vecRowX1[row], span.x1);
+			vecRowX2[row] = std::max(vecRowX2[row], span.x2);
+		}
+	}
+	else
+	{
+		std::fill(vecRowX1.begin(), vecRowX1.end(), 0);
+		std::fill(vecRowX2.begin(), vecRowX2.end(), width - 1);
+	}
+
+	sFrame.clear();
+
+	// Colours of the terminal are unknown at the start of a frame
+	uint32_t fg = 0xFFFFFFFF, bg = 0xFFFFFFFF;
+
+	for (int16_t row = 0; row < rows; row++)
+	{
+		if (vecRowX1[row] > vecRowX2[row])
+			continue;
+
+		// Cursor to the first changed cell
+		sFrame += "\x1b[";
+		AppendNumber(row + 1);
+		sFrame += ';';
+		AppendNumber(vecRowX1[row] + 1);
+		sFrame += 'H';
+
+		const sCell* top = &cells[2 * row * width];
+		const sCell* bottom = (2 * row + 1 < framebuffer.height) ? top + width : nullptr;
+
+		for (int16_t x = vecRowX1[row]; x <= vecRowX2[row]; x++)
+		{
+			uint32_t up = CellColour(top[x]);
+			uint32_t down = bottom ? CellColour(bottom[x]) : 0x000000;
+
+			// One colour: a space needs only the background
+			if (up == down)
+			{
+				if (bg != up)
+				{
+					AppendColour(false, up);
+					bg = up;
+				}
+				sFrame += ' ';
+				continue;
+			}
+
+			// Upper or lower half block, the one which keeps more of the current colours
+			bool bLower = (fg == down) + (bg == up) > (fg == up) + (bg == down);
+			uint32_t new_fg = bLower ? down : up;
+			uint32_t new_bg = bLower ? up : down;
+
+			if (fg != new_fg)
+			{
+				AppendColour(true, new_fg);
+				fg = new_fg;
+			}
+			if (bg != new_bg)
+			{
+				AppendColour(false, new_bg);
+				bg = new_bg;
+			}
+			sFrame.append(bLower ? szLowerHalf : szUpperHalf, 3);
+		}
+	}
+
+	if (!sFrame.empty())
+		Write(sFrame.data(), sFrame.size());
+
+	nBytesLastFrame = sFrame.size();
+	nBytesTotal += sFrame.size();
+	nFramesPresented++;
+}
+
+void AnsiSurface::SetTitle(const wchar_t* title)
+{
+	if (fd < 0)
+		return;
+
+	// OSC 0 with the title in UTF-8
+	std::string s = "\x1b]0;";
+	for (; *title; title++)
+	{
+		uint32_t c = static_cast<uint32_t>(*title);
+		if (c < 0x80)
+			s += static_cast<char>(c);
+		else if (c < 0x800)
+		{
+			s += static_cast<char>(0xC0 | (c >> 6));
+			s += static_cast<char>(0x80 | (c & 0x3F));
+		}
+		else if (c < 0x10000)
+		{
+			s += static_cast<char>(0xE0 | (c >> 12));
+			s += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+			s += static_cast<char>(0x80 | (c & 0x3F));
+		}
+		else
+		{
+			s += static_cast<char>(0xF0 | (c >> 18));
+			s += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+			s += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+			s += static_cast<char>(0x80 | (c & 0x3F));
+		}
+	}
+	s += '\x07';
+
+	Write(s.data(), s.size());
+}
+
+uint32_t AnsiSurface::CellColour(const sCell& cell) const
+{
+	uint32_t fg = palette[cell.col & 0x0F];
+	uint32_t bg = palette[(cell.col >> 4) & 0x0F];
+
+	// Share of the foreground in the glyph
+	uint32_t cover;
+	switch (static_cast<uint16_t>(cell.sym))
+	{
+	case 0:
+	case ' ':		cover = 0; break;
+	case 0x2591:	cover = 1; break;					// PIXEL_QUARTER
+	case 0x2592:	cover = 2; break;					// PIXEL_HALF
+	case 0x2593:	cover = 3; break;					// PIXEL_THREEQUARTERS
+	default:		cover = 4; break;					// PIXEL_SOLID and letters
+	}
+
+	if (cover == 4)
+		return fg;
+	if (cover == 0)
+		return bg;
+
+	uint32_t rgb = 0;
+	for (int32_t shift = 0; shift < 24; shift += 8)
+	{
+		uint32_t f = (fg >> shift) & 0xFF;
+		uint32_t b = (bg >> shift) & 0xFF;
+		rgb |= ((f * cover + b * (4 - cover)) / 4) << shift;
+	}
+	return rgb;
+}
+
+void AnsiSurface::AppendColour(bool bForeground, uint32_t rgb)
+{
+	// SGR 38;2;r;g;b or 48;2;r;g;b
+	sFrame.append(bForeground ? "\x1b[38;2;" : "\x1b[48;2;", 7);
+	AppendNumber((rgb >> 16) & 0xFF);
+	sFrame += ';';
+	AppendNumber((rgb >> 8) & 0xFF);
+	sFrame += ';';
+	AppendNumber(rgb & 0xFF);
+	sFrame += 'm';
+}
+
+void AnsiSurface::AppendNumber(int32_t n)
+{
+	if (n >= 0 && n < 256)
+	{
+		sFrame.append(szNumbers[n], nNumberLength[n]);
+		return;
+	}
+
+	char s[16];
+	int len = std::snprintf(s, sizeof(s), "%d", n);
+	sFrame.append(s, len);
+}
+
+void AnsiSurface::Write(const char* data, size_t size)
+{
+	if (fd < 0)
+		return;
+
+	// Terminal can take a frame in parts
+	while (size)
+	{
+		ssize_t n = write(fd, data, size);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		data += n;
+		size -= n;
+	}
+}
+
+void AnsiSurface::Restore()
+{
+	if (!bStarted)
+		return;
+
+	Write(szRestore, sizeof(szRestore) - 1);
+	bStarted = false;
+
+	if (iRestoreFd == fd)
+	{
+		std::signal(SIGINT, SIG_DFL);
+		std::signal(SIGTERM, SIG_DFL);
+		iRestoreFd = -1;
+	}
+}
+
+#endif // !_WIN32
@@ -0,0 +1,55 @@
+#ifndef _ANSI_SURFACE_H_
+#define _ANSI_SURFACE_H_
+
+#ifndef _WIN32
+
+#include "DirtyTracker.h"
+#include "Surface.h"
+
+#include <string>
+#include <vector>
+
+	// POSIX terminal backend: every two rows of the framebuffer become one row of
+	// half-block characters with 24-bit colours. A frame is written by one write(),
+	// colours are sent only when they change, and only changed rows are sent (from
+	// the first to the last changed cell)
+class AnsiSurface : public Surface
+{
+private:
+	int fd;												// Where frames go, -1 - only count bytes
+	bool bStarted;										// Terminal is switched to the alternate screen
+	std::string sFrame;									// Escape stream of the current frame
+	DirtyTracker tracker;
+	std::vector<int16_t> vecRowX1, vecRowX2;			// Changed part of every terminal row
+	uint32_t palette[16];								// Console colours as 0xRRGGBB
+	char szNumbers[256][4];								// Decimal strings of 0 ... 255
+	uint8_t nNumberLength[256];
+
+	uint64_t nBytesLastFrame, nBytesTotal;
+	uint64_t nFramesPresented;
+
+public:
+	AnsiSurface(int fd = 1);							// stdout by default
+	~AnsiSurface();
+
+	bool bDelta;										// false - every frame is sent whole
+
+	virtual int16_t Create(int16_t width, int16_t height, int16_t font_w, int16_t font_h, const std::wstring& name) override;
+	virtual void Present(const Framebuffer& framebuffer) override;
+	virtual void SetTitle(const wchar_t* title) override;
+
+	uint64_t GetBytesLastFrame() const { return nBytesLastFrame; }
+	uint64_t GetBytesTotal() const { return nBytesTotal; }
+	uint64_t GetFramesPresented() const { return nFramesPresented; }
+
+private:
+	uint32_t CellColour(const sCell& cell) const;
+	void AppendColour(bool bForeground, uint32_t rgb);
+	void AppendNumber(int32_t n);
+	void Write(const char* data, size_t size);
+	void Restore();
+};
+
+#endif // !_WIN32
+
+#endif // !_ANSI_SURFACE_H_
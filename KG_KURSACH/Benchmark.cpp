@@ -0,0 +1,1339 @@
+#include "Benchmark.h"
+#include "AnsiSurface.h"
+
+#include <cstdio>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+Benchmark::Benchmark(int32_t nMeshes, BENCH_MODE mode, int32_t nThreads) : nMeshes(nMeshes), mode(mode), nThreads(nThreads)
+{
+	fPathTime = 0.0f;
+	bBackground = true;
+	bMoveCamera = true;
+	bWideScene = false;
+	fWideStartZ = 2.0f;
+	bCulling = true;
+	bGroups = true;
+	bClip = true;
+	bBackFaces = true;
+	bEdges = true;
+	nVisibleTotal = nTestedTotal = 0;
+	nClipRejected = nClipClipped = nClipOutput = 0;
+	nFacesTotal = nBackFacesTotal = 0;
+	nShadowRebuilds = nShadowFaces = nShadowEdges = nShadowArea = 0;
+	pTracker = nullptr;
+	nTrackedCells = nTrackedRectCells = nTrackedRects = 0;
+	fTrackTime = 0.0f;
+	nFramesHash = HashCells(nullptr, 0);
+	nSteadyAllocations = 0;
+	nFillDepth = 0;
+	nFillStackTop = 0;
+	nFillStackBytes = 0;
+	nFillStackLimit = 0;
+	bFillOutOfStack = false;
+
+	// Recording of times mustn't allocate during the run
+	vecFrameTime.reserve(1 << 16);
+	std::fill(fStageTotal, fStageTotal + STAGE_COUNT, 0.0f);
+}
+
+void Benchmark::OnUserCreate()
+{
+	NewGarphics::OnUserCreate();
+
+	// Instances of the figures are put on a grid. Blocks of nBlock x nBlock
+	// instances are groups of the scene graph, so culling drops them at once.
+	// The normal grid goes away from the camera, so the camera path never brings
+	// it behind the camera. The wide one is far wider than the view and mostly unseen
+	const float fSpacingX = bWideScene ? 20.0f : 2.5f;
+	const float fSpacingZ = bWideScene ? 4.0f : 2.5f;
+	const int32_t nColumns = bWideScene ? 200 : 8;
+	const float fStartZ = bWideScene ? fWideStartZ : 0.0f;
+	const int32_t nBlock = 8;
+
+	scene.Clear();
+	std::vector<int32_t> vecBlocks;
+	int32_t nBlockColumns = (nColumns + nBlock - 1) / nBlock;
+
+	for (int32_t i = 0; i < nMeshes; i++)
+	{
+		int32_t column = i % nColumns, row = i / nColumns;
+
+		int32_t nParent = scene.GetRoot();
+		if (bGroups)
+		{
+			size_t block = static_cast<size_t>((row / nBlock) * nBlockColumns + column / nBlock);
+			if (block >= vecBlocks.size())
+				vecBlocks.resize(block + 1, -1);
+			if (vecBlocks[block] < 0)
+				vecBlocks[block] = scene.AddNode(scene.GetRoot(), -1, math3d::MakeIdentity());
+			nParent = vecBlocks[block];
+		}
+
+		float x = (static_cast<float>(column) - nColumns / 2) * fSpacingX;
+		float z = fStartZ + static_cast<float>(row) * fSpacingZ;
+		scene.AddNode(nParent, i % static_cast<int32_t>(vecShapeViews.size()), math3d::MakeTranslation(x, 0.0f, z));
+	}
+	ReserveSortMemory();
+
+	bFrustumCulling = bCulling;
+	bClipping = bClip;
+	bBackFaceCulling = bBackFaces;
+	bMeshEdges = bEdges;
+	bDepthBuffer = (mode != MODE_PAINT);
+	bTiledRaster = (mode == MODE_TILED);
+	if (bTiledRaster)
+		SetRasterThreads(nThreads);
+	bCacheBackground = bBackground;
+	bMeasureStages = true;
+	nPixelsWritten = 0;
+}
+
+void Benchmark::OnUserUpdate(float fElapsedTime)
+{
+	// Allocations of the previous frame
+	if (vecFrameTime.size() > nWarmUpFrames)
+		nSteadyAllocations += Profiler::Get().GetFrameCounter(COUNTER_ALLOCATIONS);
+
+	if (bMoveCamera)
+		MoveCamera(fElapsedTime);
+
+	std::fill(fStageTime, fStageTime + STAGE_COUNT, 0.0f);
+
+	auto tp1 = std::chrono::steady_clock::now();
+	RenderFrame();
+	auto tp2 = std::chrono::steady_clock::now();
+
+	vecFrameTime.push_back(std::chrono::duration<float>(tp2 - tp1).count());
+	for (int16_t i = 0; i < STAGE_COUNT; i++)
+		fStageTotal[i] += fStageTime[i];
+
+	nFramesHash = HashCells(framebuffer.cells.data(), framebuffer.cells.size(), nFramesHash);
+	nVisibleTotal += scene.GetCullStats().nVisible;
+	nTestedTotal += scene.GetCullStats().nTested;
+	nClipRejected += clipStats.nRejected;
+	nClipClipped += clipStats.nClipped;
+	nClipOutput += clipStats.nOutput;
+	nFacesTotal += clipStats.nTriangles;
+	nBackFacesTotal += clipStats.nBackFaces;
+	nShadowRebuilds += shadowStats.bRebuilt;
+	nShadowFaces += shadowStats.bRebuilt ? shadowStats.nFaces : 0;
+	nShadowEdges += shadowStats.bRebuilt ? shadowStats.nEdges : 0;
+	nShadowArea += shadowStats.nArea;
+
+	if (pTracker)
+	{
+		auto tp3 = std::chrono::steady_clock::now();
+		nTrackedRects += pTracker->Update(framebuffer);
+		fTrackTime += std::chrono::duration<float>(std::chrono::steady_clock::now() - tp3).count();
+		nTrackedCells += pTracker->GetChangedCells();
+		nTrackedRectCells += pTracker->GetRectCells();
+	}
+}
+
+void Benchmark::ReportTracker(const wchar_t* name)
+{
+	if (vecFrameTime.empty())
+		return;
+
+	float nFrames = static_cast<float>(vecFrameTime.size());
+	float fFull = static_cast<float>(framebuffer.cells.size());
+
+	wprintf(L"%-8ls %7d | %10.0f %10.0f %7.2f %8.1f%% | %8.4f\n", name, nMeshes,
+		nTrackedCells / nFrames, nTrackedRectCells / nFrames, nTrackedRects / nFrames,
+		nTrackedRectCells / nFrames / fFull * 100.0f, fTrackTime / nFrames * 1000.0f);
+}
+
+float Benchmark::GetMeanTime(FRAME_STAGE stage) const
+{
+	return vecFrameTime.empty() ? 0.0f : fStageTotal[stage] / vecFrameTime.size() * 1000.0f;
+}
+
+void Benchmark::MoveCamera(float fElapsedTime)
+{
+	// Same path on every run: swing around Y, nod around X, dolly and pan
+	fPathTime += fElapsedTime;
+
+	fThetaY = 0.3f * sinf(0.7f * fPathTime);
+	fThetaX = 0.2f * sinf(0.3f * fPathTime);
+	fThetaZ = 0.0f;
+
+	_z = 4.5f + 1.5f * sinf(0.2f * fPathTime);
+	_x = 0.5f + 0.2f * sinf(0.5f * fPathTime);
+}
+
+void Benchmark::Report()
+{
+	if (vecFrameTime.empty())
+		return;
+
+	// Instances share the meshes: triangles are counted per instance, bytes per mesh
+	size_t nTriangles = 0;
+	size_t nMeshBytes = 0;
+	for (size_t i = 0; i < scene.GetNodeCount(); i++)
+	{
+		int32_t nMesh = scene.GetNode(static_cast<int32_t>(i)).nMesh;
+		if (nMesh >= 0)
+			nTriangles += vecShapeViews[nMesh].nFaces;
+	}
+	for (auto& sh : shapes)
+		nMeshBytes += sh.MemoryUsage();
+
+	std::vector<float> sorted = vecFrameTime;
+	std::sort(sorted.begin(), sorted.end());
+
+	auto percentile = [&sorted](float p)
+	{
+		size_t i = static_cast<size_t>(p * (sorted.size() - 1) + 0.5f);
+		return sorted[i] * 1000.0f;
+	};
+
+	float fTotal = 0.0f;
+	for (float t : vecFrameTime)
+		fTotal += t;
+
+	float nFrames = static_cast<float>(vecFrameTime.size());
+
+	wprintf(L"%5ls %7d %8zu | %8.3f %8.3f %8.3f %8.3f %8.3f | %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f | %10.0f %9zu\n",
+		GetModeName(mode), nMeshes, nTriangles,
+		fTotal / nFrames * 1000.0f, percentile(0.5f), percentile(0.9f), percentile(0.99f), sorted.back() * 1000.0f,
+		fStageTotal[STAGE_CLEAR] / nFrames * 1000.0f,
+		fStageTotal[STAGE_MATRICES] / nFrames * 1000.0f,
+		(fStageTotal[STAGE_TRANSFORM] + fStageTotal[STAGE_CLIP]) / nFrames * 1000.0f,
+		fStageTotal[STAGE_SORT] / nFrames * 1000.0f,
+		fStageTotal[STAGE_SHADOW] / nFrames * 1000.0f,
+		(fStageTotal[STAGE_ROBERTS] + fStageTotal[STAGE_RASTER]) / nFrames * 1000.0f,
+		static_cast<float>(nPixelsWritten) / nFrames, nMeshBytes / 1024);
+}
+
+int16_t RunBenchmarks(int32_t nFrames)
+{
+	const int32_t scenes[] = { 2, 16, 128, 1024, 4096, 20000 };
+
+	wprintf(L"Frame benchmark: %d frames per scene, 360x200, ms per frame\n", nFrames);
+	wprintf(L"%5ls %7ls %8ls | %8ls %8ls %8ls %8ls %8ls | %8ls %8ls %8ls %8ls %8ls %8ls | %10ls %9ls\n",
+		L"mode", L"meshes", L"tris", L"mean", L"p50", L"p90", L"p99", L"max",
+		L"clear", L"matrix", L"transf", L"sort", L"shadow", L"hidden", L"pix/frame", L"mesh KB");
+
+	// hidden: RobertsAlgorithm for paint, the z-buffer for zbuf and tiled
+	for (Benchmark::BENCH_MODE mode : { Benchmark::MODE_PAINT, Benchmark::MODE_ZBUF, Benchmark::MODE_TILED })
+	{
+		for (int32_t nMeshes : scenes)
+		{
+			Benchmark bench(nMeshes, mode);
+			if (bench.ConstructHeadless(360, 200, L"Benchmark"))
+				return 1;
+
+			bench.LoopHeadless(nFrames, 1.0f / 60.0f);
+			bench.Report();
+		}
+	}
+
+	return 0;
+}
+
+const wchar_t* Benchmark::GetModeName(BENCH_MODE mode)
+{
+	switch (mode)
+	{
+	case MODE_PAINT:	return L"paint";
+	case MODE_ZBUF:		return L"zbuf";
+	case MODE_TILED:	return L"tiled";
+	default:			return L"?";
+	}
+}
+
+int16_t RunAllocationCheck(int32_t nFrames)
+{
+#ifndef KG_PROFILE
+	wprintf(L"ERROR: allocations are counted only in the build with KG_PROFILE\n");
+	return 1;
+#else
+	const int32_t scenes[] = { 2, 128, 4096 };
+	int16_t result = 0;
+
+	wprintf(L"Allocation check: %d frames per scene, first %d are warm-up\n", nFrames, Benchmark::nWarmUpFrames);
+	wprintf(L"%5ls %7ls | %12ls %12ls\n", L"mode", L"meshes", L"allocations", L"arena KB");
+
+	for (Benchmark::BENCH_MODE mode : { Benchmark::MODE_PAINT, Benchmark::MODE_ZBUF, Benchmark::MODE_TILED })
+	{
+		for (int32_t nMeshes : scenes)
+		{
+			Benchmark bench(nMeshes, mode);
+			if (bench.ConstructHeadless(360, 200, L"Benchmark"))
+				return 1;
+
+			bench.LoopHeadless(nFrames, 1.0f / 60.0f);
+
+			wprintf(L"%5ls %7d | %12lld %12zu\n", Benchmark::GetModeName(mode), nMeshes,
+				static_cast<long long>(bench.GetSteadyAllocations()), bench.GetArenaPeakBytes() / 1024);
+
+			if (bench.GetSteadyAllocations())
+				result = 1;
+		}
+	}
+
+	if (result)
+		wprintf(L"ERROR: frames allocate memory\n");
+
+	return result;
+#endif
+}
+
+int16_t RunThreadBenchmark(int32_t nFrames)
+{
+	const int32_t scenes[] = { 1024, 4096, 20000 };
+
+	int32_t nCores = static_cast<int32_t>(std::thread::hardware_concurrency());
+	nCores = (nCores < 1) ? 1 : nCores;
+
+	wprintf(L"Thread benchmark: %d frames per scene, %d cores, raster ms per frame\n", nFrames, nCores);
+	wprintf(L"%7ls %8ls | %8ls %8ls %8ls | %9ls\n", L"meshes", L"threads", L"raster", L"speedup", L"frame", L"identical");
+
+	for (int32_t nMeshes : scenes)
+	{
+		Benchmark single(nMeshes, Benchmark::MODE_ZBUF);
+		if (single.ConstructHeadless(360, 200, L"Benchmark"))
+			return 1;
+		float fSingleFrame = single.LoopHeadless(nFrames, 1.0f / 60.0f) / nFrames * 1000.0f;
+		float fSingle = single.GetMeanTime(NewGarphics::STAGE_RASTER);
+
+		wprintf(L"%7d %8ls | %8.3f %8.2f %8.3f | %9ls\n", nMeshes, L"-", fSingle, 1.0f, fSingleFrame, L"-");
+
+		// At least up to 4 threads, so the result is checked on every machine
+		for (int32_t nThreads = 1; nThreads <= std::max(nCores, 4); nThreads *= 2)
+		{
+			Benchmark tiled(nMeshes, Benchmark::MODE_TILED, nThreads);
+			if (tiled.ConstructHeadless(360, 200, L"Benchmark"))
+				return 1;
+			float fFrame = tiled.LoopHeadless(nFrames, 1.0f / 60.0f) / nFrames * 1000.0f;
+			float fTiled = tiled.GetMeanTime(NewGarphics::STAGE_RASTER);
+
+			wprintf(L"%7d %8d | %8.3f %8.2f %8.3f | %9ls\n", nMeshes, nThreads, fTiled, fSingle / fTiled, fFrame,
+				(tiled.GetFramesHash() == single.GetFramesHash()) ? L"yes" : L"NO");
+		}
+	}
+
+	return 0;
+}
+
+void Benchmark::ReportTransform(size_t nVertices, int32_t nRepeats)
+{
+	// Same vertices and matrices as a frame of the scene would use
+	sVertexBatch batch;
+	batch.Resize(nVertices);
+	for (size_t i = 0; i < nVertices; i++)
+	{
+		batch.x[i] = static_cast<float>(i % 97) * 0.03f - 1.5f;
+		batch.y[i] = static_cast<float>(i % 89) * 0.02f;
+		batch.z[i] = static_cast<float>(i % 83) * 0.05f;
+	}
+
+	mat4x4 matProj = Matrix_MakeProjection(90.0f, 200.0f / 360.0f, 0.1f, 1000.0f);
+	mat4x4 matRotY = Matrix_MakeRotationY(0.3f);
+	mat4x4 matTranslation = Matrix_MakeTranslation(0.0f, 0.0f, 4.0f);
+	mat4x4 WorldMatrix = matRotY * matTranslation;
+	mat4x4 WorldProjMatrix = WorldMatrix * matProj;
+	sViewport viewport = { 0.5f, 0.75f, 180.0f, 100.0f };
+
+	auto measure = [nRepeats](auto&& body)
+	{
+		auto tp1 = std::chrono::steady_clock::now();
+		for (int32_t r = 0; r < nRepeats; r++)
+			body();
+		return std::chrono::duration<float>(std::chrono::steady_clock::now() - tp1).count() / nRepeats;
+	};
+
+	// The old way: two MultiplyMatrixVector, divide, flip and scale for every vertex
+	std::vector<fPoint3D> vecOld(nVertices);
+	float fOld = measure([&]()
+		{
+			for (size_t i = 0; i < nVertices; i++)
+			{
+				fPoint3D v(batch.x[i], batch.y[i], batch.z[i]);
+				fPoint3D p = MultiplyMatrixVector(WorldMatrix, v);
+				p = MultiplyMatrixVector(matProj, p);
+				p = p / p.w;
+				p.x = (-p.x + viewport.offset_x) * viewport.scale_x;
+				p.y = (-p.y + viewport.offset_y) * viewport.scale_y;
+				vecOld[i] = p;
+			}
+		});
+
+	wprintf(L"%-10ls %10.3f ms %10.1f Mvert/s %8.2fx\n", L"per-vertex", fOld * 1000.0f, nVertices / fOld / 1e6f, 1.0f);
+
+	sProjectedBatch out;
+	for (TRANSFORM_KERNEL kernel : { KERNEL_SCALAR, KERNEL_SSE, KERNEL_AVX })
+	{
+		if (kernel > GetBestTransformKernel())
+			continue;
+
+		float fTime = measure([&]() { TransformBatch(WorldProjMatrix.m, viewport, batch, out, kernel); });
+		wprintf(L"%-10ls %10.3f ms %10.1f Mvert/s %8.2fx\n", GetTransformKernelName(kernel),
+			fTime * 1000.0f, nVertices / fTime / 1e6f, fOld / fTime);
+	}
+}
+
+void Benchmark::ReportClear(int32_t nRepeats)
+{
+	auto measure = [nRepeats](auto&& body)
+	{
+		auto tp1 = std::chrono::steady_clock::now();
+		for (int32_t r = 0; r < nRepeats; r++)
+			body();
+		return std::chrono::duration<float>(std::chrono::steady_clock::now() - tp1).count() / nRepeats;
+	};
+
+	// Background of the frame: black screen and the pink ground
+	auto print = [](const wchar_t* name, float fTime, float fBase)
+	{
+		wprintf(L"%-18ls %10.4f ms %8.2fx\n", name, fTime * 1000.0f, fBase / fTime);
+	};
+
+	// The old Fill: column by column, every cell through Draw
+	auto fill_cells = [this](int16_t x1, int16_t y1, int16_t x2, int16_t y2, int16_t sym, int16_t col)
+	{
+		Clip(x1, y1);
+		Clip(x2, y2);
+		for (int16_t x = x1; x <= x2; x++)
+			for (int16_t y = y1; y <= y2; y++)
+				Draw(x, y, sym, col);
+	};
+
+	float fOld = measure([&]()
+		{
+			fill_cells(0, 0, iConsoleWidth, iConsoleHeight, PIXEL_SOLID, FG_BLACK);
+			fill_cells(0, iConsoleHeight / 2, iConsoleWidth, iConsoleHeight, PIXEL_SOLID, FG_PINK);
+		});
+	print(L"per-cell Fill", fOld, fOld);
+
+	float fFill = measure([&]()
+		{
+			Fill(0, 0, iConsoleWidth, iConsoleHeight);
+			Fill(0, iConsoleHeight / 2, iConsoleWidth, iConsoleHeight, PIXEL_SOLID, FG_PINK);
+		});
+	print(L"row Fill", fFill, fOld);
+
+	float fClear = measure([&]()
+		{
+			Clear();
+			Fill(0, iConsoleHeight / 2, iConsoleWidth, iConsoleHeight, PIXEL_SOLID, FG_PINK);
+		});
+	print(L"Clear + Fill", fClear, fOld);
+
+	// Restore after a frame which covered the whole screen and after one which covered a quarter of it
+	CacheBackground();
+	float fRestoreAll = measure([&]()
+		{
+			Fill(0, 0, iConsoleWidth - 1, iConsoleHeight - 1, PIXEL_SOLID, FG_WHITE);
+			RestoreBackground();
+		}) - measure([&]() { Fill(0, 0, iConsoleWidth - 1, iConsoleHeight - 1, PIXEL_SOLID, FG_WHITE); });
+	print(L"restore, full", fRestoreAll, fOld);
+
+	float fRestoreQuarter = measure([&]()
+		{
+			Fill(iConsoleWidth / 4, iConsoleHeight / 4, iConsoleWidth * 3 / 4 - 1, iConsoleHeight * 3 / 4 - 1, PIXEL_SOLID, FG_WHITE);
+			RestoreBackground();
+		}) - measure([&]() { Fill(iConsoleWidth / 4, iConsoleHeight / 4, iConsoleWidth * 3 / 4 - 1, iConsoleHeight * 3 / 4 - 1, PIXEL_SOLID, FG_WHITE); });
+	print(L"restore, quarter", fRestoreQuarter, fOld);
+}
+
+int16_t RunClearBenchmark(int32_t nFrames)
+{
+	wprintf(L"Clear benchmark: 360x200, ms per clear\n");
+
+	Benchmark bench(0);
+	if (bench.ConstructHeadless(360, 200, L"Benchmark"))
+		return 1;
+	bench.ReportClear(2000);
+
+	// Clear stage of whole frames, with and without the cached background
+	wprintf(L"\nFrames: %d per scene, clear ms per frame\n", nFrames);
+	wprintf(L"%5ls %7ls | %8ls %8ls\n", L"mode", L"meshes", L"clear", L"cached");
+
+	for (Benchmark::BENCH_MODE mode : { Benchmark::MODE_PAINT, Benchmark::MODE_ZBUF })
+	{
+		for (int32_t nMeshes : { 2, 128 })
+		{
+			float fTime[2];
+			uint64_t nHash[2];
+			for (int16_t cached = 0; cached < 2; cached++)
+			{
+				Benchmark frames(nMeshes, mode);
+				frames.SetBackgroundCache(cached != 0);
+				if (frames.ConstructHeadless(360, 200, L"Benchmark"))
+					return 1;
+				frames.LoopHeadless(nFrames, 1.0f / 60.0f);
+				fTime[cached] = frames.GetMeanTime(NewGarphics::STAGE_CLEAR);
+				nHash[cached] = frames.GetFramesHash();
+			}
+
+			wprintf(L"%5ls %7d | %8.4f %8.4f\n", Benchmark::GetModeName(mode), nMeshes, fTime[0], fTime[1]);
+			if (nHash[0] != nHash[1])
+			{
+				wprintf(L"ERROR: frames with the cached background differ\n");
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+	// Calls body(context) on a thread with nStackBytes of stack and waits for it,
+	// std::thread can't set the size. Returns false if the thread isn't made
+static bool RunWithStack(size_t nStackBytes, void (*body)(void*), void* context)
+{
+	struct sStart
+	{
+		void (*body)(void*);
+		void* context;
+	} start = { body, context };
+
+#ifdef _WIN32
+	HANDLE thread = reinterpret_cast<HANDLE>(_beginthreadex(nullptr, static_cast<unsigned>(nStackBytes),
+		[](void* start) -> unsigned
+		{
+			static_cast<sStart*>(start)->body(static_cast<sStart*>(start)->context);
+			return 0;
+		}, &start, STACK_SIZE_PARAM_IS_A_RESERVATION, nullptr));
+	if (!thread)
+		return false;
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+#else
+	pthread_attr_t attr;
+	pthread_t thread;
+	pthread_attr_init(&attr);
+	int iResult = pthread_attr_setstacksize(&attr, nStackBytes);
+	if (!iResult)
+		iResult = pthread_create(&thread, &attr, [](void* start) -> void*
+			{
+				static_cast<sStart*>(start)->body(static_cast<sStart*>(start)->context);
+				return nullptr;
+			}, &start);
+	pthread_attr_destroy(&attr);
+	if (iResult)
+		return false;
+	pthread_join(thread, nullptr);
+#endif
+	return true;
+}
+
+void Benchmark::FillRecursive(int16_t x, int16_t y, int16_t sym, int16_t col, int16_t col_edges, int32_t nDepth)
+{
+	// The fill of the first version: one call per cell, 4 neighbours.
+	// Kept only here to compare with FillingFloodFill
+	char cMark;
+	uintptr_t nBytes = nFillStackTop - reinterpret_cast<uintptr_t>(&cMark);
+	nFillStackBytes = std::max(nFillStackBytes, (size_t)nBytes);
+	nFillDepth = std::max(nFillDepth, nDepth);
+
+	// The calls are bigger than nFillStackPerCell, e.g. in a debug build: the run is dropped
+	if (nBytes > nFillStackLimit)
+	{
+		bFillOutOfStack = true;
+		return;
+	}
+
+	Draw(x, y, sym, col);
+
+	auto can_fill = [&](int16_t x, int16_t y)
+	{
+		if (x < 0 || x >= iConsoleWidth || y < 0 || y >= iConsoleHeight)
+			return false;
+		int16_t c = console[y * iConsoleWidth + x].col;
+		return c != col_edges && c != col;
+	};
+
+	if (can_fill(x, y - 1))
+		FillRecursive(x, y - 1, sym, col, col_edges, nDepth + 1);
+	if (can_fill(x, y + 1))
+		FillRecursive(x, y + 1, sym, col, col_edges, nDepth + 1);
+	if (can_fill(x - 1, y))
+		FillRecursive(x - 1, y, sym, col, col_edges, nDepth + 1);
+	if (can_fill(x + 1, y))
+		FillRecursive(x + 1, y, sym, col, col_edges, nDepth + 1);
+}
+
+int16_t Benchmark::ReportFill(float fScale, int32_t nRepeats)
+{
+	// Triangle in the middle of the screen, fScale of its width and height
+	float fWidth = (iConsoleWidth - 1) * fScale, fHeight = (iConsoleHeight - 1) * fScale;
+	float cx = (iConsoleWidth - 1) * 0.5f, cy = (iConsoleHeight - 1) * 0.5f;
+	fPoint2D points[3];
+	points[0].x = cx - fWidth * 0.5f; points[0].y = cy + fHeight * 0.5f;
+	points[1].x = cx + fWidth * 0.5f; points[1].y = cy + fHeight * 0.5f;
+	points[2].x = cx; points[2].y = cy - fHeight * 0.5f;
+	int16_t x = (int16_t)roundf(cx), y = (int16_t)roundf(cy + fHeight / 6.0f);
+
+	const int16_t col_edges = FG_WHITE, col = FG_BLUE;
+	size_t nCells = (size_t)iConsoleWidth * iConsoleHeight;
+
+	// Only the fill is timed, the edges are drawn again before every repeat
+	auto measure = [&](auto&& fill)
+	{
+		float fTime = 0.0f;
+		for (int32_t r = 0; r < nRepeats; r++)
+		{
+			Clear();
+			DrawPolygons(points, 3, PIXEL_SOLID, col_edges);
+			auto tp1 = std::chrono::steady_clock::now();
+			fill();
+			fTime += std::chrono::duration<float>(std::chrono::steady_clock::now() - tp1).count();
+		}
+
+		size_t nFilled = 0;
+		for (size_t i = 0; i < nCells; i++)
+			nFilled += console[i].col == col;
+		return std::make_pair(fTime / nRepeats, nFilled);
+	};
+
+	// The recursion goes as deep as the cells it fills: it runs on a thread
+	// with a stack for the whole screen, the main one may be only 1 MB
+	nFillDepth = 0;
+	nFillStackBytes = 0;
+	nFillStackLimit = nCells * nFillStackPerCell;
+	bFillOutOfStack = false;
+	std::pair<float, size_t> recursive;
+	uint64_t nRecursiveHash = 0;
+	auto run_recursive = [&]()
+	{
+		recursive = measure([&]()
+			{
+				char cTop;
+				nFillStackTop = reinterpret_cast<uintptr_t>(&cTop);
+				FillRecursive(x, y, PIXEL_SOLID, col, col_edges, 1);
+			});
+		nRecursiveHash = HashCells(console, nCells);
+	};
+	bool bRecursive = RunWithStack(nFillStackLimit + (1 << 20),
+		[](void* run) { (*static_cast<decltype(run_recursive)*>(run))(); }, &run_recursive) && !bFillOutOfStack;
+
+	auto span = measure([&]() { FillingFloodFill(x, y, PIXEL_SOLID, col, col_edges); });
+	uint64_t nSpanHash = HashCells(console, nCells);
+
+	// A recursive run which didn't finish isn't a result: its row is left out
+	if (bRecursive)
+		wprintf(L"%5.2f %-10ls %7zu %9.4f %9.1f | %7d %9.1f %9ls\n", fScale, L"recursive", recursive.second,
+			recursive.first * 1000.0f, recursive.second / recursive.first / 1e6f, nFillDepth, nFillStackBytes / 1024.0f, L"-");
+	else
+		wprintf(L"%5.2f %-10ls no result, %ls\n", fScale, L"recursive",
+			bFillOutOfStack ? L"out of the stack" : L"no thread with the stack");
+	wprintf(L"%5.2f %-10ls %7zu %9.4f %9.1f | %7ls %9ls %9zu\n", fScale, L"span", span.second,
+		span.first * 1000.0f, span.second / span.first / 1e6f, L"-", L"-", GetSeedStackBytes());
+
+	if (bRecursive && nRecursiveHash != nSpanHash)
+	{
+		wprintf(L"ERROR: the span fill differs from the recursive one\n");
+		return 1;
+	}
+	return 0;
+}
+
+int16_t RunFillBenchmark(int32_t nRepeats)
+{
+	wprintf(L"Fill benchmark: 360x200, %d repeats, triangles of a part of the screen\n", nRepeats);
+	wprintf(L"%5ls %-10ls %7ls %9ls %9ls | %7ls %9ls %9ls\n", L"scale", L"fill", L"cells", L"ms", L"Mpix/s",
+		L"depth", L"stack KB", L"heap B");
+
+	// One fill object for all sizes: the seed stack keeps the heap of the biggest face so far
+	Benchmark bench(0);
+	if (bench.ConstructHeadless(360, 200, L"Benchmark"))
+		return 1;
+
+	for (float fScale : { 0.1f, 0.25f, 0.5f, 0.75f, 1.0f })
+	{
+		if (bench.ReportFill(fScale, nRepeats))
+			return 1;
+	}
+
+	return 0;
+}
+
+int16_t RunPresentBenchmark(int32_t nFrames)
+{
+	wprintf(L"Present benchmark: %d frames per scene, 360x200 (%d cells per full frame)\n", nFrames, 360 * 200);
+	wprintf(L"%-8ls %7ls | %10ls %10ls %7ls %9ls | %8ls\n", L"camera", L"meshes",
+		L"changed", L"sent", L"rects", L"of full", L"diff ms");
+
+	// First frame is sent whole and counted too
+	for (bool bMoving : { false, true })
+	{
+		for (int32_t nMeshes : { 2, 128, 4096 })
+		{
+			DirtyTracker tracker;
+			Benchmark bench(nMeshes);
+			bench.SetCameraMoving(bMoving);
+			bench.SetDirtyTracker(&tracker);
+			if (bench.ConstructHeadless(360, 200, L"Benchmark"))
+				return 1;
+
+			bench.LoopHeadless(nFrames, 1.0f / 60.0f);
+			bench.ReportTracker(bMoving ? L"moving" : L"static");
+		}
+	}
+
+	return 0;
+}
+
+#ifndef _WIN32
+int16_t RunAnsiBenchmark(int32_t nFrames)
+{
+	// Terminal side of the pty is read by a thread, like a terminal emulator would
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) || unlockpt(master))
+	{
+		wprintf(L"ERROR: can't open a pseudo terminal\n");
+		return 1;
+	}
+	int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+	if (slave < 0)
+	{
+		wprintf(L"ERROR: can't open a pseudo terminal\n");
+		close(master);
+		return 1;
+	}
+
+	termios raw;
+	tcgetattr(slave, &raw);
+	cfmakeraw(&raw);
+	tcsetattr(slave, TCSANOW, &raw);
+
+	std::atomic<uint64_t> nBytesRead(0);
+	std::thread reader([master, &nBytesRead]()
+		{
+			char buf[1 << 16];
+			ssize_t n;
+			while ((n = read(master, buf, sizeof(buf))) > 0)
+				nBytesRead += n;
+		});
+
+	wprintf(L"ANSI benchmark: %d frames per scene, 360x200 as 360x100 half blocks, written to a pty\n", nFrames);
+	wprintf(L"%-8ls %6ls %7ls | %10ls %10ls | %8ls %8ls %8ls\n", L"camera", L"send", L"meshes",
+		L"bytes", L"MB/s", L"frame", L"present", L"FPS");
+
+	int16_t result = 0;
+	for (bool bMoving : { false, true })
+	{
+		for (bool bDelta : { false, true })
+		{
+			for (int32_t nMeshes : { 2, 128 })
+			{
+				// Same frames without a terminal, to take the drawing out of the time
+				Benchmark headless(nMeshes);
+				headless.SetCameraMoving(bMoving);
+				if (headless.ConstructHeadless(360, 200, L"Benchmark"))
+				{
+					result = 1;
+					break;
+				}
+				float fHeadless = headless.LoopHeadless(nFrames, 1.0f / 60.0f);
+
+				Benchmark bench(nMeshes);
+				bench.SetCameraMoving(bMoving);
+				AnsiSurface* ansi = new AnsiSurface(slave);
+				ansi->bDelta = bDelta;
+				if (bench.ConstructSurface(ansi, 360, 200, 1, 1, L"Benchmark"))
+				{
+					result = 1;
+					break;
+				}
+				float fSeconds = bench.LoopHeadless(nFrames, 1.0f / 60.0f);
+				float fBytes = static_cast<float>(ansi->GetBytesTotal()) / nFrames;
+
+				wprintf(L"%-8ls %6ls %7d | %10.0f %10.1f | %8.3f %8.3f %8.1f\n",
+					bMoving ? L"moving" : L"static", bDelta ? L"delta" : L"full", nMeshes,
+					fBytes, fBytes * nFrames / fSeconds / 1e6f,
+					fSeconds / nFrames * 1000.0f, (fSeconds - fHeadless) / nFrames * 1000.0f, nFrames / fSeconds);
+			}
+		}
+	}
+
+	close(slave);
+	reader.join();
+	close(master);
+
+	return result;
+}
+#endif
+
+int16_t RunTransformBenchmark()
+{
+	const size_t nVertices = 3 * 400000;				// 400k triangles without shared vertices
+
+	wprintf(L"Transform benchmark: %zu vertices\n", nVertices);
+
+	Benchmark bench(0);
+	bench.ReportTransform(nVertices, 20);
+
+	return 0;
+}
+
+	// The math of Graphics before Math3D.h: loops with int16_t counters,
+	// sinf and cosf for every element and a product for every matrix
+namespace old_math
+{
+	struct mat4x4
+	{
+		float m[4][4] = { 0 };
+	};
+
+	static mat4x4 Multiply(mat4x4& m1, mat4x4& m2)
+	{
+		mat4x4 matrix;
+		for (int16_t c = 0; c < 4; c++)
+			for (int16_t r = 0; r < 4; r++)
+				matrix.m[r][c] = m1.m[r][0] * m2.m[0][c] + m1.m[r][1] * m2.m[1][c] + m1.m[r][2] * m2.m[2][c] + m1.m[r][3] * m2.m[3][c];
+		return matrix;
+	}
+
+	static void Transform(mat4x4& m, const float* v, float* out)
+	{
+		out[0] = v[0] * m.m[0][0] + v[1] * m.m[1][0] + v[2] * m.m[2][0] + v[3] * m.m[3][0];
+		out[1] = v[0] * m.m[0][1] + v[1] * m.m[1][1] + v[2] * m.m[2][1] + v[3] * m.m[3][1];
+		out[2] = v[0] * m.m[0][2] + v[1] * m.m[1][2] + v[2] * m.m[2][2] + v[3] * m.m[3][2];
+		out[3] = v[0] * m.m[0][3] + v[1] * m.m[1][3] + v[2] * m.m[2][3] + v[3] * m.m[3][3];
+	}
+
+	static mat4x4 MakeWorld(float ax, float ay, float az, float scale, float z)
+	{
+		mat4x4 rx, ry, rz, s, t;
+		rx.m[0][0] = 1.0f;
+		rx.m[1][1] = cosf(ax); rx.m[1][2] = sinf(ax);
+		rx.m[2][1] = -sinf(ax); rx.m[2][2] = cosf(ax);
+		rx.m[3][3] = 1.0f;
+		ry.m[0][0] = cosf(ay); ry.m[0][2] = sinf(ay);
+		ry.m[2][0] = -sinf(ay); ry.m[2][2] = cosf(ay);
+		ry.m[1][1] = 1.0f; ry.m[3][3] = 1.0f;
+		rz.m[0][0] = cosf(az); rz.m[0][1] = sinf(az);
+		rz.m[1][0] = -sinf(az); rz.m[1][1] = cosf(az);
+		rz.m[2][2] = 1.0f; rz.m[3][3] = 1.0f;
+		s.m[0][0] = s.m[1][1] = s.m[2][2] = scale; s.m[3][3] = 1.0f;
+		t.m[0][0] = t.m[1][1] = t.m[2][2] = t.m[3][3] = 1.0f;
+		t.m[3][2] = z;
+
+		mat4x4 w = Multiply(ry, rx);
+		w = Multiply(w, rz);
+		w = Multiply(w, s);
+		return Multiply(w, t);
+	}
+}
+
+void Benchmark::ReportScene(const wchar_t* name)
+{
+	if (vecFrameTime.empty())
+		return;
+
+	float fTotal = 0.0f;
+	for (float t : vecFrameTime)
+		fTotal += t;
+	float nFrames = static_cast<float>(vecFrameTime.size());
+
+	wprintf(L"%-6ls %-8ls %7d %7zu | %8.3f %8.3f %8.3f %8.3f | %8.0f %8.0f\n", GetModeName(mode), name, nMeshes,
+		scene.GetNodeCount(), fTotal / nFrames * 1000.0f, GetMeanTime(STAGE_CULL), GetMeanTime(STAGE_TRANSFORM) + GetMeanTime(STAGE_CLIP),
+		(fStageTotal[STAGE_ROBERTS] + fStageTotal[STAGE_RASTER]) / nFrames * 1000.0f,
+		nTestedTotal / nFrames, nVisibleTotal / nFrames);
+}
+
+int16_t RunSceneBenchmark(int32_t nInstances, int32_t nFrames)
+{
+	wprintf(L"Scene benchmark: %d instances on a grid wider than the view, %d frames, ms per frame\n", nInstances, nFrames);
+	wprintf(L"%-6ls %-8ls %7ls %7ls | %8ls %8ls %8ls %8ls | %8ls %8ls\n", L"mode", L"culling", L"inst", L"nodes",
+		L"frame", L"cull", L"transf", L"hidden", L"tested", L"visible");
+
+	// none: every instance goes to the vertex stage, flat: every instance is
+	// tested, groups: blocks of 8 x 8 instances are tested first
+	struct sVariant
+	{
+		const wchar_t* name;
+		bool bCulling, bGroups;
+	};
+	const sVariant variants[] = { { L"none", false, true }, { L"flat", true, false }, { L"groups", true, true } };
+
+	for (Benchmark::BENCH_MODE mode : { Benchmark::MODE_PAINT, Benchmark::MODE_ZBUF })
+	{
+		uint64_t nHash = 0;
+		for (const sVariant& variant : variants)
+		{
+			Benchmark bench(nInstances, mode);
+			bench.SetWideScene(true);
+			bench.SetCameraMoving(false);
+			bench.SetCulling(variant.bCulling, variant.bGroups);
+			if (bench.ConstructHeadless(360, 200, L"Benchmark"))
+				return 1;
+
+			bench.LoopHeadless(nFrames, 1.0f / 60.0f);
+			bench.ReportScene(variant.name);
+
+			// Culling mustn't change what is drawn: shadows come from the world, so
+			// unseen instances keep their shadows in the view
+			if (&variant != variants && bench.GetFramesHash() != nHash)
+				wprintf(L"ERROR: frames with culling by %ls differ from frames without it\n", variant.name);
+			nHash = bench.GetFramesHash();
+		}
+	}
+
+	return 0;
+}
+
+void Benchmark::ReportClip(const wchar_t* name)
+{
+	if (vecFrameTime.empty())
+		return;
+
+	float fTotal = 0.0f;
+	for (float t : vecFrameTime)
+		fTotal += t;
+	float nFrames = static_cast<float>(vecFrameTime.size());
+
+	wprintf(L"%-6ls %-4ls | %8.3f %8.3f %8.3f %8.3f | %8.0f %8.0f %8.0f\n", GetModeName(mode), name,
+		fTotal / nFrames * 1000.0f, GetMeanTime(STAGE_TRANSFORM), GetMeanTime(STAGE_CLIP),
+		(fStageTotal[STAGE_SHADOW] + fStageTotal[STAGE_ROBERTS] + fStageTotal[STAGE_RASTER]) / nFrames * 1000.0f,
+		nClipRejected / nFrames, nClipClipped / nFrames, nClipOutput / nFrames);
+}
+
+int16_t RunClipBenchmark(int32_t nFrames)
+{
+	// Rows start behind the camera, so the nearest instances cross the near plane
+	// and most of the others are out of the view by one side. Culling is off to
+	// leave all of them to the clipping stage
+	const int32_t nInstances = 2000;
+	wprintf(L"Clip benchmark: %d instances, rows from behind the camera, %d frames, ms per frame\n", nInstances, nFrames);
+	wprintf(L"%-6ls %-4ls | %8ls %8ls %8ls %8ls | %8ls %8ls %8ls\n", L"mode", L"clip",
+		L"frame", L"transf", L"clip", L"draw", L"rejected", L"clipped", L"output");
+
+	for (Benchmark::BENCH_MODE mode : { Benchmark::MODE_PAINT, Benchmark::MODE_ZBUF })
+	{
+		for (bool bClip : { false, true })
+		{
+			Benchmark bench(nInstances, mode);
+			bench.SetWideScene(true, -4.0f);
+			bench.SetCameraMoving(false);
+			bench.SetCulling(false, true);
+			bench.SetClipping(bClip);
+			if (bench.ConstructHeadless(360, 200, L"Benchmark"))
+				return 1;
+
+			bench.LoopHeadless(nFrames, 1.0f / 60.0f);
+			bench.ReportClip(bClip ? L"on" : L"off");
+		}
+	}
+
+	return 0;
+}
+
+void Benchmark::ReportBackFaces(const wchar_t* name)
+{
+	if (vecFrameTime.empty())
+		return;
+
+	float fTotal = 0.0f;
+	for (float t : vecFrameTime)
+		fTotal += t;
+	float nFrames = static_cast<float>(vecFrameTime.size());
+
+	wprintf(L"%-6ls %6d %-5ls | %8.3f %8.3f %8.3f %8.3f %8.3f | %8.0f %8.0f %6.1f%%\n", GetModeName(mode), nMeshes, name,
+		fTotal / nFrames * 1000.0f, GetMeanTime(STAGE_TRANSFORM) + GetMeanTime(STAGE_CLIP), GetMeanTime(STAGE_SORT),
+		GetMeanTime(STAGE_SHADOW), GetMeanTime(STAGE_ROBERTS) + GetMeanTime(STAGE_RASTER),
+		nFacesTotal / nFrames, nBackFacesTotal / nFrames, nFacesTotal ? 100.0f * nBackFacesTotal / nFacesTotal : 0.0f);
+}
+
+int16_t RunBackFaceBenchmark(int32_t nFrames)
+{
+	wprintf(L"Back-face benchmark: closed figures on the moving camera path, %d frames, ms per frame\n", nFrames);
+	wprintf(L"%-6ls %6ls %-5ls | %8ls %8ls %8ls %8ls %8ls | %8ls %8ls %7ls\n", L"mode", L"meshes", L"early",
+		L"frame", L"transf", L"sort", L"shadow", L"hidden", L"faces", L"back", L"removed");
+
+	for (Benchmark::BENCH_MODE mode : { Benchmark::MODE_PAINT, Benchmark::MODE_ZBUF })
+		for (int32_t nMeshes : { 128, 4096 })
+			for (bool bEarly : { false, true })
+			{
+				Benchmark bench(nMeshes, mode);
+				bench.SetBackFaceCulling(bEarly);
+				if (bench.ConstructHeadless(360, 200, L"Benchmark"))
+					return 1;
+
+				bench.LoopHeadless(nFrames, 1.0f / 60.0f);
+				bench.ReportBackFaces(bEarly ? L"on" : L"off");
+			}
+
+	return 0;
+}
+
+void Benchmark::ReportShadows()
+{
+	if (vecFrameTime.empty())
+		return;
+
+	float nFrames = static_cast<float>(vecFrameTime.size());
+	wprintf(L"%-6ls %6d %-6ls | %8.3f %8.0f | %8.0f %8.0f %8.0f\n", GetModeName(mode), nMeshes, bMoveCamera ? L"moving" : L"still",
+		GetMeanTime(STAGE_SHADOW), nShadowRebuilds / nFrames * 100.0f,
+		nShadowRebuilds ? static_cast<float>(nShadowFaces) / nShadowRebuilds : 0.0f, nShadowArea / nFrames,
+		static_cast<float>(shadowStats.nCasters));
+}
+
+int16_t RunShadowBenchmark(int32_t nFrames)
+{
+	wprintf(L"Shadow benchmark: %d frames, ms per frame\n", nFrames);
+	wprintf(L"%-6ls %6ls %-6ls | %8ls %8ls | %8ls %8ls %8ls\n", L"mode", L"meshes", L"camera",
+		L"shadow", L"rebuilt%", L"faces", L"cells", L"casters");
+
+	for (int32_t nMeshes : { 2, 128, 4096 })
+		for (bool bMove : { false, true })
+		{
+			Benchmark bench(nMeshes, Benchmark::MODE_PAINT);
+			bench.SetCameraMoving(bMove);
+			if (bench.ConstructHeadless(360, 200, L"Benchmark"))
+				return 1;
+
+			bench.LoopHeadless(nFrames, 1.0f / 60.0f);
+			bench.ReportShadows();
+		}
+
+	return 0;
+}
+
+void Benchmark::ReportEdges(int32_t nTriangles, const wchar_t* name)
+{
+	if (vecFrameTime.empty())
+		return;
+
+	float fTotal = 0.0f;
+	for (float t : vecFrameTime)
+		fTotal += t;
+	float nFrames = static_cast<float>(vecFrameTime.size());
+	float nRebuilds = nShadowRebuilds ? static_cast<float>(nShadowRebuilds) : 1.0f;
+
+	wprintf(L"%6d %6d %-5ls | %8.3f %8.3f %8.3f | %8.0f %8.0f %8.0f\n", nTriangles, nMeshes, name,
+		fTotal / nFrames * 1000.0f, GetMeanTime(STAGE_SHADOW), GetMeanTime(STAGE_ROBERTS),
+		nShadowFaces / nRebuilds, nShadowEdges / nRebuilds, nShadowArea / nFrames);
+}
+
+int16_t RunEdgeBenchmark(int32_t nFrames)
+{
+	// Closed UV spheres: a pole is one vertex, every edge is shared by two faces
+	const char* obj_path = "bench_edges.obj";
+
+	wprintf(L"Edge benchmark: spheres on the moving camera path, paint mode, %d frames, ms per frame\n", nFrames);
+	wprintf(L"%6ls %6ls %-5ls | %8ls %8ls %8ls | %8ls %8ls %8ls\n", L"tris", L"meshes", L"edges",
+		L"frame", L"shadow", L"roberts", L"lit", L"silhou.", L"cells");
+
+	for (int32_t nStacks : { 8, 32, 64 })
+	{
+		int32_t nSlices = 2 * nStacks;
+		FILE* file = std::fopen(obj_path, "w");
+		if (!file)
+			return 1;
+
+		const float fPi = 3.14159265f;
+		std::fprintf(file, "v 0.5 1.0 0.5\n");
+		for (int32_t j = 1; j < nStacks; j++)
+			for (int32_t i = 0; i < nSlices; i++)
+			{
+				float fTheta = fPi * j / nStacks, fPhi = 2.0f * fPi * i / nSlices;
+				std::fprintf(file, "v %.5f %.5f %.5f\n", 0.5f + 0.5f * sinf(fTheta) * cosf(fPhi), 0.5f + 0.5f * cosf(fTheta),
+					0.5f + 0.5f * sinf(fTheta) * sinf(fPhi));
+			}
+		std::fprintf(file, "v 0.5 0.0 0.5\n");
+
+		// Vertex of ring j (1...nStacks - 1) and slice i, OBJ counts from 1
+		auto vertex = [nSlices](int32_t j, int32_t i) { return 2 + (j - 1) * nSlices + i % nSlices; };
+		int32_t nBottom = 2 + (nStacks - 1) * nSlices;
+		for (int32_t i = 0; i < nSlices; i++)
+		{
+			std::fprintf(file, "f 1 %d %d\n", vertex(1, i + 1), vertex(1, i));
+			for (int32_t j = 1; j + 1 < nStacks; j++)
+				std::fprintf(file, "f %d %d %d\nf %d %d %d\n", vertex(j, i), vertex(j, i + 1), vertex(j + 1, i + 1),
+					vertex(j, i), vertex(j + 1, i + 1), vertex(j + 1, i));
+			std::fprintf(file, "f %d %d %d\n", nBottom, vertex(nStacks - 1, i), vertex(nStacks - 1, i + 1));
+		}
+		std::fclose(file);
+
+		int32_t nTriangles = 2 * nSlices * (nStacks - 1);
+		for (int32_t nMeshes : { 2, 16 })
+			for (bool bEdges : { false, true })
+			{
+				Benchmark bench(nMeshes, Benchmark::MODE_PAINT);
+				bench.AddModel(obj_path);
+				bench.SetMeshEdges(bEdges);
+				if (bench.ConstructHeadless(360, 200, L"Benchmark"))
+					return 1;
+
+				bench.LoopHeadless(nFrames, 1.0f / 60.0f);
+				bench.ReportEdges(nTriangles, bEdges ? L"on" : L"off");
+			}
+	}
+
+	std::remove(obj_path);
+	return 0;
+}
+
+int16_t RunDepthSortBenchmark(int32_t nMaxTriangles)
+{
+	// Same layout as the triangles of the render path
+	struct triangle
+	{
+		struct { float x, y, z, w; } points[3];
+		int16_t sym, col;
+	};
+
+	wprintf(L"Depth sort benchmark: ms per sort of the triangles of one figure\n");
+	wprintf(L"%9ls | %9ls %9ls %9ls | %8ls %8ls | %8ls %8ls\n", L"tris", L"std", L"radix", L"coherent",
+		L"x radix", L"x coher", L"moves", L"fallback");
+
+	for (size_t n = 10000; n <= static_cast<size_t>(nMaxTriangles); n *= 10)
+	{
+		// Small triangles all over the screen, the depths of a figure are close
+		uint32_t seed = 12345;
+		auto next = [&seed]()
+		{
+			seed = seed * 1664525u + 1013904223u;
+			return static_cast<float>(seed >> 8) * (1.0f / 16777216.0f);
+		};
+		std::vector<triangle> source(n), work(n), sorted(n);
+		for (triangle& tri : source)
+		{
+			float x = 360.0f * next(), y = 200.0f * next(), z = 0.9f + 0.1f * next();
+			for (int16_t i = 0; i < 3; i++)
+				tri.points[i] = { x + 4.0f * next(), y + 4.0f * next(), z + 0.001f * next(), 1.0f };
+		}
+
+		std::vector<float> depths(n);
+		auto average = [](const triangle& tri) { return (tri.points[0].z + tri.points[1].z + tri.points[2].z) / 3.0f; };
+		auto make_depths = [&]()
+		{
+			for (size_t k = 0; k < n; k++)
+				depths[k] = average(source[k]);
+		};
+		auto ms = [](std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b)
+		{
+			return std::chrono::duration<float>(b - a).count() * 1000.0f;
+		};
+
+		int32_t nRepeats = std::max<int32_t>(3, static_cast<int32_t>(1000000 / n));
+		float fStd = 0.0f, fRadix = 0.0f, fCoherent = 0.0f;
+		bool bOk = true;
+
+		// Sorted triangles must have the depths of std::sort
+		auto check = [&]()
+		{
+			for (size_t k = 0; k < n; k++)
+				bOk = bOk && average(sorted[k]) == average(work[k]);
+		};
+
+		DepthSort radix, coherent;
+		radix.SetCoherent(false);
+		make_depths();
+		radix.Reserve(n);
+		coherent.Reserve(n);
+		coherent.ReserveHistory(0, n);
+		coherent.Sort(depths.data(), n, 0);					// The frame before the first one
+
+		for (int32_t r = 0; r < nRepeats; r++)
+		{
+			// The camera moves a little: depths change by about the gap between two of them
+			float fShift = 0.2f / static_cast<float>(n);
+			for (triangle& tri : source)
+				for (int16_t i = 0; i < 3; i++)
+					tri.points[i].z += fShift * sinf(0.05f * tri.points[i].x + static_cast<float>(r));
+
+			work = source;
+			auto tp1 = std::chrono::steady_clock::now();
+			std::sort(work.begin(), work.end(), [](triangle& t1, triangle& t2)
+				{
+					float z1 = (t1.points[0].z + t1.points[1].z + t1.points[2].z) / 3.0f;
+					float z2 = (t2.points[0].z + t2.points[1].z + t2.points[2].z) / 3.0f;
+					return z1 > z2;
+				});
+			auto tp2 = std::chrono::steady_clock::now();
+
+			// Both DepthSort runs include the depths and the copy in the new order
+			make_depths();
+			const uint32_t* order = radix.Sort(depths.data(), n);
+			for (size_t k = 0; k < n; k++)
+				sorted[k] = source[order[k]];
+			auto tp3 = std::chrono::steady_clock::now();
+			check();
+
+			auto tp4 = std::chrono::steady_clock::now();
+			make_depths();
+			order = coherent.Sort(depths.data(), n, 0);
+			for (size_t k = 0; k < n; k++)
+				sorted[k] = source[order[k]];
+			auto tp5 = std::chrono::steady_clock::now();
+			check();
+
+			fStd += ms(tp1, tp2);
+			fRadix += ms(tp2, tp3);
+			fCoherent += ms(tp4, tp5);
+		}
+
+		const sDepthSortStats& stats = coherent.GetStats();
+		wprintf(L"%9zu | %9.3f %9.3f %9.3f | %7.2fx %7.2fx | %8.2f %8u\n", n, fStd / nRepeats, fRadix / nRepeats,
+			fCoherent / nRepeats, fStd / fRadix, fStd / fCoherent,
+			static_cast<double>(stats.nMoves) / (static_cast<double>(n) * nRepeats), stats.nFallbacks);
+		if (!bOk)
+		{
+			wprintf(L"ERROR: DepthSort order differs from std::sort\n");
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int16_t RunMathBenchmark(int32_t nRepeats)
+{
+	using namespace math3d;
+
+	auto measure = [](int32_t nCount, auto&& body)
+	{
+		auto tp1 = std::chrono::steady_clock::now();
+		for (int32_t i = 0; i < nCount; i++)
+			body(i);
+		return std::chrono::duration<float>(std::chrono::steady_clock::now() - tp1).count() / nCount * 1e9f;
+	};
+	auto angle = [](int32_t i) { return static_cast<float>(i & 1023) * 0.0061f; };
+
+	volatile float fSink = 0.0f;							// Keeps the results alive
+	float fMaxDiff = 0.0f;
+
+	wprintf(L"Math benchmark: %d repeats\n", nRepeats);
+	wprintf(L"%-10ls %12ls %12ls %8ls\n", L"", L"old ns", L"Math3D ns", L"speedup");
+
+	// Chain of products, every one needs the previous
+	mat4 rot = MakeRotationY(0.01f);
+	old_math::mat4x4 old_rot, old_acc;
+	std::memcpy(old_rot.m, rot.m, sizeof(rot.m));
+	old_acc.m[0][0] = old_acc.m[1][1] = old_acc.m[2][2] = old_acc.m[3][3] = 1.0f;
+	mat4 acc = MakeIdentity();
+
+	float fOld = measure(nRepeats, [&](int32_t) { old_acc = old_math::Multiply(old_acc, old_rot); });
+	float fNew = measure(nRepeats, [&](int32_t) { acc = acc * rot; });
+	fSink = fSink + old_acc.m[0][0] + acc.m[0][0];
+	for (int16_t r = 0; r < 4; r++)
+		for (int16_t c = 0; c < 4; c++)
+			fMaxDiff = std::max(fMaxDiff, fabsf(old_acc.m[r][c] - acc.m[r][c]));
+	wprintf(L"%-10ls %12.2f %12.2f %7.2fx\n", L"multiply", fOld, fNew, fOld / fNew);
+
+	// Vector by the same matrix, like vertices of a mesh
+	mat4 world = MakeWorldYXZ(0.3f, 0.2f, 0.1f, 1.5f, { 0.0f, 0.0f, 4.0f });
+	old_math::mat4x4 old_world;
+	std::memcpy(old_world.m, world.m, sizeof(world.m));
+	float v_old[4] = { 0.0f, 0.0f, 0.0f, 1.0f }, v_out[4] = {};
+	vec4 v_new = { 0.0f, 0.0f, 0.0f, 1.0f };
+
+	fOld = measure(nRepeats, [&](int32_t i)
+		{
+			v_old[0] = static_cast<float>(i & 255);
+			old_math::Transform(old_world, v_old, v_out);
+			fSink = fSink + v_out[2];
+		});
+	fNew = measure(nRepeats, [&](int32_t i)
+		{
+			v_new.x = static_cast<float>(i & 255);
+			fSink = fSink + Transform(world, v_new).z;
+		});
+	wprintf(L"%-10ls %12.2f %12.2f %7.2fx\n", L"transform", fOld, fNew, fOld / fNew);
+
+	// World matrix of a frame: three rotations, scaling and translation
+	fOld = measure(nRepeats, [&](int32_t i)
+		{
+			old_math::mat4x4 m = old_math::MakeWorld(angle(i), angle(i + 7), angle(i + 13), 1.5f, 4.0f);
+			fSink = fSink + m.m[2][1];
+		});
+	fNew = measure(nRepeats, [&](int32_t i)
+		{
+			mat4 m = MakeWorldYXZ(angle(i), angle(i + 7), angle(i + 13), 1.5f, { 0.0f, 0.0f, 4.0f });
+			fSink = fSink + m.m[2][1];
+		});
+	wprintf(L"%-10ls %12.2f %12.2f %7.2fx\n", L"world", fOld, fNew, fOld / fNew);
+
+	for (int32_t i = 0; i < 1024; i++)
+	{
+		old_math::mat4x4 m_old = old_math::MakeWorld(angle(i), angle(i + 7), angle(i + 13), 1.5f, 4.0f);
+		mat4 m_new = MakeWorldYXZ(angle(i), angle(i + 7), angle(i + 13), 1.5f, { 0.0f, 0.0f, 4.0f });
+		for (int16_t r = 0; r < 4; r++)
+			for (int16_t c = 0; c < 4; c++)
+				fMaxDiff = std::max(fMaxDiff, fabsf(m_old.m[r][c] - m_new.m[r][c]));
+	}
+	wprintf(L"Largest difference from the old results: %g\n", fMaxDiff);
+
+	return 0;
+}
+
+int16_t RunLoadBenchmark(int32_t nTriangles)
+{
+	const char* obj_path = "bench_load.obj";
+	const char* kgm_path = "bench_load.kgm";
+
+	// Square grid with about nTriangles triangles
+	int32_t nSide = static_cast<int32_t>(sqrtf(nTriangles / 2.0f));
+	if (nSide < 1)
+		nSide = 1;
+
+	FILE* file = std::fopen(obj_path, "w");
+	if (!file)
+		return 1;
+
+	for (int32_t j = 0; j <= nSide; j++)
+		for (int32_t i = 0; i <= nSide; i++)
+			std::fprintf(file, "v %.4f %.4f %.4f\n", i * 0.01f, 0.1f * sinf(i * 0.05f + j * 0.07f), j * 0.01f);
+
+	for (int32_t j = 0; j < nSide; j++)
+		for (int32_t i = 0; i < nSide; i++)
+		{
+			int32_t v = j * (nSide + 1) + i + 1;
+			std::fprintf(file, "f %d %d %d\nf %d %d %d\n", v, v + 1, v + nSide + 2, v, v + nSide + 2, v + nSide + 1);
+		}
+	std::fclose(file);
+
+	wprintf(L"Load benchmark: %d triangles\n", 2 * nSide * nSide);
+
+	auto tp1 = std::chrono::steady_clock::now();
+	indexedMesh model;
+	if (LoadObj(obj_path, model, PIXEL_SOLID, FG_WHITE))
+		return 1;
+	auto tp2 = std::chrono::steady_clock::now();
+
+	if (SaveBinaryMesh(kgm_path, model.View()))
+		return 1;
+
+	auto tp3 = std::chrono::steady_clock::now();
+	MappedMesh mapped;
+	if (mapped.Open(kgm_path))
+		return 1;
+	auto tp4 = std::chrono::steady_clock::now();
+
+	// First pass over the mapped data pages it in, like the first frame would
+	const sMeshView& view = mapped.View();
+	float fSum = 0.0f;
+	for (uint32_t i = 0; i < view.nVertices; i++)
+		fSum += view.x[i] + view.y[i] + view.z[i];
+	for (uint32_t i = 0; i < 3 * view.nFaces; i++)
+		fSum += static_cast<float>(view.Index(i));
+	auto tp5 = std::chrono::steady_clock::now();
+
+	auto ms = [](std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b)
+	{
+		return std::chrono::duration<float>(b - a).count() * 1000.0f;
+	};
+
+	wprintf(L"%-16ls %10.3f ms  (%u vertices, %u faces)\n", L"OBJ parse", ms(tp1, tp2), model.View().nVertices, model.View().nFaces);
+	wprintf(L"%-16ls %10.3f ms\n", L"kgm map", ms(tp3, tp4));
+	wprintf(L"%-16ls %10.3f ms  (checksum %.1f)\n", L"kgm first touch", ms(tp4, tp5), fSum);
+
+	mapped.Close();
+	std::remove(obj_path);
+	std::remove(kgm_path);
+
+	return 0;
+}
@@ -0,0 +1,131 @@
+#ifndef _BENCHMARK_H_
+#define _BENCHMARK_H_
+
+#include "DirtyTracker.h"
+#include "NewGarphics.h"
+
+	// Headless run of the NewGarphics frame over a fixed camera path.
+	// The scene is made of nMeshes copies of the pyramid and the prism.
+class Benchmark : public NewGarphics
+{
+public:
+	enum BENCH_MODE
+	{
+		MODE_PAINT,								// Sort + Roberts
+		MODE_ZBUF,								// RasterTriangleDepth
+		MODE_TILED								// RasterTrianglesDepthTiled
+	};
+
+private:
+	int32_t nMeshes;
+	BENCH_MODE mode;
+	int32_t nThreads;							// For MODE_TILED, 0 - one per core
+	bool bBackground;							// Frames restore the cached background
+	bool bMoveCamera;							// Else every frame is the same
+	bool bWideScene;							// Grid far wider than the view, most instances unseen
+	float fWideStartZ;							// First row of the wide grid, < 0 - rows behind the camera
+	bool bCulling;								// Frustum culling of the scene graph
+	bool bGroups;								// Instances are in groups of 8 x 8, else all under the root
+	bool bClip;									// Clipping stage, else triangles go to the raster as they are
+	bool bBackFaces;							// Back faces dropped before projection, else by RobertsAlgorithm
+	bool bEdges;								// Edges of the meshes for outlines and shadows
+	uint64_t nVisibleTotal, nTestedTotal;		// Cull results of all frames
+	uint64_t nClipRejected, nClipClipped, nClipOutput;	// Clip results of all frames
+	uint64_t nFacesTotal, nBackFacesTotal;
+	uint64_t nShadowRebuilds, nShadowFaces, nShadowEdges, nShadowArea;
+
+	DirtyTracker* pTracker;						// Finds changed cells of every frame, if set
+	uint64_t nTrackedCells, nTrackedRectCells, nTrackedRects;
+	float fTrackTime;
+	float fPathTime;							// Position on the camera path
+
+	std::vector<float> vecFrameTime;			// Seconds of every frame
+	float fStageTotal[STAGE_COUNT];				// Seconds of every stage for all frames
+	uint64_t nFramesHash;						// Of all drawn frames, to compare modes
+	int64_t nSteadyAllocations;					// Heap allocations after the warm-up frames (KG_PROFILE)
+
+	int32_t nFillDepth;							// Deepest call of FillRecursive
+	uintptr_t nFillStackTop;					// Stack address of the first call
+	size_t nFillStackBytes;						// Stack used by the deepest call
+	size_t nFillStackLimit;						// FillRecursive stops past it, the thread has a bit more
+	bool bFillOutOfStack;						// FillRecursive reached nFillStackLimit
+
+public:
+	Benchmark(int32_t nMeshes, BENCH_MODE mode = MODE_PAINT, int32_t nThreads = 0);
+
+	void Report();
+	void ReportTransform(size_t nVertices, int32_t nRepeats);
+	void ReportClear(int32_t nRepeats);
+	int16_t ReportFill(float fScale, int32_t nRepeats);
+
+	void SetBackgroundCache(bool bEnable) { bBackground = bEnable; }
+	void SetCameraMoving(bool bEnable) { bMoveCamera = bEnable; }
+	void SetDirtyTracker(DirtyTracker* tracker) { pTracker = tracker; }
+	void ReportTracker(const wchar_t* name);
+	void SetWideScene(bool bEnable, float fStartZ = 2.0f) { bWideScene = bEnable; fWideStartZ = fStartZ; }
+	void SetCulling(bool bEnable, bool bGroups) { bCulling = bEnable; this->bGroups = bGroups; }
+	void SetClipping(bool bEnable) { bClip = bEnable; }
+	void SetBackFaceCulling(bool bEnable) { bBackFaces = bEnable; }
+	void SetMeshEdges(bool bEnable) { bEdges = bEnable; }
+	void ReportScene(const wchar_t* name);
+	void ReportClip(const wchar_t* name);
+	void ReportBackFaces(const wchar_t* name);
+	void ReportShadows();
+	void ReportEdges(int32_t nTriangles, const wchar_t* name);
+
+	float GetMeanTime(FRAME_STAGE stage) const;	// ms per frame
+	uint64_t GetFramesHash() const { return nFramesHash; }
+	int64_t GetSteadyAllocations() const { return nSteadyAllocations; }
+	size_t GetArenaPeakBytes() const { return frameArena.GetPeakBytes(); }
+
+	static const int32_t nWarmUpFrames = 10;	// Arena and buffers reach their size
+	static const size_t nFillStackPerCell = 512;	// Of FillRecursive, a call fills one cell
+	static const wchar_t* GetModeName(BENCH_MODE mode);
+
+protected:
+	virtual void OnUserCreate() override;
+	virtual void OnUserUpdate(float fElapsedTime) override;
+
+private:
+	void MoveCamera(float fElapsedTime);
+	void FillRecursive(int16_t x, int16_t y, int16_t sym, int16_t col, int16_t col_edges, int32_t nDepth);
+};
+
+	// Runs the scenes from 2 to thousands of meshes in both modes and prints the table
+int16_t RunBenchmarks(int32_t nFrames);
+	// Tiled z-buffer with 1, 2, 4 ... threads against the single-threaded one
+int16_t RunThreadBenchmark(int32_t nFrames);
+	// Frames after the warm-up must not touch the heap, returns 1 if they do
+int16_t RunAllocationCheck(int32_t nFrames);
+	// Cells and rects the console would get with the dirty tracker, against full frames
+int16_t RunPresentBenchmark(int32_t nFrames);
+#ifndef _WIN32
+	// Frames sent to a pseudo terminal through AnsiSurface, bytes and time per frame
+int16_t RunAnsiBenchmark(int32_t nFrames);
+#endif
+	// Per-cell Fill against the row fills, Clear and the background restore
+int16_t RunClearBenchmark(int32_t nFrames);
+	// Recursive seed fill of the first version against the span fill on big triangles:
+	// pixels per second, depth and stack of the recursion, heap of the seed stack
+int16_t RunFillBenchmark(int32_t nRepeats);
+	// Per-vertex MultiplyMatrixVector path against the TransformBatch kernels
+int16_t RunTransformBenchmark();
+	// Culling of the scene graph off, flat and by groups, with most instances out of the view
+int16_t RunSceneBenchmark(int32_t nInstances, int32_t nFrames);
+	// Clipping stage on and off with rows of instances across the near plane
+int16_t RunClipBenchmark(int32_t nFrames);
+	// Back faces of the closed figures dropped before projection against RobertsAlgorithm
+int16_t RunBackFaceBenchmark(int32_t nFrames);
+	// Shadow mask with the camera still and moving: rebuilds, faces, area and time
+int16_t RunShadowBenchmark(int32_t nFrames);
+	// Outlines once per edge and shadows from the silhouettes against the faces one by one, dense spheres
+int16_t RunEdgeBenchmark(int32_t nFrames);
+	// std::sort of the triangles with the average depth lambda against DepthSort,
+	// from scratch and from the order of the last frame, 10k triangles up to nMaxTriangles
+int16_t RunDepthSortBenchmark(int32_t nMaxTriangles);
+	// Old matrix code of Graphics against Math3D.h: products, vectors and the world matrix
+int16_t RunMathBenchmark(int32_t nRepeats);
+	// OBJ parsing against mapping of the same mesh saved as .kgm
+int16_t RunLoadBenchmark(int32_t nTriangles);
+
+#endif // !_BENCHMARK_H_
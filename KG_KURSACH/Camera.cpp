@@ -0,0 +1,158 @@
+#include "Camera.h"
+#include "Profiler.h"
+
+#include <cstring>
+
+Camera::Camera()
+{
+	fAngleX = fAngleY = fAngleZ = 0.0f;
+	fScale = 1.0f;
+	position = { 0.0f, 0.0f, 0.0f };
+
+	fFov = 90.0f;
+	fAspectRatio = 1.0f;
+	fNear = 0.1f;
+	fFar = 1000.0f;
+
+	matView = math3d::MakeIdentity();
+	bViewIdentity = true;
+	viewport = { 0.0f, 0.0f, 1.0f, 1.0f };
+	fWidth = fHeight = 2.0f;
+
+	nDirty = DIRTY_WORLD | DIRTY_PROJECTION | DIRTY_COMBINED | DIRTY_FRUSTUM;
+	nBuilds = 0;
+	nViewports = 0;
+}
+
+void Camera::SetWorld(float fAngleX, float fAngleY, float fAngleZ, float fScale, const math3d::vec3& position)
+{
+	if (fAngleX == this->fAngleX && fAngleY == this->fAngleY && fAngleZ == this->fAngleZ && fScale == this->fScale
+		&& position.x == this->position.x && position.y == this->position.y && position.z == this->position.z)
+		return;
+
+	this->fAngleX = fAngleX;
+	this->fAngleY = fAngleY;
+	this->fAngleZ = fAngleZ;
+	this->fScale = fScale;
+	this->position = position;
+	nDirty |= DIRTY_WORLD | DIRTY_COMBINED | DIRTY_FRUSTUM;
+}
+
+void Camera::SetView(const math3d::mat4& view)
+{
+	if (!std::memcmp(view.m, matView.m, sizeof(matView.m)))
+		return;
+
+	const math3d::mat4 identity = math3d::MakeIdentity();
+	matView = view;
+	bViewIdentity = !std::memcmp(view.m, identity.m, sizeof(identity.m));
+	nDirty |= DIRTY_VIEW | DIRTY_COMBINED | DIRTY_FRUSTUM;
+}
+
+void Camera::SetProjection(float fFovDegrees, float fAspectRatio, float fNear, float fFar)
+{
+	if (fFovDegrees == fFov && fAspectRatio == this->fAspectRatio && fNear == this->fNear && fFar == this->fFar)
+		return;
+
+	fFov = fFovDegrees;
+	this->fAspectRatio = fAspectRatio;
+	this->fNear = fNear;
+	this->fFar = fFar;
+	nDirty |= DIRTY_PROJECTION | DIRTY_COMBINED | DIRTY_FRUSTUM;
+}
+
+void Camera::SetViewport(const sViewport& viewport, float fWidth, float fHeight)
+{
+	// Applied after the divide by w, so it never makes the matrices dirty
+	if (viewport.offset_x == this->viewport.offset_x && viewport.offset_y == this->viewport.offset_y
+		&& viewport.scale_x == this->viewport.scale_x && viewport.scale_y == this->viewport.scale_y
+		&& fWidth == this->fWidth && fHeight == this->fHeight)
+		return;
+
+	this->viewport = viewport;
+	this->fWidth = fWidth;
+	this->fHeight = fHeight;
+	nDirty |= DIRTY_FRUSTUM;
+	nViewports++;
+}
+
+const math3d::mat4& Camera::GetWorld()
+{
+	Update();
+	return matWorld;
+}
+
+const math3d::mat4& Camera::GetProjection()
+{
+	Update();
+	return matProj;
+}
+
+const math3d::mat4& Camera::GetWorldViewProj()
+{
+	Update();
+	return matWorldViewProj;
+}
+
+const sFrustum& Camera::GetFrustum()
+{
+	Update();
+	if (!(nDirty & DIRTY_FRUSTUM))
+		return frustum;
+
+	// The console gets x = (-x/w + offset_x) * scale_x, so 0 <= x < fWidth is
+	// offset_x * w - x >= 0 and x + (fWidth / scale_x - offset_x) * w >= 0 in clip space.
+	// Near is z >= 0 and far is z <= w. A clip plane c of v * M is the plane M * c of v
+	const float clip[6][4] =
+	{
+		{ -1.0f, 0.0f, 0.0f, viewport.offset_x },
+		{ 1.0f, 0.0f, 0.0f, fWidth / viewport.scale_x - viewport.offset_x },
+		{ 0.0f, -1.0f, 0.0f, viewport.offset_y },
+		{ 0.0f, 1.0f, 0.0f, fHeight / viewport.scale_y - viewport.offset_y },
+		{ 0.0f, 0.0f, 1.0f, 0.0f },
+		{ 0.0f, 0.0f, -1.0f, 1.0f }
+	};
+
+	const math3d::mat4& m = matWorldViewProj;
+	for (int16_t p = 0; p < 6; p++)
+	{
+		float plane[4];
+		for (int16_t i = 0; i < 4; i++)
+			plane[i] = m.m[i][0] * clip[p][0] + m.m[i][1] * clip[p][1] + m.m[i][2] * clip[p][2] + m.m[i][3] * clip[p][3];
+
+		float fLength = math3d::Length({ plane[0], plane[1], plane[2] });
+		if (fLength > 0.0f)
+			for (int16_t i = 0; i < 4; i++)
+				plane[i] /= fLength;
+
+		frustum.planes[p] = { plane[0], plane[1], plane[2], plane[3] };
+	}
+
+	nDirty &= ~DIRTY_FRUSTUM;
+	return frustum;
+}
+
+void Camera::Update()
+{
+	if (!(nDirty & ~DIRTY_FRUSTUM))
+		return;
+
+	if (nDirty & DIRTY_WORLD)
+	{
+		matWorld = math3d::MakeWorldYXZ(fAngleX, fAngleY, fAngleZ, fScale, position);
+		nBuilds++;
+	}
+	if (nDirty & DIRTY_PROJECTION)
+	{
+		matProj = math3d::MakeProjection(fFov, fAspectRatio, fNear, fFar);
+		nBuilds++;
+	}
+	if (nDirty & DIRTY_COMBINED)
+	{
+		matWorldViewProj = bViewIdentity ? matWorld * matProj : matWorld * matView * matProj;
+		nBuilds++;
+	}
+
+	PROFILE_COUNT(COUNTER_MATRIX_BUILDS, ((nDirty & DIRTY_WORLD) != 0) + ((nDirty & DIRTY_PROJECTION) != 0) + ((nDirty & DIRTY_COMBINED) != 0));
+	nDirty &= DIRTY_FRUSTUM;							// Built by GetFrustum when it is asked for
+}
@@ -0,0 +1,81 @@
+#ifndef _CAMERA_H_
+#define _CAMERA_H_
+
+#include <cstdint>
+
+#include "Math3D.h"
+#include "VertexTransform.h"
+
+//###################//
+	// Camera
+//###################//
+
+	// Visible part of the scene: dot(plane.xyz, p) + plane.w >= 0 for all
+	// planes (left, right, top, bottom, near, far). Normals are of unit length
+struct sFrustum
+{
+	math3d::vec4 planes[6];
+};
+
+	// World, view and projection matrices and the viewport of the scene.
+	// Setters only compare the parameters and mark what changed, the
+	// matrices are built when they are asked for. A frame with the same
+	// parameters does no matrix work
+class Camera
+{
+public:
+	enum DIRTY_FLAG
+	{
+		DIRTY_WORLD = 0x01,
+		DIRTY_VIEW = 0x02,
+		DIRTY_PROJECTION = 0x04,
+		DIRTY_COMBINED = 0x08,							// World * view * projection
+		DIRTY_FRUSTUM = 0x10
+	};
+
+private:
+	float fAngleX, fAngleY, fAngleZ;
+	float fScale;
+	math3d::vec3 position;
+
+	float fFov, fAspectRatio, fNear, fFar;
+
+	math3d::mat4 matWorld;
+	math3d::mat4 matView;
+	math3d::mat4 matProj;
+	math3d::mat4 matWorldViewProj;
+	bool bViewIdentity;									// World * view is skipped
+
+	sViewport viewport;
+	float fWidth, fHeight;								// Of the console the viewport maps to
+	sFrustum frustum;									// In the space before the world matrix
+
+	uint8_t nDirty;
+	uint64_t nBuilds;									// Matrices built since the start
+	uint64_t nViewports;								// Changes of the viewport since the start
+
+public:
+	Camera();
+
+		// RotationY * RotationX * RotationZ * Scaling * Translation of the figures
+	void SetWorld(float fAngleX, float fAngleY, float fAngleZ, float fScale, const math3d::vec3& position);
+	void SetView(const math3d::mat4& view);
+	void SetProjection(float fFovDegrees, float fAspectRatio, float fNear, float fFar);
+	void SetViewport(const sViewport& viewport, float fWidth, float fHeight);
+
+	const math3d::mat4& GetWorld();
+	const math3d::mat4& GetView() const { return matView; }
+	const math3d::mat4& GetProjection();
+	const math3d::mat4& GetWorldViewProj();				// The only matrix the vertex stage needs
+	const sViewport& GetViewport() const { return viewport; }
+	const sFrustum& GetFrustum();
+
+	bool IsDirty() const { return nDirty != 0; }
+	uint64_t GetBuildCount() const { return nBuilds; }
+	uint64_t GetViewportCount() const { return nViewports; }	// Screen coords change with it, the matrices don't
+
+private:
+	void Update();
+};
+
+#endif // !_CAMERA_H_
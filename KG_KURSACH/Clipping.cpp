@@ -0,0 +1,110 @@
+#include "Clipping.h"
+
+uint8_t GetClipCode(float x, float y, float z, float w, const sClipRect& screen, const sClipRect& guard)
+{
+	// Behind the camera the divide flips x and y, so only the near side is known
+	if (!(w > 0.0f) || !(z >= 0.0f))
+		return CLIP_NEAR;
+
+	uint8_t code = (z > 1.0f) ? CLIP_FAR : 0;
+	if (x < screen.x1)
+		code |= CLIP_LEFT;
+	else if (x > screen.x2)
+		code |= CLIP_RIGHT;
+	if (y < screen.y1)
+		code |= CLIP_TOP;
+	else if (y > screen.y2)
+		code |= CLIP_BOTTOM;
+
+	if (!(x >= guard.x1 && x <= guard.x2 && y >= guard.y1 && y <= guard.y2))
+		code |= CLIP_GUARD;
+	return code;
+}
+
+	// One plane of Sutherland-Hodgman: distance >= 0 is kept, cut points are made by lerp
+template <typename DISTANCE, typename LERP>
+static size_t ClipByPlane(const math3d::vec4* in, size_t n, math3d::vec4* out, DISTANCE&& distance, LERP&& lerp)
+{
+	size_t nOut = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		const math3d::vec4& a = in[i];
+		const math3d::vec4& b = in[(i + 1 == n) ? 0 : i + 1];
+		float da = distance(a), db = distance(b);
+
+		if (da >= 0.0f)
+			out[nOut++] = a;
+		if ((da >= 0.0f) != (db >= 0.0f))
+			out[nOut++] = lerp(a, b, da / (da - db));
+	}
+	return nOut;
+}
+
+size_t ClipPolygonDepth(const math3d::vec4* in, size_t n, math3d::vec4* out)
+{
+	// Everything is linear before the divide
+	auto lerp = [](const math3d::vec4& a, const math3d::vec4& b, float t) -> math3d::vec4
+	{
+		return { a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t };
+	};
+
+	math3d::vec4 temp[16];
+	size_t nTemp = ClipByPlane(in, n, temp, [](const math3d::vec4& v) { return v.z; }, lerp);
+	return ClipByPlane(temp, nTemp, out, [](const math3d::vec4& v) { return v.w - v.z; }, lerp);
+}
+
+size_t ClipPolygonRect(const math3d::vec4* in, size_t n, const sClipRect& rect, math3d::vec4* out)
+{
+	// 1/w is linear on the screen, w itself isn't
+	auto lerp = [](const math3d::vec4& a, const math3d::vec4& b, float t) -> math3d::vec4
+	{
+		float inv_w = 1.0f / a.w + (1.0f / b.w - 1.0f / a.w) * t;
+		return { a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, 1.0f / inv_w };
+	};
+
+	math3d::vec4 temp1[16], temp2[16];
+	size_t n1 = ClipByPlane(in, n, temp1, [&rect](const math3d::vec4& v) { return v.x - rect.x1; }, lerp);
+	size_t n2 = ClipByPlane(temp1, n1, temp2, [&rect](const math3d::vec4& v) { return rect.x2 - v.x; }, lerp);
+	n1 = ClipByPlane(temp2, n2, temp1, [&rect](const math3d::vec4& v) { return v.y - rect.y1; }, lerp);
+	return ClipByPlane(temp1, n1, out, [&rect](const math3d::vec4& v) { return rect.y2 - v.y; }, lerp);
+}
+
+bool ClipSegment(float& x1, float& y1, float& x2, float& y2, const sClipRect& rect)
+{
+	float dx = x2 - x1, dy = y2 - y1;
+	float t0 = 0.0f, t1 = 1.0f;
+
+	// p * t <= q for every side
+	const float p[4] = { -dx, dx, -dy, dy };
+	const float q[4] = { x1 - rect.x1, rect.x2 - x1, y1 - rect.y1, rect.y2 - y1 };
+
+	for (int16_t i = 0; i < 4; i++)
+	{
+		if (p[i] == 0.0f)
+		{
+			if (q[i] < 0.0f)
+				return false;
+			continue;
+		}
+
+		float t = q[i] / p[i];
+		if (p[i] < 0.0f)
+			t0 = (t > t0) ? t : t0;
+		else
+			t1 = (t < t1) ? t : t1;
+		if (t0 > t1)
+			return false;
+	}
+
+	if (t1 < 1.0f)
+	{
+		x2 = x1 + dx * t1;
+		y2 = y1 + dy * t1;
+	}
+	if (t0 > 0.0f)
+	{
+		x1 += dx * t0;
+		y1 += dy * t0;
+	}
+	return true;
+}
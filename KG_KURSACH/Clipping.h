@@ -0,0 +1,63 @@
+#ifndef _CLIPPING_H_
+#define _CLIPPING_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Math3D.h"
+#include "VertexTransform.h"
+
+//###################//
+	// Clipping
+//###################//
+
+	// Sides of the view a projected vertex is out of
+enum CLIP_CODE
+{
+	CLIP_LEFT = 0x01,
+	CLIP_RIGHT = 0x02,
+	CLIP_TOP = 0x04,
+	CLIP_BOTTOM = 0x08,
+	CLIP_NEAR = 0x10,									// Before the near plane or behind the camera: x, y mean nothing
+	CLIP_FAR = 0x20,
+	CLIP_GUARD = 0x40									// Out of the guard band: too far for the rasterizer
+};
+
+	// Rectangle on the screen (x1 <= x <= x2, y1 <= y <= y2)
+struct sClipRect
+{
+	float x1, y1, x2, y2;
+};
+
+	// What the clipping stage did with the triangles of one frame
+struct sClipStats
+{
+	uint32_t nTriangles;								// Came from the vertex stage
+	uint32_t nBackFaces;								// Turned away from the camera, dropped first
+	uint32_t nRejected;									// Out of the view by one side
+	uint32_t nClipped;									// Cut by the near/far planes or the guard band
+	uint32_t nOutput;									// Went to the raster
+};
+
+	// Code of a vertex after the transform: screen x, y, depth z = z/w and w
+uint8_t GetClipCode(float x, float y, float z, float w, const sClipRect& screen, const sClipRect& guard);
+
+	// Sutherland-Hodgman against 0 <= z <= w in homogeneous clip space.
+	// Vertices are (x, y, z, w) before the divide, out must hold n + 2 of them
+size_t ClipPolygonDepth(const math3d::vec4* in, size_t n, math3d::vec4* out);
+
+	// Sutherland-Hodgman against a rect on the screen for vertices after the divide
+	// (screen x, y, depth z, w). z is linear on the screen, w goes through 1/w.
+	// out must hold n + 4 vertices
+size_t ClipPolygonRect(const math3d::vec4* in, size_t n, const sClipRect& rect, math3d::vec4* out);
+
+	// Liang-Barsky: cuts the segment to the rect, false if nothing is left
+bool ClipSegment(float& x1, float& y1, float& x2, float& y2, const sClipRect& rect);
+
+	// Clip space -> screen, the same way TransformBatch does it
+inline math3d::vec4 ProjectClipVertex(const math3d::vec4& v, const sViewport& viewport)
+{
+	return { (viewport.offset_x - v.x / v.w) * viewport.scale_x, (viewport.offset_y - v.y / v.w) * viewport.scale_y, v.z / v.w, v.w };
+}
+
+#endif // !_CLIPPING_H_
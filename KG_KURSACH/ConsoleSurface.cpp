@@ -0,0 +1,130 @@
+#include "ConsoleSurface.h"
+
+#ifdef _WIN32
+
+#include <cstdio>
+
+static_assert(sizeof(sCell) == sizeof(CHAR_INFO), "sCell must keep the CHAR_INFO layout");
+
+ConsoleSurface::ConsoleSurface()
+{
+	hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+	hOriginalConsole = hConsole;
+	rectWindow = { 0 };
+}
+
+ConsoleSurface::~ConsoleSurface()
+{
+	SetConsoleActiveScreenBuffer(hOriginalConsole);
+}
+
+int16_t ConsoleSurface::Create(int16_t width, int16_t height, int16_t font_w, int16_t font_h, const std::wstring& name)
+{
+	if (hConsole == INVALID_HANDLE_VALUE)
+		return Error(L"Handle error.");
+
+	rectWindow = { 0, 0, 1, 1 };
+	SetConsoleWindowInfo(hConsole, TRUE, &rectWindow);
+
+	// Set the size of the screen buffer
+	COORD coord = { width, height };
+	if (!SetConsoleScreenBufferSize(hConsole, coord))
+		Error(L"SetConsoleScreenBufferSize");
+
+	// Assign screen buffer to the console
+	if (!SetConsoleActiveScreenBuffer(hConsole))
+		return Error(L"SetConsoleActiveScreenBuffer");
+
+	// Set the font size now that the screen buffer has been assigned to the console
+	CONSOLE_FONT_INFOEX cfi;
+	cfi.cbSize = sizeof(cfi);
+	cfi.nFont = 0;
+	cfi.dwFontSize.X = font_w;
+	cfi.dwFontSize.Y = font_h;
+	cfi.FontFamily = FF_DONTCARE;
+	cfi.FontWeight = FW_NORMAL;
+
+	wcscpy_s(cfi.FaceName, L"Consolas");
+	if (!SetCurrentConsoleFontEx(hConsole, false, &cfi))
+		return Error(L"SetCurrentConsoleFontEx");
+
+	// Get screen buffer info and check the maximum allowed window size. Return
+	// error if exceeded, so user knows their dimensions/fontsize are too large
+	CONSOLE_SCREEN_BUFFER_INFO csbi;
+	if (!GetConsoleScreenBufferInfo(hConsole, &csbi))
+		return Error(L"GetConsoleScreenBufferInfo");
+	if (height > csbi.dwMaximumWindowSize.Y)
+		return Error(L"Screen Height / Font Height Too Big");
+	if (width > csbi.dwMaximumWindowSize.X)
+		return Error(L"Screen Width / Font Width Too Big");
+
+	// Set Physical Console Window Size
+	rectWindow = { 0, 0, static_cast<int16_t>(width - 1), static_cast<int16_t>(height - 1) };
+	if (!SetConsoleWindowInfo(hConsole, TRUE, &rectWindow))
+		return Error(L"SetConsoleWindowInfo");
+
+	SetTitle(name.c_str());
+	tracker.Invalidate();
+
+	return 0;
+}
+
+void ConsoleSurface::Present(const Framebuffer& framebuffer)
+{
+	// Every rect is taken from the same place of the framebuffer as it goes to
+	tracker.Update(framebuffer);
+	for (auto& rect : tracker.GetRects())
+	{
+		SMALL_RECT region = { rect.x1, rect.y1, rect.x2, rect.y2 };
+		WriteConsoleOutput(hConsole, reinterpret_cast<const CHAR_INFO*>(framebuffer.cells.data()),
+			{ framebuffer.width, framebuffer.height }, { rect.x1, rect.y1 }, &region);
+	}
+}
+
+void ConsoleSurface::SetTitle(const wchar_t* title)
+{
+	SetConsoleTitle(title);
+}
+
+int16_t ConsoleSurface::Error(const wchar_t* msg)
+{
+	wchar_t buf[256];
+
+	SetConsoleDefault();
+
+	FormatMessage(FORMAT_MESSAGE_FROM_SYSTEM, NULL, GetLastError(), MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), buf, 256, NULL);
+	SetConsoleActiveScreenBuffer(hOriginalConsole);
+	wprintf(L"ERROR: %s\n\t%s\n", msg, buf);
+
+	return 1;
+}
+
+void ConsoleSurface::SetConsoleDefault()
+{
+	// Font 14; w 85; h 25
+
+	// Set Font
+	CONSOLE_FONT_INFOEX cfi;
+	cfi.cbSize = sizeof(cfi);
+	cfi.nFont = 0;
+	cfi.dwFontSize.X = 8;
+	cfi.dwFontSize.Y = 14;
+	cfi.FontFamily = FF_DONTCARE;
+	cfi.FontWeight = FW_NORMAL;
+
+	wcscpy_s(cfi.FaceName, L"Lucida Console");
+	SetCurrentConsoleFontEx(hConsole, false, &cfi);
+
+	// Set the size of the screen buffer
+	COORD coord = { 106, 26 };
+	SetConsoleScreenBufferSize(hConsole, coord);
+
+	// Assign screen buffer to the console
+	SetConsoleActiveScreenBuffer(hConsole);
+
+	// Set Physical Console Window Size
+	rectWindow = { 0, 0, 105, 25 };
+	SetConsoleWindowInfo(hConsole, TRUE, &rectWindow);
+}
+
+#endif // _WIN32
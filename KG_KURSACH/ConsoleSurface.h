@@ -0,0 +1,39 @@
+#ifndef _CONSOLE_SURFACE_H_
+#define _CONSOLE_SURFACE_H_
+
+#ifdef _WIN32
+
+#include "DirtyTracker.h"
+#include "Surface.h"
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+
+	// Win32 console backend: presents the framebuffer through WriteConsoleOutput,
+	// only the rectangles which changed since the previous frame
+class ConsoleSurface : public Surface
+{
+private:
+	HANDLE hConsole;									// Current output handle
+	HANDLE hOriginalConsole;							// Original handle (need when we got some error)
+	SMALL_RECT rectWindow;
+	DirtyTracker tracker;
+
+public:
+	ConsoleSurface();
+	~ConsoleSurface();
+
+	virtual int16_t Create(int16_t width, int16_t height, int16_t font_w, int16_t font_h, const std::wstring& name) override;
+	virtual void Present(const Framebuffer& framebuffer) override;
+	virtual void SetTitle(const wchar_t* title) override;
+
+private:
+	int16_t Error(const wchar_t* msg);
+	void SetConsoleDefault();
+};
+
+#endif // _WIN32
+
+#endif // !_CONSOLE_SURFACE_H_
@@ -0,0 +1,188 @@
+#include "DepthSort.h"
+
+#include <cstring>
+
+DepthSort::DepthSort()
+{
+	bCoherent = true;
+	nMaxMovesPerItem = 4;
+	stats = { 0, 0, 0, 0 };
+}
+
+uint32_t DepthSort::GetKey(float depth)
+{
+	// Bits of a float are in order for positive numbers and in reverse for
+	// negative ones: flip them so that all of them go up, then turn it over
+	if (depth == 0.0f)
+		depth = 0.0f;
+	uint32_t bits;
+	std::memcpy(&bits, &depth, sizeof(bits));
+	bits = (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+	return ~bits;
+}
+
+void DepthSort::Reserve(size_t nMaxItems)
+{
+	if (vecKeys.size() < nMaxItems)
+	{
+		vecKeys.resize(nMaxItems);
+		vecSortKeys.resize(nMaxItems);
+		vecTempKeys.resize(nMaxItems);
+		vecOrder.resize(nMaxItems);
+		vecTempOrder.resize(nMaxItems);
+	}
+}
+
+void DepthSort::ReserveHistory(int32_t id, size_t nItems)
+{
+	if (vecHistory.size() <= static_cast<size_t>(id))
+		vecHistory.resize(static_cast<size_t>(id) + 1);
+	vecHistory[id].reserve(nItems);
+}
+
+const uint32_t* DepthSort::Sort(const float* depths, size_t n, int32_t id)
+{
+	for (size_t i = 0; i < n; i++)
+		vecKeys[i] = GetKey(depths[i]);
+
+	// No history without the memory for it: the sequence is sorted from scratch
+	std::vector<uint32_t>* last = nullptr;
+	if (id >= 0 && static_cast<size_t>(id) < vecHistory.size())
+	{
+		last = &vecHistory[id];
+		if (last->capacity() < n)
+		{
+			last->clear();
+			last = nullptr;
+		}
+	}
+
+	// The last order is of use only for the same items
+	bool bSorted = false;
+	if (bCoherent && last && last->size() == n && n)
+	{
+		bSorted = FixUp(*last, n);
+		if (bSorted)
+			stats.nCoherent++;
+		else
+			stats.nFallbacks++;
+	}
+	if (!bSorted)
+	{
+		RadixSort(n);
+		stats.nRadix++;
+	}
+
+	if (last)
+		last->assign(vecOrder.begin(), vecOrder.begin() + n);
+
+	return vecOrder.data();
+}
+
+void DepthSort::ClearHistory()
+{
+	for (auto& last : vecHistory)
+		last.clear();
+}
+
+void DepthSort::RadixSort(size_t n)
+{
+	uint32_t* keys = vecSortKeys.data();
+	uint32_t* order = vecOrder.data();
+	for (size_t i = 0; i < n; i++)
+	{
+		keys[i] = vecKeys[i];
+		order[i] = static_cast<uint32_t>(i);
+	}
+
+	// Short sequences (most figures) don't pay for the histograms
+	if (n <= 32)
+	{
+		for (size_t i = 1; i < n; i++)
+		{
+			uint32_t key = keys[i], index = order[i];
+			size_t j = i;
+			for (; j > 0 && keys[j - 1] > key; j--)
+			{
+				keys[j] = keys[j - 1];
+				order[j] = order[j - 1];
+			}
+			keys[j] = key;
+			order[j] = index;
+		}
+		return;
+	}
+
+	// Histograms of all four bytes in one pass
+	uint32_t counts[4][256] = {};
+	for (size_t i = 0; i < n; i++)
+	{
+		uint32_t key = keys[i];
+		counts[0][key & 0xFF]++;
+		counts[1][(key >> 8) & 0xFF]++;
+		counts[2][(key >> 16) & 0xFF]++;
+		counts[3][key >> 24]++;
+	}
+
+	uint32_t* temp_keys = vecTempKeys.data();
+	uint32_t* temp_order = vecTempOrder.data();
+	for (int16_t pass = 0; pass < 4; pass++)
+	{
+		// All keys with the same byte: the pass would move nothing.
+		// Depths of one figure are close, so the high bytes are often skipped
+		uint32_t* count = counts[pass];
+		int16_t shift = 8 * pass;
+		if (count[(keys[0] >> shift) & 0xFF] == n)
+			continue;
+
+		uint32_t offset = 0;
+		for (int16_t b = 0; b < 256; b++)
+		{
+			uint32_t c = count[b];
+			count[b] = offset;
+			offset += c;
+		}
+
+		for (size_t i = 0; i < n; i++)
+		{
+			uint32_t pos = count[(keys[i] >> shift) & 0xFF]++;
+			temp_keys[pos] = keys[i];
+			temp_order[pos] = order[i];
+		}
+		std::swap(keys, temp_keys);
+		std::swap(order, temp_order);
+	}
+
+	// Odd number of passes leaves the result in the temporary arrays
+	if (order != vecOrder.data())
+		std::memcpy(vecOrder.data(), order, n * sizeof(uint32_t));
+}
+
+bool DepthSort::FixUp(const std::vector<uint32_t>& last, size_t n)
+{
+	uint32_t* keys = vecSortKeys.data();
+	uint32_t* order = vecOrder.data();
+	uint64_t nMaxMoves = static_cast<uint64_t>(n) * nMaxMovesPerItem;
+	uint64_t nMoves = 0;
+
+	// Equal keys go by their indices, as after the radix sort
+	for (size_t i = 0; i < n; i++)
+	{
+		uint32_t index = last[i], key = vecKeys[index];
+		size_t j = i;
+		for (; j > 0 && (keys[j - 1] > key || (keys[j - 1] == key && order[j - 1] > index)); j--)
+		{
+			keys[j] = keys[j - 1];
+			order[j] = order[j - 1];
+		}
+		keys[j] = key;
+		order[j] = index;
+
+		nMoves += i - j;
+		if (nMoves > nMaxMoves)
+			return false;
+	}
+
+	stats.nMoves += nMoves;
+	return true;
+}
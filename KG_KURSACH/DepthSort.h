@@ -0,0 +1,66 @@
+#ifndef _DEPTH_SORT_H_
+#define _DEPTH_SORT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//###################//
+	// Depth sort
+//###################//
+
+	// What the sorts of the frame were
+struct sDepthSortStats
+{
+	uint32_t nRadix;									// Sorted from scratch
+	uint32_t nCoherent;									// Last order fixed by insertion sort
+	uint32_t nFallbacks;								// Last order was too far off, sorted from scratch
+	uint64_t nMoves;									// Steps of the insertion sorts
+};
+
+	// Painter's order: indices of the items from the farthest (largest depth)
+	// to the nearest. Every depth becomes a 32-bit key once, the (key, index)
+	// pairs go through an LSD radix sort by bytes, so nothing is compared twice.
+	// Equal depths keep the order of their indices.
+	// With coherence on, a sequence with an id (e.g. a figure drawn every frame)
+	// starts from its order of the last frame: a camera that moved a little
+	// swaps only a few neighbours and insertion sort fixes them in O(n + moves).
+	// Memory is taken by Reserve & ReserveHistory only: a sequence longer than
+	// its history keeps no history, sorting never touches the heap
+class DepthSort
+{
+private:
+	std::vector<uint32_t> vecKeys;						// By item
+	std::vector<uint32_t> vecSortKeys, vecTempKeys;		// By position while sorting
+	std::vector<uint32_t> vecOrder, vecTempOrder;
+	std::vector<std::vector<uint32_t>> vecHistory;		// Last order of every id
+
+	bool bCoherent;
+	uint32_t nMaxMovesPerItem;							// Insertion sort gives up after n * this moves
+	sDepthSortStats stats;
+
+public:
+	DepthSort();
+
+		// Returns n indices, valid until the next Sort. id >= 0 names the sequence
+		// for the coherent mode, -1 - no history. n can't be over Reserve
+	const uint32_t* Sort(const float* depths, size_t n, int32_t id = -1);
+
+	void Reserve(size_t nMaxItems);						// Longest sequence
+	void ReserveHistory(int32_t id, size_t nItems);		// History of the sequence id, up to nItems long
+
+	void SetCoherent(bool bEnable) { bCoherent = bEnable; }
+	bool IsCoherent() const { return bCoherent; }
+	void ClearHistory();								// Orders of the last frame aren't used
+	void ResetStats() { stats = { 0, 0, 0, 0 }; }
+	const sDepthSortStats& GetStats() const { return stats; }
+
+		// Far first: larger depth gives a smaller key, -0 and 0 are equal
+	static uint32_t GetKey(float depth);
+
+private:
+	void RadixSort(size_t n);
+	bool FixUp(const std::vector<uint32_t>& last, size_t n);	// false if it gave up
+};
+
+#endif // !_DEPTH_SORT_H_
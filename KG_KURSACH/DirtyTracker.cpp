@@ -0,0 +1,95 @@
+#include "DirtyTracker.h"
+
+#include <algorithm>
+#include <cstring>
+
+DirtyTracker::DirtyTracker()
+{
+	width = height = 0;
+	bValid = false;
+	nChangedCells = nRectCells = 0;
+	nMaxRects = 16;
+	nJoinGap = 8;
+}
+
+size_t DirtyTracker::Update(const Framebuffer& framebuffer)
+{
+	vecSpans.clear();
+	vecRects.clear();
+	nChangedCells = nRectCells = 0;
+
+	if (!bValid || framebuffer.width != width || framebuffer.height != height)
+	{
+		width = framebuffer.width;
+		height = framebuffer.height;
+		vecPrevious = framebuffer.cells;
+		bValid = true;
+
+		for (int16_t y = 0; y < height; y++)
+			vecSpans.push_back({ y, 0, static_cast<int16_t>(width - 1) });
+		nChangedCells = nRectCells = framebuffer.cells.size();
+		if (width > 0 && height > 0)
+			vecRects.push_back({ 0, 0, static_cast<int16_t>(width - 1), static_cast<int16_t>(height - 1) });
+		return vecRects.size();
+	}
+
+	for (int16_t y = 0; y < height; y++)
+	{
+		const sCell* row = &framebuffer.cells[y * width];
+		sCell* prev = &vecPrevious[y * width];
+
+		if (!std::memcmp(row, prev, width * sizeof(sCell)))
+			continue;
+
+		// First and last changed cells
+		int16_t x1 = 0, x2 = width - 1;
+		while (row[x1].sym == prev[x1].sym && row[x1].col == prev[x1].col)
+			x1++;
+		while (row[x2].sym == prev[x2].sym && row[x2].col == prev[x2].col)
+			x2--;
+
+		std::memcpy(prev + x1, row + x1, (x2 - x1 + 1) * sizeof(sCell));
+		vecSpans.push_back({ y, x1, x2 });
+		nChangedCells += x2 - x1 + 1;
+	}
+
+	BuildRects();
+	return vecRects.size();
+}
+
+void DirtyTracker::BuildRects()
+{
+	// Span goes into the rect of the row above if they (almost) overlap
+	for (auto& span : vecSpans)
+	{
+		if (!vecRects.empty())
+		{
+			sDirtyRect& rect = vecRects.back();
+			if (rect.y2 + 1 == span.y && span.x1 <= rect.x2 + nJoinGap && span.x2 + nJoinGap >= rect.x1)
+			{
+				rect.x1 = std::min(rect.x1, span.x1);
+				rect.x2 = std::max(rect.x2, span.x2);
+				rect.y2 = span.y;
+				continue;
+			}
+		}
+		vecRects.push_back({ span.x1, span.y, span.x2, span.y });
+	}
+
+	// Every rect costs a call of the backend: too many of them become one
+	if (vecRects.size() > static_cast<size_t>(nMaxRects))
+	{
+		sDirtyRect bounds = vecRects[0];
+		for (auto& rect : vecRects)
+		{
+			bounds.x1 = std::min(bounds.x1, rect.x1);
+			bounds.y1 = std::min(bounds.y1, rect.y1);
+			bounds.x2 = std::max(bounds.x2, rect.x2);
+			bounds.y2 = std::max(bounds.y2, rect.y2);
+		}
+		vecRects.assign(1, bounds);
+	}
+
+	for (auto& rect : vecRects)
+		nRectCells += static_cast<size_t>(rect.x2 - rect.x1 + 1) * (rect.y2 - rect.y1 + 1);
+}
@@ -0,0 +1,62 @@
+#ifndef _DIRTY_TRACKER_H_
+#define _DIRTY_TRACKER_H_
+
+#include "Surface.h"
+
+#include <cstdint>
+#include <vector>
+
+//###################//
+	// Dirty tracker
+//###################//
+
+	// Changed cells of one row (inclusive)
+struct sDirtySpan
+{
+	int16_t y;
+	int16_t x1, x2;
+};
+
+	// Changed rectangle of the screen (inclusive)
+struct sDirtyRect
+{
+	int16_t x1, y1, x2, y2;
+};
+
+	// Remembers the last presented frame and finds what the next one changed,
+	// so backends send only that. Rows which are equal to the previous frame are
+	// skipped by one memcmp, changed rows give the span from the first to the last
+	// changed cell. Spans of neighbouring rows are joined into rectangles
+class DirtyTracker
+{
+private:
+	int16_t width, height;
+	std::vector<sCell> vecPrevious;						// Last frame passed to Update
+	bool bValid;										// vecPrevious holds a frame
+
+	std::vector<sDirtySpan> vecSpans;
+	std::vector<sDirtyRect> vecRects;
+	size_t nChangedCells;								// In the spans
+	size_t nRectCells;									// In the rects, >= nChangedCells
+
+public:
+	DirtyTracker();
+
+	int16_t nMaxRects;									// More rects are joined into their bounding box
+	int16_t nJoinGap;									// Spans closer than that are put into one rect
+
+		// Compares with the previous frame and remembers this one, returns count of rects.
+		// The first frame (and one after Invalidate or a size change) is changed everywhere
+	size_t Update(const Framebuffer& framebuffer);
+	void Invalidate() { bValid = false; }
+
+	const std::vector<sDirtySpan>& GetSpans() const { return vecSpans; }
+	const std::vector<sDirtyRect>& GetRects() const { return vecRects; }
+	size_t GetChangedCells() const { return nChangedCells; }
+	size_t GetRectCells() const { return nRectCells; }
+
+private:
+	void BuildRects();
+};
+
+#endif // !_DIRTY_TRACKER_H_
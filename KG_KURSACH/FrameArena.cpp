@@ -0,0 +1,70 @@
+#include "FrameArena.h"
+
+#include <algorithm>
+
+FrameArena::FrameArena(size_t nInitialSize)
+{
+	vecBlocks.reserve(16);
+	vecBlocks.push_back({ std::unique_ptr<uint8_t[]>(new uint8_t[nInitialSize]), nInitialSize });
+
+	nBlock = 0;
+	nUsed = 0;
+	nFrameBytes = nPeakBytes = 0;
+}
+
+void* FrameArena::Allocate(size_t nBytes, size_t nAlign)
+{
+	while (true)
+	{
+		sBlock& block = vecBlocks[nBlock];
+
+		// Blocks are allocated with new[], so their start is aligned to max_align_t
+		size_t offset = (nUsed + nAlign - 1) & ~(nAlign - 1);
+		if (offset + nBytes <= block.size)
+		{
+			nFrameBytes += offset + nBytes - nUsed;
+			nUsed = offset + nBytes;
+			return block.data.get() + offset;
+		}
+
+		// Next block, or a new one twice as big as the last
+		nBlock++;
+		nUsed = 0;
+		if (nBlock == vecBlocks.size())
+		{
+			size_t size = std::max(2 * vecBlocks.back().size, nBytes + nAlign);
+			vecBlocks.push_back({ std::unique_ptr<uint8_t[]>(new uint8_t[size]), size });
+		}
+	}
+}
+
+void FrameArena::Reset()
+{
+	nPeakBytes = std::max(nPeakBytes, nFrameBytes);
+
+	// The frame didn't fit into one block: next frames get one block for everything
+	if (vecBlocks.size() > 1)
+	{
+		size_t size = GetCapacity();
+		vecBlocks.clear();
+		vecBlocks.push_back({ std::unique_ptr<uint8_t[]>(new uint8_t[size]), size });
+	}
+
+	nBlock = 0;
+	nUsed = 0;
+	nFrameBytes = 0;
+}
+
+void FrameArena::Rewind(const sMarker& marker)
+{
+	nBlock = marker.block;
+	nUsed = marker.used;
+}
+
+size_t FrameArena::GetCapacity() const
+{
+	size_t size = 0;
+	for (auto& block : vecBlocks)
+		size += block.size;
+	return size;
+}
@@ -0,0 +1,83 @@
+#ifndef _FRAME_ARENA_H_
+#define _FRAME_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+//###################//
+	// Frame arena
+//###################//
+
+	// Linear allocator for data which lives no longer than one frame.
+	// Allocation only moves a pointer, Reset frees everything at once.
+	// If a frame needs more than the arena has, a new block is taken, and on
+	// the next Reset all blocks are merged into one big enough block, so after
+	// the first frames the arena doesn't touch the heap at all
+class FrameArena
+{
+public:
+		// Position in the arena, everything allocated after it is freed by Rewind
+	struct sMarker
+	{
+		size_t block;
+		size_t used;
+	};
+
+private:
+	struct sBlock
+	{
+		std::unique_ptr<uint8_t[]> data;
+		size_t size;
+	};
+
+	std::vector<sBlock> vecBlocks;
+	size_t nBlock;										// Current block
+	size_t nUsed;										// Bytes used in the current block
+	size_t nFrameBytes, nPeakBytes;						// Handed out this frame & max of all frames
+
+public:
+	FrameArena(size_t nInitialSize = 1 << 20);
+
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	void* Allocate(size_t nBytes, size_t nAlign = alignof(std::max_align_t));
+
+		// Array of n default constructed T. Destructors are never called
+	template <typename T>
+	T* Allocate(size_t n)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "FrameArena doesn't call destructors");
+
+		T* ptr = static_cast<T*>(Allocate(n * sizeof(T), alignof(T)));
+		for (size_t i = 0; i < n; i++)
+			new (ptr + i) T();
+		return ptr;
+	}
+
+	void Reset();										// Call at the beginning of a frame
+
+	sMarker GetMarker() const { return { nBlock, nUsed }; }
+	void Rewind(const sMarker& marker);
+
+	size_t GetCapacity() const;
+	size_t GetPeakBytes() const { return nPeakBytes; }
+};
+
+	// Scratch memory of one function: everything allocated while it lives is freed with it
+class ArenaScope
+{
+private:
+	FrameArena& arena;
+	FrameArena::sMarker marker;
+
+public:
+	ArenaScope(FrameArena& arena) : arena(arena), marker(arena.GetMarker()) {}
+	~ArenaScope() { arena.Rewind(marker); }
+};
+
+#endif // !_FRAME_ARENA_H_
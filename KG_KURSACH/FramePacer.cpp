@@ -0,0 +1,164 @@
+#include "FramePacer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+const float FramePacer::fMaxElapsed = 0.25f;
+
+FramePacer::FramePacer()
+{
+	fSpinMargin = 0.002f;
+	fIdlePoll = 0.005f;
+	SetMode(PACING_UNCAPPED);
+
+	std::fill(fFrameTime, fFrameTime + nHistory, 0.0f);
+	std::fill(fBusyTime, fBusyTime + nHistory, 0.0f);
+	nNext = 0;
+	nFrames = nRendered = 0;
+
+	Start();
+}
+
+void FramePacer::SetMode(PACING_MODE mode, float fRate)
+{
+	this->mode = mode;
+	this->fRate = (fRate > 0.0f) ? fRate : 60.0f;
+	fPeriod = 1.0f / this->fRate;
+	fAccumulator = 0.0f;
+}
+
+void FramePacer::Start()
+{
+	tpLast = tpLastRendered = tpFrame = tpDeadline = clock::now();
+	fAccumulator = 0.0f;
+}
+
+float FramePacer::BeginFrame()
+{
+	tpLast = tpFrame;
+	tpFrame = clock::now();
+	return std::min(std::chrono::duration<float>(tpFrame - tpLast).count(), fMaxElapsed);
+}
+
+void FramePacer::EndFrame(bool bRendered)
+{
+	clock::time_point tpEnd = clock::now();
+	nFrames++;
+
+	if (bRendered)
+	{
+		fFrameTime[nNext] = std::chrono::duration<float>(tpFrame - tpLastRendered).count();
+		fBusyTime[nNext] = std::chrono::duration<float>(tpEnd - tpFrame).count();
+		nNext = (nNext + 1) % nHistory;
+		nRendered++;
+		tpLastRendered = tpFrame;
+	}
+
+	switch (mode)
+	{
+	case PACING_CAPPED:
+	case PACING_IDLE:
+	{
+		// Nothing drawn: look at the input again soon, but don't spin
+		if (mode == PACING_IDLE && !bRendered)
+		{
+			std::this_thread::sleep_for(std::chrono::duration<float>(fIdlePoll));
+			break;
+		}
+
+		// Late by more than a frame: start counting from now, no burst of frames to catch up
+		auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(fPeriod));
+		tpDeadline += period;
+		if (tpDeadline + period < tpEnd)
+			tpDeadline = tpEnd;
+		WaitUntil(tpDeadline);
+		break;
+	}
+
+	default:
+		break;
+	}
+}
+
+int32_t FramePacer::TakeSimulationSteps(float fElapsedTime)
+{
+	fAccumulator += std::min(fElapsedTime, fMaxElapsed);
+
+	int32_t nSteps = static_cast<int32_t>(fAccumulator / fPeriod);
+	fAccumulator -= nSteps * fPeriod;
+	return std::min(nSteps, nMaxSteps);
+}
+
+float FramePacer::GetInterpolationAlpha() const
+{
+	return std::min(std::max(fAccumulator / fPeriod, 0.0f), 1.0f);
+}
+
+sFrameStats FramePacer::GetStats() const
+{
+	sFrameStats stats = { 0.0f, 0.0f, 0.0f, 0.0f, nFrames, nRendered };
+
+	int32_t n = static_cast<int32_t>(std::min<uint64_t>(nRendered, nHistory));
+	if (n == 0)
+		return stats;
+
+	float sorted[nHistory];
+	float fTotal = 0.0f, fBusy = 0.0f;
+	for (int32_t i = 0; i < n; i++)
+	{
+		sorted[i] = fFrameTime[i];
+		fTotal += fFrameTime[i];
+		fBusy += fBusyTime[i];
+	}
+	std::sort(sorted, sorted + n);
+
+	stats.fMean = fTotal / n * 1000.0f;
+	stats.fMax = sorted[n - 1] * 1000.0f;
+	stats.fP99 = sorted[std::min(n - 1, static_cast<int32_t>(0.99f * n))] * 1000.0f;
+	stats.fBusy = (fTotal > 0.0f) ? std::min(fBusy / fTotal, 1.0f) : 0.0f;
+	return stats;
+}
+
+void FramePacer::WaitUntil(clock::time_point tp)
+{
+	// Sleep while it is far, then spin. How late sleep wakes up moves the margin:
+	// up at once, down slowly
+	auto now = clock::now();
+	float fLeft = std::chrono::duration<float>(tp - now).count();
+	if (fLeft > fSpinMargin)
+	{
+		float fAsked = fLeft - fSpinMargin;
+		std::this_thread::sleep_for(std::chrono::duration<float>(fAsked));
+
+		auto woke = clock::now();
+		float fLate = std::chrono::duration<float>(woke - now).count() - fAsked;
+		fSpinMargin = std::max(fSpinMargin * 0.99f, std::min(fLate + 0.0005f, 0.02f));
+	}
+
+	while (clock::now() < tp)
+		std::this_thread::yield();
+}
+
+const char* FramePacer::GetModeName(PACING_MODE mode)
+{
+	switch (mode)
+	{
+	case PACING_UNCAPPED:	return "uncapped";
+	case PACING_CAPPED:		return "capped";
+	case PACING_FIXED:		return "fixed";
+	case PACING_IDLE:		return "idle";
+	default:				return "?";
+	}
+}
+
+bool FramePacer::ParseMode(const char* name, PACING_MODE& mode)
+{
+	for (PACING_MODE m : { PACING_UNCAPPED, PACING_CAPPED, PACING_FIXED, PACING_IDLE })
+		if (!std::strcmp(name, GetModeName(m)))
+		{
+			mode = m;
+			return true;
+		}
+	return false;
+}
@@ -0,0 +1,84 @@
+#ifndef _FRAME_PACER_H_
+#define _FRAME_PACER_H_
+
+#include <chrono>
+#include <cstdint>
+
+//###################//
+	// Frame pacing
+//###################//
+
+enum PACING_MODE
+{
+	PACING_UNCAPPED,									// Next frame right away
+	PACING_CAPPED,										// Not more than fRate frames per second
+	PACING_FIXED,										// Simulation in steps of 1 / fRate, frames as fast as possible
+	PACING_IDLE											// Like capped, but frames are drawn only when something changed
+};
+
+	// Frame times of the last frames, in ms
+struct sFrameStats
+{
+	float fMean;
+	float fMax;
+	float fP99;
+	float fBusy;										// Share of time spent in frames, not waiting (0 ... 1)
+	uint64_t nFrames;									// All loop iterations
+	uint64_t nRendered;									// Iterations which drew a frame
+};
+
+	// Monotonic clock of the loop. Waits between frames by sleeping and then
+	// spinning for the last part, because sleep wakes up late. How late it
+	// wakes is measured and the spin margin follows it
+class FramePacer
+{
+private:
+	typedef std::chrono::steady_clock clock;
+
+	PACING_MODE mode;
+	float fRate;
+	float fPeriod;										// 1 / fRate
+	float fSpinMargin;									// Seconds before the deadline to stop sleeping
+	float fIdlePoll;									// Seconds between input checks of an idle loop
+	float fAccumulator;									// Simulation time not taken by steps yet (PACING_FIXED)
+
+	clock::time_point tpLast;							// Start of the previous frame
+	clock::time_point tpLastRendered;					// Start of the previous frame which was drawn
+	clock::time_point tpFrame;							// Start of the current frame
+	clock::time_point tpDeadline;						// When the next frame may start
+
+	static const int32_t nHistory = 128;
+	float fFrameTime[nHistory];							// Ring of the last drawn frames: time from the previous drawn one
+	float fBusyTime[nHistory];							// and time of the work (seconds)
+	int32_t nNext;
+	uint64_t nFrames, nRendered;
+
+public:
+	FramePacer();
+
+	static const int32_t nMaxSteps = 8;					// More steps are dropped, so a slow frame can't snowball
+	static const float fMaxElapsed;						// Longer frames are cut to this (seconds)
+
+	void SetMode(PACING_MODE mode, float fRate = 60.0f);
+	PACING_MODE GetMode() const { return mode; }
+	float GetRate() const { return fRate; }
+
+	void Start();
+	float BeginFrame();									// Seconds since the previous frame
+	void EndFrame(bool bRendered);						// Waits until the next frame is due
+
+		// PACING_FIXED: adds the frame time and returns count of steps of GetStep() to run now
+	int32_t TakeSimulationSteps(float fElapsedTime);
+	float GetStep() const { return fPeriod; }
+	float GetInterpolationAlpha() const;				// Position between the last two steps (0 ... 1)
+
+	sFrameStats GetStats() const;
+
+	static const char* GetModeName(PACING_MODE mode);
+	static bool ParseMode(const char* name, PACING_MODE& mode);
+
+private:
+	void WaitUntil(clock::time_point tp);
+};
+
+#endif // !_FRAME_PACER_H_
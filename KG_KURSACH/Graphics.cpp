@@ -1,23 +1,34 @@
 #include "Graphics.h"
+#include "ConsoleSurface.h"
 
 Graphics::Graphics()
 {
 	iConsoleWidth = 120;
 	iConsoleHeight = 60;
 
-	hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+#ifdef _WIN32
 	m_hConsoleIn = GetStdHandle(STD_INPUT_HANDLE);
+#endif
 
 	console = nullptr;
-	rectWindow = { 0 };
+	nPixelsWritten = 0;
+	bProfilerOverlay = false;
+	m_dirty = { 0, 0, -1, -1 };
+
+	m_pRecordLog = nullptr;
+	m_pReplayLog = nullptr;
+	m_fReplayStep = 0.0f;
+	m_nReplayFrame = 0;
+	m_pHashDump = nullptr;
+	m_nDumpFrame = 0;
+	bRedraw = true;
+
+	fTitlePeriod = 0.5f;
+	fTitleTime = 0.0f;
+	szTitle[0] = L'\0';
 
-	std::memset(m_keyNewState, 0, 256 * sizeof(short));
-	std::memset(m_keyOldState, 0, 256 * sizeof(short));
 	std::memset(m_keys, 0, 256 * sizeof(sKeyState));
-
 	std::memset(m_mouse, 0, 5 * sizeof(sKeyState));
-	std::memset(m_mouseOldState, 0, 5 * sizeof(bool));
-	std::memset(m_mouseNewState, 0, 5 * sizeof(bool));
 	m_mousePosX = 0;
 	m_mousePosY = 0;
 
@@ -28,244 +39,324 @@ Graphics::Graphics()
 
 Graphics::~Graphics()
 {
-	SetConsoleActiveScreenBuffer(hOriginalConsole);
-	delete[] console;
+	m_input.Stop();
+	if (m_pHashDump)
+		std::fclose(m_pHashDump);
 }
 
+#ifdef _WIN32
 int16_t Graphics::ConstructConsole(int16_t width, int16_t height, int16_t font_w, int16_t font_h, std::wstring Console_name)
+{
+	if (ConstructSurface(new ConsoleSurface(), width, height, font_w, font_h, Console_name))
+		return 1;
+
+	// Set flags to allow mouse input		
+	if (!SetConsoleMode(m_hConsoleIn, ENABLE_EXTENDED_FLAGS | ENABLE_WINDOW_INPUT | ENABLE_MOUSE_INPUT))
+		return Error(L"SetConsoleMode");
+
+	// Keys and mouse are read by their own thread
+	SetInputSource(new ConsoleInputSource(m_hConsoleIn));
+
+	return 0;
+}
+#endif
+
+int16_t Graphics::ConstructHeadless(int16_t width, int16_t height, std::wstring Console_name)
+{
+	return ConstructSurface(new FramebufferSurface(), width, height, 1, 1, Console_name);
+}
+
+int16_t Graphics::ConstructSurface(Surface* new_surface, int16_t width, int16_t height, int16_t font_w, int16_t font_h,
+	std::wstring Console_name)
 {
 	wsApp_name = Console_name;
+	surface.reset(new_surface);
 
-	if (hConsole == INVALID_HANDLE_VALUE)
-		return Error(L"Handle error.");
+	if (surface->Create(width, height, font_w, font_h, Console_name))
+		return 1;
 
 	iConsoleWidth = width;
 	iConsoleHeight = height;
 
-	rectWindow = { 0, 0, 1, 1 };
-	SetConsoleWindowInfo(hConsole, TRUE, &rectWindow);
-
-	// Set the size of the screen buffer
-	COORD coord = { (int16_t)iConsoleWidth, (int16_t)iConsoleHeight };
-	if (!SetConsoleScreenBufferSize(hConsole, coord))
-		Error(L"SetConsoleScreenBufferSize");
-
-	// Assign screen buffer to the console
-	if (!SetConsoleActiveScreenBuffer(hConsole))
-		return Error(L"SetConsoleActiveScreenBuffer");
-
-	// Set the font size now that the screen buffer has been assigned to the console
-	CONSOLE_FONT_INFOEX cfi;
-	cfi.cbSize = sizeof(cfi);
-	cfi.nFont = 0;
-	cfi.dwFontSize.X = font_w;
-	cfi.dwFontSize.Y = font_h;
-	cfi.FontFamily = FF_DONTCARE;
-	cfi.FontWeight = FW_NORMAL;
-	
-	wcscpy_s(cfi.FaceName, L"Consolas");
-	if (!SetCurrentConsoleFontEx(hConsole, false, &cfi))
-		return Error(L"SetCurrentConsoleFontEx");
-
-	// Get screen buffer info and check the maximum allowed window size. Return
-	// error if exceeded, so user knows their dimensions/fontsize are too large
-	CONSOLE_SCREEN_BUFFER_INFO csbi;
-	if (!GetConsoleScreenBufferInfo(hConsole, &csbi))
-		return Error(L"GetConsoleScreenBufferInfo");
-	if (iConsoleHeight > csbi.dwMaximumWindowSize.Y)
-		return Error(L"Screen Height / Font Height Too Big");
-	if (iConsoleWidth > csbi.dwMaximumWindowSize.X)
-		return Error(L"Screen Width / Font Width Too Big");
-
-	// Set Physical Console Window Size
-	rectWindow = { 0, 0, (int16_t)iConsoleWidth - 1, (int16_t)iConsoleHeight - 1 };
-	if (!SetConsoleWindowInfo(hConsole, TRUE, &rectWindow))
-		return Error(L"SetConsoleWindowInfo");
-
-	// Set flags to allow mouse input		
-	if (!SetConsoleMode(m_hConsoleIn, ENABLE_EXTENDED_FLAGS | ENABLE_WINDOW_INPUT | ENABLE_MOUSE_INPUT))
-		return Error(L"SetConsoleMode");
-
 	// Allocate memory for screen buffer
-	console = new CHAR_INFO[iConsoleWidth * iConsoleHeight];
-	memset(console, 0, sizeof(CHAR_INFO) * iConsoleWidth * iConsoleHeight);
+	framebuffer.Create(iConsoleWidth, iConsoleHeight);
+	console = framebuffer.cells.data();
+	vecDepth.assign(framebuffer.cells.size(), INFINITY);
+	InvalidateBackground();
 
 	return 0;
 }
 
 int16_t Graphics::Error(const wchar_t* msg)
 {
-	wchar_t buf[256];
+	wprintf(L"ERROR: %ls\n", msg);
 
-	SetConsoleDefault();
+	return 1;
+}
 
-	FormatMessage(FORMAT_MESSAGE_FROM_SYSTEM, NULL, GetLastError(), MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), buf, 256, NULL);
-	SetConsoleActiveScreenBuffer(hOriginalConsole);
-	wprintf(L"ERROR: %s\n\t%s\n", msg, buf);
+void Graphics::HandleInput(bool& bKeyWasPressed)
+{
+	// Sources without a thread give their events now
+	m_input.Update();
+
+	for (auto& key : m_keys)
+		key.bPressed = key.bReleased = false;
+	for (auto& button : m_mouse)
+		button.bPressed = button.bReleased = false;
+
+	// Everything since the last frame, in order. A key pressed and released
+	// between two frames is bPressed and bReleased at once
+	sInputEvent event;
+	while (m_inputQueue.Pop(event))
+	{
+		if (m_pRecordLog)
+			m_pRecordLog->AddEvent(event);
+		bKeyWasPressed = true;
 
-	return 1;
+		switch (event.type)
+		{
+		case EVENT_KEY:
+			ApplyKeyEvent(m_keys[event.code], event.bDown);
+			break;
+
+		case EVENT_MOUSE_BUTTON:
+			if (event.code < 5)
+				ApplyKeyEvent(m_mouse[event.code], event.bDown);
+			break;
+
+		case EVENT_MOUSE_MOVE:
+			m_mousePosX = event.x;
+			m_mousePosY = event.y;
+			break;
+
+		case EVENT_FOCUS:
+			m_bConsoleInFocus = event.bDown;
+			break;
+
+		default:
+			break;
+		}
+	}
 }
 
-void Graphics::SetConsoleDefault()
+void Graphics::StartReplay(const InputLog& log, float fTimeStep)
 {
-	// Font 14; w 85; h 25
+	m_pReplayLog = &log;
+	m_fReplayStep = fTimeStep;
+	m_nReplayFrame = 0;
+	SetInputSource(new ReplayInputSource(log));
+}
 
-	// Set Font
-	CONSOLE_FONT_INFOEX cfi;
-	cfi.cbSize = sizeof(cfi);
-	cfi.nFont = 0;
-	cfi.dwFontSize.X = 8;
-	cfi.dwFontSize.Y = 14;
-	cfi.FontFamily = FF_DONTCARE;
-	cfi.FontWeight = FW_NORMAL;
+int16_t Graphics::StartHashDump(const char* path)
+{
+	if (m_pHashDump)
+		std::fclose(m_pHashDump);
 
-	wcscpy_s(cfi.FaceName, L"Lucida Console");
-	SetCurrentConsoleFontEx(hConsole, false, &cfi);
+	m_pHashDump = std::fopen(path, "w");
+	m_nDumpFrame = 0;
+	if (!m_pHashDump)
+		return Error(L"can't create the hash file");
 
-	// Set the size of the screen buffer
-	COORD coord = { 106, 26 };
-	SetConsoleScreenBufferSize(hConsole, coord);
+	return 0;
+}
 
-	// Assign screen buffer to the console
-	SetConsoleActiveScreenBuffer(hConsole);
+bool Graphics::NextFrameTime(float& fElapsedTime)
+{
+	if (m_pReplayLog)
+	{
+		if (m_nReplayFrame >= m_pReplayLog->GetFrameCount())
+			return false;
+		fElapsedTime = (m_fReplayStep > 0.0f) ? m_fReplayStep : m_pReplayLog->GetFrameTime(m_nReplayFrame);
+		m_nReplayFrame++;
+	}
 
-	// Set Physical Console Window Size
-	rectWindow = { 0, 0, 105, 25 };
-	SetConsoleWindowInfo(hConsole, TRUE, &rectWindow);
+	if (m_pRecordLog)
+		m_pRecordLog->BeginFrame(fElapsedTime);
+
+	return true;
 }
 
-void Graphics::Loop()
+void Graphics::DumpFrameHash()
 {
-	auto tp1 = std::chrono::system_clock::now();
-	auto tp2 = std::chrono::system_clock::now();
+	if (!m_pHashDump)
+		return;
 
+	std::fprintf(m_pHashDump, "%d %016llx\n", m_nDumpFrame++,
+		static_cast<unsigned long long>(HashCells(framebuffer.cells.data(), framebuffer.cells.size())));
+}
+
+void Graphics::ApplyKeyEvent(sKeyState& key, bool bDown)
+{
+	if (bDown)
+	{
+		key.bPressed = key.bPressed || !key.bHeld;
+		key.bHeld = true;
+	}
+	else
+	{
+		key.bReleased = key.bReleased || key.bHeld;
+		key.bHeld = false;
+	}
+}
+
+void Graphics::Loop()
+{
 	OnUserCreate();
 
 	bool bExit = false;
-	bool bKeyWasPressed = true;									// Else we cann't go to OnUserUpdate()
+	bRedraw = true;												// First frame is always drawn
+	pacer.Start();
 
 	while (!bExit)
 	{
-		// Handle Timing
-		tp2 = std::chrono::system_clock::now();
-		std::chrono::duration<float> elapsedTime = tp2 - tp1;
+		Profiler::Get().BeginFrame();
+		frameArena.Reset();
 
-		tp1 = tp2;
-		float fElapsedTime = elapsedTime.count();
+		// Handle Timing
+		float fElapsedTime = pacer.BeginFrame();
 
-		// Handle Keyboard Input
-		for (int16_t i = 0; i < 256; i++)
+		// Replay gives its own time, and ends the loop with the log
+		if (!NextFrameTime(fElapsedTime))
 		{
-			m_keyNewState[i] = GetAsyncKeyState(i);
+			Profiler::Get().EndFrame();
+			break;
+		}
 
-			m_keys[i].bPressed = false;
-			m_keys[i].bReleased = false;
+		bool bKeyWasPressed = false;
+		HandleInput(bKeyWasPressed);
 
-			if (m_keyNewState[i] != m_keyOldState[i])
-			{
-				if (m_keyNewState[i] & 0x8000)
-				{
-					m_keys[i].bPressed = !m_keys[i].bHeld;
-					m_keys[i].bHeld = true;
-				}
+		if (GetKey(L'P').bPressed)
+			bProfilerOverlay = !bProfilerOverlay;
+		if (GetKey(VK_ESCAPE).bPressed)
+			bExit = true;
 
-				else
-				{
-					m_keys[i].bReleased = true;
-					m_keys[i].bHeld = false;
-				}
+		if (pacer.GetMode() == PACING_FIXED)
+		{
+			int32_t nSteps = pacer.TakeSimulationSteps(fElapsedTime);
+			for (int32_t i = 0; i < nSteps; i++)
+				OnUserSimulate(pacer.GetStep());
+		}
 
-				bKeyWasPressed = true;
-			}
+		// Idle loop draws only when input came, a key is held (the scene moves) or a redraw was asked
+		bool bDraw = pacer.GetMode() != PACING_IDLE || bKeyWasPressed || bRedraw || IsAnyKeyHeld();
+		bRedraw = false;
+
+		if (bDraw)
+		{
+			OnUserUpdate(fElapsedTime);
 
-			m_keyOldState[i] = m_keyNewState[i];
+			// Update Title & Present Screen Buffer
+			if (bProfilerOverlay)
+				DrawProfilerOverlay();
+			UpdateTitle(fElapsedTime);
+			surface->Present(framebuffer);
+			DumpFrameHash();
 		}
 
+		Profiler::Get().EndFrame();
+		pacer.EndFrame(bDraw);
+	}
+}
 
-		// Handle Mouse Input - Check for window events
-		INPUT_RECORD inBuf[32];
-		DWORD events = 0;
-		GetNumberOfConsoleInputEvents(m_hConsoleIn, &events);
-		if (events > 0)
-			ReadConsoleInput(m_hConsoleIn, inBuf, events, &events);
+bool Graphics::IsAnyKeyHeld() const
+{
+	for (auto& key : m_keys)
+		if (key.bHeld)
+			return true;
+	for (auto& button : m_mouse)
+		if (button.bHeld)
+			return true;
+	return false;
+}
 
-		// Handle events - we only care about mouse clicks and movement
-		// for now
-		for (DWORD i = 0; i < events; i++)
-		{
-			switch (inBuf[i].EventType)
-			{
-			case FOCUS_EVENT:
-			{
-				m_bConsoleInFocus = inBuf[i].Event.FocusEvent.bSetFocus;
-			}
-			break;
+void Graphics::UpdateTitle(float fElapsedTime)
+{
+	wchar_t s[256];
 
-			case MOUSE_EVENT:
-			{
-				switch (inBuf[i].Event.MouseEvent.dwEventFlags)
-				{
-				case MOUSE_MOVED:
-				{
-					m_mousePosX = inBuf[i].Event.MouseEvent.dwMousePosition.X;
-					m_mousePosY = inBuf[i].Event.MouseEvent.dwMousePosition.Y;
-				}
-				break;
+	fTitleTime += fElapsedTime;
 
-				case 0:
-				{
-					for (int16_t m = 0; m < 5; m++)
-						m_mouseNewState[m] = (inBuf[i].Event.MouseEvent.dwButtonState & (1 << m)) > 0;
+	if (bProfilerOverlay)
+		swprintf(s, 256, L"%ls", wsApp_name.c_str());
+	else if (fTitleTime >= fTitlePeriod)
+	{
+		sFrameStats stats = pacer.GetStats();
+		swprintf(s, 256, L"%ls - FPS: %3.2f (%hs, max %.1f ms, busy %.0f%%)", wsApp_name.c_str(),
+			(stats.fMean > 0.0f) ? 1000.0f / stats.fMean : 0.0f,
+			FramePacer::GetModeName(pacer.GetMode()), stats.fMax, stats.fBusy * 100.0f);
+	}
+	else
+		return;
 
-				}
-				break;
+	fTitleTime = 0.0f;
 
-				default:
-					break;
-				}
-			}
-			break;
+	// Setting the title is a slow call of the console
+	if (wcscmp(s, szTitle))
+	{
+		wcscpy(szTitle, s);
+		surface->SetTitle(szTitle);
+	}
+}
 
-			default:
-				break;
-				// We don't care just at the moment
-			}
-		}
+float Graphics::LoopHeadless(int32_t nFrames, float fTimeStep)
+{
+	// No wall clock: every frame advances the scene by fTimeStep (or the time
+	// of the replayed frame), and input comes only from a scripted or replayed
+	// source (if any), so the rendered frames are the same on every run
+	OnUserCreate();
 
-		for (int16_t m = 0; m < 5; m++)
-		{
-			m_mouse[m].bPressed = false;
-			m_mouse[m].bReleased = false;
+	auto tp1 = std::chrono::steady_clock::now();
+	bool bKeyWasPressed = false;
 
-			if (m_mouseNewState[m] != m_mouseOldState[m])
-			{
-				if (m_mouseNewState[m])
-				{
-					m_mouse[m].bPressed = true;
-					m_mouse[m].bHeld = true;
-				}
-				else
-				{
-					m_mouse[m].bReleased = true;
-					m_mouse[m].bHeld = false;
-				}
-			}
+	for (int32_t i = 0; i < nFrames; i++)
+	{
+		Profiler::Get().BeginFrame();
+		frameArena.Reset();
 
-			m_mouseOldState[m] = m_mouseNewState[m];
+		float fElapsedTime = fTimeStep;
+		if (!NextFrameTime(fElapsedTime))
+		{
+			Profiler::Get().EndFrame();
+			break;
 		}
 
+		HandleInput(bKeyWasPressed);
+		if (GetKey(L'P').bPressed)
+			bProfilerOverlay = !bProfilerOverlay;
 
-		if (bKeyWasPressed)
-		{
-			OnUserUpdate(fElapsedTime);
-			//bKeyWasPressed = false;
-		}
+		OnUserUpdate(fElapsedTime);
+		if (bProfilerOverlay)
+			DrawProfilerOverlay();
+		surface->Present(framebuffer);
+		DumpFrameHash();
+
+		Profiler::Get().EndFrame();
+	}
+
+	std::chrono::duration<float> elapsedTime = std::chrono::steady_clock::now() - tp1;
+	return elapsedTime.count();
+}
+
+void Graphics::DrawProfilerOverlay()
+{
+	// Results of the previous frame: the current one isn't finished yet
+	const Profiler& profiler = Profiler::Get();
+	wchar_t s[128];
+	int16_t y = 1;
+
+	swprintf(s, 128, L"frame %7.3f ms", profiler.GetFrameTime() * 1000.0f);
+	DrawString(1, y++, s);
 
-		// Update Title & Present Screen Buffer
-		wchar_t s[256];
-		swprintf_s(s, 256, L"%s - FPS: %3.2f", wsApp_name.c_str(), 1.0f / fElapsedTime);
-		SetConsoleTitle(s);
-		WriteConsoleOutput(hConsole, console, { iConsoleWidth, iConsoleHeight }, { 0,0 }, &rectWindow);
+	for (auto& scope : profiler.GetFrameScopes())
+	{
+		swprintf(s, 128, L"%-18hs %7.3f ms %6u", scope.name, scope.fTime * 1000.0f, scope.nCalls);
+		DrawString(1, y++, s);
+	}
+
+	for (int16_t c = 0; c < COUNTER_COUNT; c++)
+	{
+		PROFILE_COUNTER counter = static_cast<PROFILE_COUNTER>(c);
+		swprintf(s, 128, L"%-18hs %10lld", Profiler::GetCounterName(counter), static_cast<long long>(profiler.GetFrameCounter(counter)));
+		DrawString(1, y++, s);
 	}
 }
 
@@ -292,8 +383,10 @@ void Graphics::Draw(int16_t x, int16_t y, int16_t sym, int16_t col)
 {
 	if (x >= 0 && x < iConsoleWidth && y >= 0 && y < iConsoleHeight)
 	{
-		console[y * iConsoleWidth + x].Char.UnicodeChar = sym;
-		console[y * iConsoleWidth + x].Attributes = col;
+		console[y * iConsoleWidth + x].sym = sym;
+		console[y * iConsoleWidth + x].col = col;
+		nPixelsWritten++;
+		MarkDirty(x, y, x, y);
 	}
 }
 
@@ -367,24 +460,120 @@ void Graphics::DrawLineBresenham(int16_t x1, int16_t y1, int16_t x2, int16_t y2,
 	}
 }
 
-void Graphics::DrawPolygons(std::vector<fPoint2D>& points, int16_t sym, int16_t col)
+void Graphics::DrawPolygons(const fPoint2D* points, size_t nPoints, int16_t sym, int16_t col)
 {
-	size_t i;
+	for (size_t i = 0; i < nPoints; i++)
+		DrawSegment(points[i], points[(i + 1 < nPoints) ? i + 1 : 0], sym, col);
+}
 
-	for (i = 0; i < points.size() - 1; i++)
-	{
-		DrawLineBresenham(roundf(points[i].x), roundf(points[i].y), roundf(points[i + 1].x), roundf(points[i + 1].y), sym, col);
-	}
-	DrawLineBresenham(roundf(points[i].x), roundf(points[i].y), roundf(points[0].x), roundf(points[0].y), sym, col);
+void Graphics::DrawSegment(const fPoint2D& p1, const fPoint2D& p2, int16_t sym, int16_t col)
+{
+	// Far out of the screen the coords don't fit in int16_t
+	float x1 = p1.x, y1 = p1.y, x2 = p2.x, y2 = p2.y;
+	if (!ClipSegment(x1, y1, x2, y2, GetGuardRect()))
+		return;
+
+	DrawLineBresenham(roundf(x1), roundf(y1), roundf(x2), roundf(y2), sym, col);
+}
+
+void Graphics::DrawString(int16_t x, int16_t y, const wchar_t* text, int16_t col)
+{
+	for (size_t i = 0; text[i]; i++)
+		Draw(x + static_cast<int16_t>(i), y, text[i], col);
 }
 
 void Graphics::Fill(int16_t x1, int16_t y1, int16_t x2, int16_t y2, int16_t sym, int16_t col)
 {
+	// Inclusive corners, row by row
 	Clip(x1, y1);
 	Clip(x2, y2);
-	for (int16_t x = x1; x <= x2; x++)
-		for (int16_t y = y1; y <= y2; y++)
-			Draw(x, y, sym, col);
+	x2 = std::min<int16_t>(x2, iConsoleWidth - 1);
+	y2 = std::min<int16_t>(y2, iConsoleHeight - 1);
+	if (x1 > x2 || y1 > y2)
+		return;
+
+	for (int16_t y = y1; y <= y2; y++)
+		FillCells(&console[y * iConsoleWidth + x1], x2 - x1 + 1, sCell{ sym, col });
+
+	nPixelsWritten += static_cast<uint64_t>(x2 - x1 + 1) * (y2 - y1 + 1);
+	MarkDirty(x1, y1, x2, y2);
+}
+
+void Graphics::FillPattern(int16_t x1, int16_t y1, int16_t x2, int16_t y2, const sCell* pattern, int16_t pattern_w, int16_t pattern_h)
+{
+	// Same corners as Fill. The pattern is tiled from (0, 0) of the screen, so
+	// neighbouring fills join without seams. Every row is copied from one
+	// pattern row which is repeated to the whole width of the rect
+	Clip(x1, y1);
+	Clip(x2, y2);
+	x2 = std::min<int16_t>(x2, iConsoleWidth - 1);
+	y2 = std::min<int16_t>(y2, iConsoleHeight - 1);
+	if (x1 > x2 || y1 > y2 || pattern_w <= 0 || pattern_h <= 0)
+		return;
+
+	for (int16_t y = y1; y <= y2; y++)
+	{
+		const sCell* pattern_row = &pattern[(y % pattern_h) * pattern_w];
+		sCell* row = &console[y * iConsoleWidth];
+
+		if (pattern_w == 1)
+			FillCells(row + x1, x2 - x1 + 1, pattern_row[0]);
+		else
+		{
+			int16_t x = x1;
+			while (x <= x2)
+			{
+				int16_t px = x % pattern_w;
+				int16_t n = std::min<int16_t>(pattern_w - px, x2 - x + 1);
+				std::copy(pattern_row + px, pattern_row + px + n, row + x);
+				x += n;
+			}
+		}
+	}
+
+	nPixelsWritten += static_cast<uint64_t>(x2 - x1 + 1) * (y2 - y1 + 1);
+	MarkDirty(x1, y1, x2, y2);
+}
+
+void Graphics::Clear(int16_t sym, int16_t col)
+{
+	// The whole framebuffer is one array
+	FillCells(console, framebuffer.cells.size(), sCell{ sym, col });
+
+	nPixelsWritten += framebuffer.cells.size();
+	MarkDirty(0, 0, iConsoleWidth - 1, iConsoleHeight - 1);
+}
+
+void Graphics::CacheBackground()
+{
+	m_vecBackground = framebuffer.cells;
+	ResetDirty();
+}
+
+bool Graphics::RestoreBackground()
+{
+	if (m_vecBackground.size() != framebuffer.cells.size())
+		return false;
+
+	if (m_dirty.x1 <= m_dirty.x2 && m_dirty.y1 <= m_dirty.y2)
+	{
+		int16_t width = m_dirty.x2 - m_dirty.x1 + 1;
+		for (int16_t y = m_dirty.y1; y <= m_dirty.y2; y++)
+		{
+			size_t offset = y * iConsoleWidth + m_dirty.x1;
+			std::copy(&m_vecBackground[offset], &m_vecBackground[offset] + width, &console[offset]);
+		}
+		nPixelsWritten += static_cast<uint64_t>(width) * (m_dirty.y2 - m_dirty.y1 + 1);
+	}
+
+	ResetDirty();
+	return true;
+}
+
+void Graphics::InvalidateBackground()
+{
+	m_vecBackground.clear();
+	ResetDirty();
 }
 
 void Graphics::Clip(int16_t& x, int16_t& y)
@@ -396,30 +585,123 @@ void Graphics::Clip(int16_t& x, int16_t& y)
 	else if (y >= iConsoleHeight) y = iConsoleHeight;
 }
 
-void Graphics::ShadingPolygonsScanLine(const std::vector<fPoint2D>& points, int16_t sym, int16_t col, int16_t y_min, int16_t y_max,
-	int16_t x_min, int16_t x_max)
+	// For few elements, which are almost sorted
+template <typename T, typename LESS>
+static void InsertionSort(T* data, size_t n, LESS less)
 {
-	std::vector<iEdgeScanLine> edges(points.size());
-	int16_t min_y, max_y;
+	for (size_t i = 1; i < n; i++)
+	{
+		T value = data[i];
+		size_t j = i;
+		for (; j > 0 && less(value, data[j - 1]); j--)
+			data[j] = data[j - 1];
+		data[j] = value;
+	}
+}
+
+int16_t Graphics::DrawSpan(int16_t x1, int16_t x2, int16_t y, int16_t sym, int16_t col)
+{
+	// Cells x1...x2 of row y, clipped to the screen, with one store
+	if (y < 0 || y >= iConsoleHeight)
+		return 0;
+
+	x1 = (x1 < 0) ? 0 : x1;
+	x2 = (x2 >= iConsoleWidth) ? iConsoleWidth - 1 : x2;
+	if (x1 > x2)
+		return 0;
+
+	FillCells(&console[y * iConsoleWidth + x1], x2 - x1 + 1, sCell{ sym, col });
+
+	nPixelsWritten += x2 - x1 + 1;
+	MarkDirty(x1, y, x2, y);
+	return x2 - x1 + 1;
+}
+
+int16_t Graphics::DrawVerticalSpan(int16_t x, int16_t y1, int16_t y2, int16_t sym, int16_t col)
+{
+	// Cells y1...y2 of column x, clipped to the screen
+	if (x < 0 || x >= iConsoleWidth)
+		return 0;
+
+	y1 = (y1 < 0) ? 0 : y1;
+	y2 = (y2 >= iConsoleHeight) ? iConsoleHeight - 1 : y2;
+	if (y1 > y2)
+		return 0;
+
+	sCell* cell = &console[y1 * iConsoleWidth + x];
+	for (int16_t y = y1; y <= y2; y++, cell += iConsoleWidth)
+		*cell = sCell{ sym, col };
+
+	nPixelsWritten += y2 - y1 + 1;
+	MarkDirty(x, y1, x, y2);
+	return y2 - y1 + 1;
+}
 
-	std::vector<int16_t> scanex;
+void Graphics::ShadingPolygonsScanLine(const fPoint2D* points, size_t nPoints, int16_t sym, int16_t col, int16_t y_min, int16_t y_max,
+	int16_t x_min, int16_t x_max)
+{
+	// Edge table + active edge list. Edges are sorted by their top, every line
+	// takes the edges which begin above it and drops the ones which ended,
+	// so only edges crossing the line are looked at. Horizontal edges give
+	// both ends on their own line. Spans are written straight into console.
+	// The rect [x_min, x_max) x [y_min, y_max) limits the drawn cells
+
+	if (nPoints < 2)
+		return;
+
+	// Small polygons (shadows are triangles) use the stack, big ones the frame arena
+	const size_t nLocalPoints = 8;
+	iEdgeScanLine local_edges[nLocalPoints], local_flats[nLocalPoints];
+	iEdgeScanLine* local_active[nLocalPoints];
+	int16_t local_scanex[2 * nLocalPoints];
+
+	ArenaScope scope(frameArena);
+	bool bLocal = (nPoints <= nLocalPoints);
+
+	iEdgeScanLine* edges = bLocal ? local_edges : frameArena.Allocate<iEdgeScanLine>(nPoints);		// Sloped edges, by y_top
+	iEdgeScanLine* flats = bLocal ? local_flats : frameArena.Allocate<iEdgeScanLine>(nPoints);		// Horizontal edges, by y
+	iEdgeScanLine** active = bLocal ? local_active : frameArena.Allocate<iEdgeScanLine*>(nPoints);
+	int16_t* scanex = bLocal ? local_scanex : frameArena.Allocate<int16_t>(2 * nPoints);	// Every edge gives at most 2 crossings per line
+	size_t nEdges = 0, nFlats = 0, nActive = 0;
 
-	min_y = max_y = round(points[0].y);
+	int16_t min_y, max_y;
+	min_y = max_y = roundf(points[0].y);
 
-	for (size_t i = 0; i < points.size(); i++)
+	for (size_t i = 0; i < nPoints; i++)
 	{
-		edges[i].x1 = round(points[i].x);
-		edges[i].y1 = round(points[i].y);
-		edges[i].x2 = ((i + 1) == points.size()) ? round(points[0].x) : round(points[i + 1].x);
-		edges[i].y2 = ((i + 1) == points.size()) ? round(points[0].y) : round(points[i + 1].y);
-		edges[i].del_x = edges[i].x2 - edges[i].x1;
-		edges[i].del_y = edges[i].y2 - edges[i].y1;
-		edges[i].del_xy = (edges[i].del_y == 0) ? 0 : edges[i].del_x / edges[i].del_y;
+		const fPoint2D& next = ((i + 1) == nPoints) ? points[0] : points[i + 1];
+
+		iEdgeScanLine edge;
+		edge.x1 = roundf(points[i].x);
+		edge.y1 = roundf(points[i].y);
+		edge.x2 = roundf(next.x);
+		edge.y2 = roundf(next.y);
+		edge.del_x = edge.x2 - edge.x1;
+		edge.del_y = edge.y2 - edge.y1;
+		edge.del_xy = (edge.del_y == 0) ? 0 : edge.del_x / edge.del_y;
+		edge.y_top = std::min(edge.y1, edge.y2);
+		edge.y_bottom = std::max(edge.y1, edge.y2);
+
+		min_y = std::min(min_y, edge.y_top);
+		max_y = std::max(max_y, edge.y_bottom);
+
+		if (edge.y1 == edge.y2)
+			flats[nFlats++] = edge;
+		else
+			edges[nEdges++] = edge;
+	}
 
-		if (edges[i].y2 > max_y)
-			max_y = edges[i].y2;
-		else if (edges[i].y2 < min_y)
-			min_y = edges[i].y2;
+	auto by_top = [](const iEdgeScanLine& e1, const iEdgeScanLine& e2) { return e1.y_top < e2.y_top; };
+	auto by_y = [](const iEdgeScanLine& e1, const iEdgeScanLine& e2) { return e1.y1 < e2.y1; };
+	if (bLocal)
+	{
+		InsertionSort(edges, nEdges, by_top);
+		InsertionSort(flats, nFlats, by_y);
+	}
+	else
+	{
+		std::sort(edges, edges + nEdges, by_top);
+		std::sort(flats, flats + nFlats, by_y);
 	}
 
 	// For Warnock Algorithm
@@ -431,53 +713,73 @@ void Graphics::ShadingPolygonsScanLine(const std::vector<fPoint2D>& points, int1
 	min_y = (min_y < y_min) ? y_min : min_y;
 	max_y = (max_y > y_max) ? y_max : max_y;
 
+	size_t next_edge = 0, next_flat = 0;
 
 	for (int16_t y = min_y; y < max_y; y++)
 	{
-		for (size_t i = 0; i < points.size(); i++)
+		// An edge crosses line y when y_top < y <= y_bottom
+		while (next_edge < nEdges && edges[next_edge].y_top < y)
+			active[nActive++] = &edges[next_edge++];
+
+		size_t nScanex = 0;
+		for (size_t i = 0; i < nActive; )
 		{
-			if ((edges[i].y1 >= y && edges[i].y2 < y) || (edges[i].y1 < y && edges[i].y2 >= y))
+			iEdgeScanLine* edge = active[i];
+			if (edge->y_bottom < y)
 			{
-				// Count X
-				scanex.push_back(edges[i].x1 + edges[i].del_xy * (y - edges[i].y1));
+				active[i] = active[--nActive];
+				continue;
 			}
 
-			// if edge == y
-			else if (edges[i].y1 == y && edges[i].y2 == y)
-			{
-				scanex.push_back(edges[i].x1);
-				scanex.push_back(edges[i].x2);
-			}
+			// From the first point of the edge, so long edges don't drift
+			scanex[nScanex++] = edge->x1 + edge->del_xy * (y - edge->y1);
+			i++;
 		}
 
-		if (scanex.size())
+		while (next_flat < nFlats && flats[next_flat].y1 < y)
+			next_flat++;
+		for (size_t i = next_flat; i < nFlats && flats[i].y1 == y; i++)
 		{
-			std::sort(scanex.begin(), scanex.end());
+			scanex[nScanex++] = flats[i].x1;
+			scanex[nScanex++] = flats[i].x2;
+		}
 
-			for (size_t i = 0; i < scanex.size() - 1; i += 2)
-			{
-				int16_t x1, x2;
-				x1 = (scanex[i] < x_min) ? x_min : scanex[i];
-				x2 = (scanex[i + 1] > x_max) ? x_max : scanex[i + 1];
+		if (nScanex < 2)
+			continue;
 
-				DrawLineBresenham(x1, y, x2, y, sym, col);
-				//DrawLineBresenham(scanex[i], y, scanex[i + 1], y, c, col);
-			}
+		// Convex polygons without horizontal edges on the line have 2 crossings: no sort
+		if (nScanex == 2)
+		{
+			if (scanex[0] > scanex[1])
+				std::swap(scanex[0], scanex[1]);
+		}
+		else
+			InsertionSort(scanex, nScanex, [](int16_t x1, int16_t x2) { return x1 < x2; });
 
-			scanex.clear();
+		for (size_t i = 0; i + 1 < nScanex; i += 2)
+		{
+			int16_t x1 = (scanex[i] < x_min) ? x_min : scanex[i];
+			int16_t x2 = (scanex[i + 1] >= x_max) ? x_max - 1 : scanex[i + 1];
+
+			int16_t nCells = DrawSpan(x1, x2, y, sym, col);
+			if (nCells)
+			{
+				PROFILE_COUNT(COUNTER_SPANS_FILLED, 1);
+				PROFILE_COUNT(COUNTER_PIXELS_FILLED, nCells);
+			}
 		}
 	}
 }
 
-void Graphics::ShadingPolygonsFloodFillRecursion(const std::vector<fPoint2D>& points, int16_t sym, int16_t col, int16_t col_edges)
+void Graphics::ShadingPolygonsFloodFillRecursion(const fPoint2D* points, size_t nPoints, int16_t sym, int16_t col, int16_t col_edges)
 {
 	fPoint2D center;
 
-	for (auto& point : points)
+	for (size_t i = 0; i < nPoints; i++)
 	{
-		center += point;
+		center += points[i];
 	}
-	center /= points.size();
+	center /= nPoints;
 
 	center.x = roundf(center.x);
 	center.y = roundf(center.y);
@@ -491,8 +793,9 @@ void Graphics::ShadingPolygonsFloodFillRecursion(const std::vector<fPoint2D>& po
 	{
 		fPoint2D new_center;
 		int16_t counter = 0;
-		for (auto& point : points)
+		for (size_t i = 0; i < nPoints; i++)
 		{
+			const fPoint2D& point = points[i];
 			if (point.x >= 0.0f && point.x <= iConsoleWidth && point.y >= 0.0f && point.y <= iConsoleHeight)
 			{
 				new_center += point;
@@ -507,37 +810,279 @@ void Graphics::ShadingPolygonsFloodFillRecursion(const std::vector<fPoint2D>& po
 		center = new_center;
 	}
 
-	if (center.x >= 0.0f && center.x <= iConsoleWidth && center.y >= 0.0f && center.y <= iConsoleHeight)
+	if (center.x >= 0.0f && center.x < iConsoleWidth && center.y >= 0.0f && center.y < iConsoleHeight)
 	{
-		CHAR_INFO* console_ptr = &console[(int16_t)center.y * iConsoleWidth + (int16_t)center.x];;
+		sCell* console_ptr = &console[(int16_t)center.y * iConsoleWidth + (int16_t)center.x];
 
-		if (console_ptr->Attributes != col_edges && console_ptr->Attributes != col)
-			FillingFloodFill(console_ptr, center.x, center.y, sym, col, col_edges);
+		if (console_ptr->col != col_edges && console_ptr->col != col)
+			FillingFloodFill(center.x, center.y, sym, col, col_edges);
 	}
 }
 
-void Graphics::FillingFloodFill(CHAR_INFO* console_ptr, int16_t x, int16_t y, int16_t sym, int16_t col, int16_t col_edges)
+void Graphics::FillingFloodFill(int16_t x, int16_t y, int16_t sym, int16_t col, int16_t col_edges)
 {
-	// lambda for checking edges of screen
-	auto on_screen = [this](int16_t x, int16_t y)
+	PROFILE_SCOPE("FloodFill");
+
+	// Scanline seed fill: every popped seed is widened to the whole horizontal run
+	// bounded by col_edges (or already filled cells), the run is painted at once,
+	// and only one seed per run is pushed for the rows above and below.
+	// The stack is explicit, so big faces can't overflow the call stack.
+
+	m_vecSeedStack.clear();
+	m_vecSeedStack.push_back({ x, y });
+
+	while (!m_vecSeedStack.empty())
 	{
-		if (x >= 0.0f && x <= iConsoleWidth && y >= 0.0f && y <= iConsoleHeight)
-			return true;
-		return false;
+		iSeedSpan seed = m_vecSeedStack.back();
+		m_vecSeedStack.pop_back();
+
+		sCell* row = &console[seed.y * iConsoleWidth];
+
+		// The run could be filled from another seed already
+		if (row[seed.x].col == col_edges || row[seed.x].col == col)
+			continue;
+
+		int16_t x_left = seed.x;
+		int16_t x_right = seed.x;
+
+		while (x_left > 0 && row[x_left - 1].col != col_edges && row[x_left - 1].col != col)
+			x_left--;
+		while (x_right < iConsoleWidth - 1 && row[x_right + 1].col != col_edges && row[x_right + 1].col != col)
+			x_right++;
+
+		FillCells(row + x_left, x_right - x_left + 1, sCell{ sym, col });
+		nPixelsWritten += x_right - x_left + 1;
+		MarkDirty(x_left, seed.y, x_right, seed.y);
+		PROFILE_COUNT(COUNTER_SPANS_FILLED, 1);
+		PROFILE_COUNT(COUNTER_PIXELS_FILLED, x_right - x_left + 1);
+
+		if (seed.y > 0)
+			PushSeedSpans(x_left, x_right, seed.y - 1, col, col_edges);
+		if (seed.y < iConsoleHeight - 1)
+			PushSeedSpans(x_left, x_right, seed.y + 1, col, col_edges);
+	}
+}
+
+void Graphics::PushSeedSpans(int16_t x_left, int16_t x_right, int16_t y, int16_t col, int16_t col_edges)
+{
+	// One seed for every unfilled run of row y inside [x_left, x_right]
+	sCell* row = &console[y * iConsoleWidth];
+	bool in_span = false;
+
+	for (int16_t x = x_left; x <= x_right; x++)
+	{
+		bool fillable = row[x].col != col_edges && row[x].col != col;
+
+		if (fillable && !in_span)
+			m_vecSeedStack.push_back({ x, y });
+
+		in_span = fillable;
+	}
+}
+
+void Graphics::ClearDepth()
+{
+	std::fill(vecDepth.begin(), vecDepth.end(), INFINITY);
+}
+
+void Graphics::RasterTriangleDepth(const triangle& tri, int16_t sym, int16_t col, int16_t y_min, int16_t y_max,
+	int16_t x_min, int16_t x_max)
+{
+	y_min = (y_min == -1) ? 0 : y_min;
+	y_max = (y_max == -1) ? iConsoleHeight : y_max;
+	x_min = (x_min == -1) ? 0 : x_min;
+	x_max = (x_max == -1) ? iConsoleWidth : x_max;
+
+	iDirtyRect bounds;
+	int32_t nPixels = RasterTriangleDepthRect(tri, sym, col, y_min, y_max, x_min, x_max, &bounds);
+	if (nPixels)
+		MarkDirty(bounds.x1, bounds.y1, bounds.x2, bounds.y2);
+
+	nPixelsWritten += nPixels;
+	PROFILE_COUNT(COUNTER_PIXELS_FILLED, nPixels);
+}
+
+int32_t Graphics::RasterTriangleDepthRect(const triangle& tri, int16_t sym, int16_t col, int16_t y_min, int16_t y_max,
+	int16_t x_min, int16_t x_max, iDirtyRect* bounds)
+{
+	// Edge functions are evaluated at the centre of every cell. Pixels on a shared edge
+	// go to one triangle only (top-left rule), and every pixel is computed the same way
+	// whatever rectangle is drawn, so a triangle can be drawn in parts
+
+	const fPoint3D* a = &tri.points[0];
+	const fPoint3D* b = &tri.points[1];
+	const fPoint3D* c = &tri.points[2];
+
+	// Behind the camera
+	if (a->w <= 0.0f || b->w <= 0.0f || c->w <= 0.0f)
+		return 0;
+
+	auto edge = [](const fPoint3D* p0, const fPoint3D* p1, float x, float y)
+	{
+		return (p1->x - p0->x) * (y - p0->y) - (p1->y - p0->y) * (x - p0->x);
 	};
 
-	Draw(x, y, sym, col);
+	float area = edge(a, b, c->x, c->y);
+	if (area == 0.0f || !std::isfinite(area))
+		return 0;
+	if (area < 0.0f)
+	{
+		std::swap(b, c);
+		area = -area;
+	}
+
+	// Bounding box in float first: projected points can be far outside of the screen
+	float fMinX = std::max(static_cast<float>(x_min), floorf(std::min({ a->x, b->x, c->x })));
+	float fMaxX = std::min(static_cast<float>(x_max - 1), ceilf(std::max({ a->x, b->x, c->x })));
+	float fMinY = std::max(static_cast<float>(y_min), floorf(std::min({ a->y, b->y, c->y })));
+	float fMaxY = std::min(static_cast<float>(y_max - 1), ceilf(std::max({ a->y, b->y, c->y })));
+	if (fMinX > fMaxX || fMinY > fMaxY)
+		return 0;
+
+	auto top_left = [](const fPoint3D* p0, const fPoint3D* p1)
+	{
+		float dy = p1->y - p0->y;
+		return dy < 0.0f || (dy == 0.0f && p1->x > p0->x);
+	};
+	bool tl0 = top_left(b, c), tl1 = top_left(c, a), tl2 = top_left(a, b);
+
+	float fInvArea = 1.0f / area;
+	int32_t nPixels = 0;
+
+	for (int16_t y = static_cast<int16_t>(fMinY); y <= static_cast<int16_t>(fMaxY); y++)
+	{
+		float py = y + 0.5f;
+		sCell* row = &console[y * iConsoleWidth];
+		float* depth_row = &vecDepth[y * iConsoleWidth];
+
+		for (int16_t x = static_cast<int16_t>(fMinX); x <= static_cast<int16_t>(fMaxX); x++)
+		{
+			float px = x + 0.5f;
+			float w0 = edge(b, c, px, py);
+			float w1 = edge(c, a, px, py);
+			float w2 = edge(a, b, px, py);
+
+			if ((w0 > 0.0f || (w0 == 0.0f && tl0)) && (w1 > 0.0f || (w1 == 0.0f && tl1)) && (w2 > 0.0f || (w2 == 0.0f && tl2)))
+			{
+				float z = (w0 * a->z + w1 * b->z + w2 * c->z) * fInvArea;
+				if (z < depth_row[x])
+				{
+					depth_row[x] = z;
+					row[x].sym = sym;
+					row[x].col = col;
+					nPixels++;
+				}
+			}
+		}
+	}
 
-	console_ptr = &console[(int16_t)y * iConsoleWidth + (int16_t)x];
+	if (bounds && nPixels)
+		*bounds = { static_cast<int16_t>(fMinX), static_cast<int16_t>(fMinY), static_cast<int16_t>(fMaxX), static_cast<int16_t>(fMaxY) };
 
-	if (on_screen(x, y - 1) && (console_ptr - iConsoleWidth)->Attributes != col_edges && (console_ptr - iConsoleWidth)->Attributes != col)
-		FillingFloodFill(console_ptr, x, y - 1, sym, col, col_edges);
-	if (on_screen(x, y + 1) && (console_ptr + iConsoleWidth)->Attributes != col_edges && (console_ptr + iConsoleWidth)->Attributes != col)
-		FillingFloodFill(console_ptr, x, y + 1, sym, col, col_edges);
-	if (on_screen(x - 1, y) && (console_ptr - 1)->Attributes != col_edges && (console_ptr - 1)->Attributes != col)
-		FillingFloodFill(console_ptr, x - 1, y, sym, col, col_edges);
-	if (on_screen(x + 1, y) && (console_ptr + 1)->Attributes != col_edges && (console_ptr + 1)->Attributes != col)
-		FillingFloodFill(console_ptr, x + 1, y, sym, col, col_edges);
+	return nPixels;
+}
+
+void Graphics::SetRasterThreads(int32_t nThreads)
+{
+	m_pRasterPool.reset(new WorkerPool(nThreads));
+}
+
+void Graphics::RasterTrianglesDepthTiled(const triangle* tris, size_t nTris)
+{
+	PROFILE_SCOPE("RasterTiled");
+
+	if (!m_pRasterPool)
+		SetRasterThreads(0);
+
+	int16_t nTilesX = (iConsoleWidth + iTileSize - 1) / iTileSize;
+	int16_t nTilesY = (iConsoleHeight + iTileSize - 1) / iTileSize;
+	int32_t nTiles = nTilesX * nTilesY;
+	if (nTiles <= 0 || nTris == 0)
+		return;
+
+	// Tiles touched by every triangle (empty range for skipped ones)
+	struct iTileRect
+	{
+		int16_t x1, y1, x2, y2;
+	};
+	iTileRect* rects = frameArena.Allocate<iTileRect>(nTris);
+	uint32_t* bin_start = frameArena.Allocate<uint32_t>(nTiles + 1);
+	uint64_t* tile_pixels = frameArena.Allocate<uint64_t>(nTiles);
+
+	// Binning: every triangle goes to the tiles its bounding box touches.
+	// The order of triangles in a bin stays the same, so every cell sees
+	// the same sequence of depth tests as without tiles.
+	// First pass counts triangles of every tile, second one fills the bins
+	for (size_t i = 0; i < nTris; i++)
+	{
+		const fPoint3D* p = tris[i].points;
+		rects[i] = { 0, 0, -1, -1 };
+
+		if (p[0].w <= 0.0f || p[1].w <= 0.0f || p[2].w <= 0.0f)
+			continue;
+
+		float fMinX = std::max(0.0f, floorf(std::min({ p[0].x, p[1].x, p[2].x })));
+		float fMaxX = std::min(static_cast<float>(iConsoleWidth - 1), ceilf(std::max({ p[0].x, p[1].x, p[2].x })));
+		float fMinY = std::max(0.0f, floorf(std::min({ p[0].y, p[1].y, p[2].y })));
+		float fMaxY = std::min(static_cast<float>(iConsoleHeight - 1), ceilf(std::max({ p[0].y, p[1].y, p[2].y })));
+		if (!(fMinX <= fMaxX && fMinY <= fMaxY))
+			continue;
+
+		iTileRect& r = rects[i];
+		r.x1 = static_cast<int16_t>(fMinX) / iTileSize;
+		r.x2 = static_cast<int16_t>(fMaxX) / iTileSize;
+		r.y1 = static_cast<int16_t>(fMinY) / iTileSize;
+		r.y2 = static_cast<int16_t>(fMaxY) / iTileSize;
+
+		for (int16_t ty = r.y1; ty <= r.y2; ty++)
+			for (int16_t tx = r.x1; tx <= r.x2; tx++)
+				bin_start[ty * nTilesX + tx + 1]++;
+	}
+
+	for (int32_t tile = 0; tile < nTiles; tile++)
+		bin_start[tile + 1] += bin_start[tile];
+
+	uint32_t* bins = frameArena.Allocate<uint32_t>(bin_start[nTiles]);
+	uint32_t* bin_end = frameArena.Allocate<uint32_t>(nTiles);
+	std::copy(bin_start, bin_start + nTiles, bin_end);
+
+	for (size_t i = 0; i < nTris; i++)
+	{
+		const iTileRect& r = rects[i];
+		for (int16_t ty = r.y1; ty <= r.y2; ty++)
+			for (int16_t tx = r.x1; tx <= r.x2; tx++)
+				bins[bin_end[ty * nTilesX + tx]++] = static_cast<uint32_t>(i);
+	}
+
+	// Every tile is drawn by one thread, so no locks are needed
+	m_pRasterPool->Run(nTiles, [&](int32_t tile)
+		{
+			int16_t x_min = (tile % nTilesX) * iTileSize;
+			int16_t y_min = (tile / nTilesX) * iTileSize;
+			int16_t x_max = std::min<int16_t>(x_min + iTileSize, iConsoleWidth);
+			int16_t y_max = std::min<int16_t>(y_min + iTileSize, iConsoleHeight);
+
+			uint64_t nPixels = 0;
+			for (uint32_t k = bin_start[tile]; k < bin_start[tile + 1]; k++)
+			{
+				const triangle& tri = tris[bins[k]];
+				nPixels += RasterTriangleDepthRect(tri, tri.sym, tri.col, y_min, y_max, x_min, x_max);
+			}
+			tile_pixels[tile] = nPixels;
+		});
+
+	for (int32_t tile = 0; tile < nTiles; tile++)
+	{
+		nPixelsWritten += tile_pixels[tile];
+		PROFILE_COUNT(COUNTER_PIXELS_FILLED, tile_pixels[tile]);
+
+		if (tile_pixels[tile])
+		{
+			int16_t x = (tile % nTilesX) * iTileSize;
+			int16_t y = (tile / nTilesX) * iTileSize;
+			MarkDirty(x, y, std::min<int16_t>(x + iTileSize, iConsoleWidth) - 1, std::min<int16_t>(y + iTileSize, iConsoleHeight) - 1);
+		}
+	}
 }
 
 bool Graphics::onSegment(const fPoint3D& p, const fPoint3D& q, const fPoint3D& r)
@@ -545,8 +1090,8 @@ bool Graphics::onSegment(const fPoint3D& p, const fPoint3D& q, const fPoint3D& r
 	// Find intersections between two segments
 		// https://www.youtube.com/watch?v=bbTqI0oqL5U&t=596s&ab_channel=TECHDOSE
 
-	if (q.x <= max(p.x, r.x) && q.x >= min(p.x, r.x) &&
-		q.y <= max(p.y, r.y) && q.y >= min(p.y, r.y))
+	if (q.x <= std::max(p.x, r.x) && q.x >= std::min(p.x, r.x) &&
+		q.y <= std::max(p.y, r.y) && q.y >= std::min(p.y, r.y))
 		return true;
 
 	return false;
@@ -575,31 +1120,42 @@ bool Graphics::checkPointAndSegment(const fPoint3D& start, const fPoint3D& p, co
 	return false;
 }
 
-std::vector<Graphics::triangle> Graphics::RobertsAlgorithm(std::vector<triangle>& vecTrianglesToRaster, fPoint3D& view_point,
-	fPoint3D& barycenter, int16_t sym, int16_t col, int16_t col_edge)
+size_t Graphics::RobertsAlgorithm(triangle* tris, size_t nTris, fPoint3D& view_point, fPoint3D& barycenter,
+	triangle* visible_surfaces, int16_t sym, int16_t col, int16_t col_edge, bool bBackFaces,
+	const uint32_t* sides, uint8_t* edges_drawn)
 {
+	PROFILE_SCOPE("RobertsAlgorithm");
+
 	fPoint3D vec1, vec2;
-	std::vector<triangle> vecVisibleSurfaces;
+	size_t nVisibleSurfaces = 0;
 
 	bool its_edge = false;
 
-	for (auto& tri : vecTrianglesToRaster)
+	for (size_t k = 0; k < nTris; k++)
 	{
-		vec1 = tri.points[0] - tri.points[1];
-		vec2 = tri.points[2] - tri.points[1];
-
-		float d;
-		fPoint3D v;
-		v = Vector_CrossProduct(vec1, vec2);
-		d = -Vector_DotProduct(v, tri.points[0]);
+		triangle& tri = tris[k];
 
-		if ((Vector_DotProduct(v, barycenter) + d) < 0.0f)
+		bool bFront = true;
+		if (bBackFaces)
 		{
-			v *= -1.0f;;
-			d *= -1.0f;
+			vec1 = tri.points[0] - tri.points[1];
+			vec2 = tri.points[2] - tri.points[1];
+
+			float d;
+			fPoint3D v;
+			v = Vector_CrossProduct(vec1, vec2);
+			d = -Vector_DotProduct(v, tri.points[0]);
+
+			if ((Vector_DotProduct(v, barycenter) + d) < 0.0f)
+			{
+				v *= -1.0f;;
+				d *= -1.0f;
+			}
+
+			bFront = (Vector_DotProduct(v, view_point) + d) < 0.0f;
 		}
 
-		if ((Vector_DotProduct(v, view_point) + d) < 0.0f)
+		if (bFront)
 		{
 			// If its edge
 			if (checkPointAndSegment(tri.points[0], tri.points[2], tri.points[1])) its_edge = true;
@@ -609,83 +1165,67 @@ std::vector<Graphics::triangle> Graphics::RobertsAlgorithm(std::vector<triangle>
 
 			if (!its_edge)
 			{
-				std::vector<fPoint2D> points(3);
+				fPoint2D points[3];
 				for (int16_t i = 0; i < 3; i++)
 				{
 					points[i].x = tri.points[i].x;
 					points[i].y = tri.points[i].y;
 				}
 
-				DrawPolygons(points, sym, col_edge);
-				ShadingPolygonsFloodFillRecursion(points, sym, col, col_edge);
+				if (sides)
+				{
+					// Shared edges once: the second face stops its fill at the line of the first one
+					for (int16_t i = 0; i < 3; i++)
+					{
+						uint32_t edge = sides[3 * k + i];
+						if (edge != UINT32_MAX)
+						{
+							if (edges_drawn[edge])
+								continue;
+							edges_drawn[edge] = 1;
+						}
+						DrawSegment(points[i], points[(i + 1) % 3], sym, col_edge);
+					}
+				}
+				else
+					DrawPolygons(points, 3, sym, col_edge);
+				ShadingPolygonsFloodFillRecursion(points, 3, sym, col, col_edge);
 
-				vecVisibleSurfaces.push_back(tri);
+				if (visible_surfaces)
+					visible_surfaces[nVisibleSurfaces] = tri;
+				nVisibleSurfaces++;
+			}
+			else
+			{
+				PROFILE_COUNT(COUNTER_TRIS_CULLED, 1);
 			}
 			its_edge = false;
 		}
-	}
-
-	return vecVisibleSurfaces;
-}
-void Graphics::DrawShadow(std::vector<triangle>& vecTrianglesToRaster, fPoint3D& light)
-{
-	std::vector<triangle> vecShadow = vecTrianglesToRaster;
-
-	for (auto& tri : vecShadow)
-	{
-		for (int16_t i = 0; i < 3; i++)
+		else
 		{
-			tri.points[i].z *= tri.points[i].w;
-
-			// Infinity light:
-
-			tri.points[i].x -= light.x * (tri.points[i].y / light.y);
-			tri.points[i].z = -tri.points[i].z - light.z * (tri.points[i].y / light.y);
-			tri.points[i].y = 0.95f * static_cast<float>(iConsoleHeight) + tri.points[i].z * 10.0f;
+			PROFILE_COUNT(COUNTER_TRIS_CULLED, 1);
 		}
 	}
 
-	std::vector<fPoint2D> lines(3);
-
-	for (auto& tri : vecShadow)
-	{
-		for (int16_t i = 0; i < 3; i++)
-		{
-			lines[i].x = tri.points[i].x;
-			lines[i].y = tri.points[i].y;
-		}
-
-		// Draw shadow
-		ShadingPolygonsScanLine(lines, PIXEL_SOLID, BG_GREY);
-	}
+	return nVisibleSurfaces;
 }
 
-float Graphics::Vector_DotProduct(fPoint3D& v1, fPoint3D& v2)
+indexedMesh Graphics::MakeIndexedMesh(const mesh& m)
 {
-	return (v1.x * v2.x + v1.y * v2.y + v1.z * v2.z);
-}
+	MeshWelder welder;
 
-float Graphics::Vector_Length(fPoint3D& v)
-{
-	return sqrt(Vector_DotProduct(v, v));;
-}
-
-Graphics::fPoint3D Graphics::Vector_Normalise(fPoint3D& v)
-{
-	float l = Vector_Length(v);
-	return v / l;
-}
+	for (auto& tri : m.tris)
+	{
+		uint32_t i1 = welder.AddVertex(tri.points[0].x, tri.points[0].y, tri.points[0].z);
+		uint32_t i2 = welder.AddVertex(tri.points[1].x, tri.points[1].y, tri.points[1].z);
+		uint32_t i3 = welder.AddVertex(tri.points[2].x, tri.points[2].y, tri.points[2].z);
+		welder.AddFace(i1, i2, i3, tri.sym, tri.col);
+	}
 
-Graphics::fPoint3D Graphics::Vector_CrossProduct(fPoint3D& v1, fPoint3D& v2)
-{
-	fPoint3D v;
-	v.x = v1.y * v2.z - v1.z * v2.y;
-	v.y = v1.z * v2.x - v1.x * v2.z;
-	v.z = v1.x * v2.y - v1.y * v2.x;
-	return v;
+	return welder.Build();
 }
 
-Graphics::fPoint2D Graphics::MultiplyMatrixVector(mat3x3& m, fPoint2D& v)
+Graphics::fPoint2D Graphics::MultiplyMatrixVector(const mat3x3& m, const fPoint2D& v)
 {
 	fPoint2D v1;
 
@@ -694,107 +1234,4 @@ Graphics::fPoint2D Graphics::MultiplyMatrixVector(mat3x3& m, fPoint2D& v)
 	v1.w = v.x * m.m[0][2] + v.y * m.m[1][2] + v.w * m.m[2][2];
 
 	return v1;
-}
-
-Graphics::fPoint3D Graphics::MultiplyMatrixVector(mat4x4& m, fPoint3D& v)
-{
-	fPoint3D v1;
-
-	v1.x = v.x * m.m[0][0] + v.y * m.m[1][0] + v.z * m.m[2][0] + v.w * m.m[3][0];
-	v1.y = v.x * m.m[0][1] + v.y * m.m[1][1] + v.z * m.m[2][1] + v.w * m.m[3][1];
-	v1.z = v.x * m.m[0][2] + v.y * m.m[1][2] + v.z * m.m[2][2] + v.w * m.m[3][2];
-	v1.w = v.x * m.m[0][3] + v.y * m.m[1][3] + v.z * m.m[2][3] + v.w * m.m[3][3];
-
-	return v1;
-}
-
-Graphics::mat4x4 Graphics::Matrix_MakeIdentity()
-{
-	mat4x4 matrix;
-	matrix.m[0][0] = 1.0f;
-	matrix.m[1][1] = 1.0f;
-	matrix.m[2][2] = 1.0f;
-	matrix.m[3][3] = 1.0f;
-	return matrix;
-}
-
-Graphics::mat4x4 Graphics::Matrix_MakeRotationX(float fAngleRad)
-{
-	mat4x4 matrix;
-	matrix.m[0][0] = 1.0f;
-	matrix.m[1][1] = cosf(fAngleRad);
-	matrix.m[1][2] = sinf(fAngleRad);
-	matrix.m[2][1] = -sinf(fAngleRad);
-	matrix.m[2][2] = cosf(fAngleRad);
-	matrix.m[3][3] = 1.0f;
-	return matrix;
-}
-
-Graphics::mat4x4 Graphics::Matrix_MakeRotationY(float fAngleRad)
-{
-	mat4x4 matrix;
-	matrix.m[0][0] = cosf(fAngleRad);
-	matrix.m[0][2] = sinf(fAngleRad);
-	matrix.m[2][0] = -sinf(fAngleRad);
-	matrix.m[1][1] = 1.0f;
-	matrix.m[2][2] = cosf(fAngleRad);
-	matrix.m[3][3] = 1.0f;
-	return matrix;
-}
-
-Graphics::mat4x4 Graphics::Matrix_MakeRotationZ(float fAngleRad)
-{
-	mat4x4 matrix;
-	matrix.m[0][0] = cosf(fAngleRad);
-	matrix.m[0][1] = sinf(fAngleRad);
-	matrix.m[1][0] = -sinf(fAngleRad);
-	matrix.m[1][1] = cosf(fAngleRad);
-	matrix.m[2][2] = 1.0f;
-	matrix.m[3][3] = 1.0f;
-	return matrix;
-}
-
-Graphics::mat4x4 Graphics::Matrix_MakeScale(float x, float y, float z)
-{
-	mat4x4 matrix;
-	matrix.m[0][0] = x;
-	matrix.m[1][1] = y;
-	matrix.m[2][2] = z;
-	matrix.m[3][3] = 1.0f;
-	return matrix;
-}
-
-Graphics::mat4x4 Graphics::Matrix_MakeTranslation(float x, float y, float z)
-{
-	mat4x4 matrix;
-	matrix.m[0][0] = 1.0f;
-	matrix.m[1][1] = 1.0f;
-	matrix.m[2][2] = 1.0f;
-	matrix.m[3][3] = 1.0f;
-	matrix.m[3][0] = x;
-	matrix.m[3][1] = y;
-	matrix.m[3][2] = z;
-	return matrix;
-}
-
-Graphics::mat4x4 Graphics::Matrix_MakeProjection(float fFovDegrees, float fAspectRatio, float fNear, float fFar)
-{
-	float fFovRad = 1.0f / tanf(fFovDegrees * 0.5f / 180.0f * PI);
-	mat4x4 matrix;
-	matrix.m[0][0] = fAspectRatio * fFovRad;
-	matrix.m[1][1] = fFovRad;
-	matrix.m[2][2] = fFar / (fFar - fNear);
-	matrix.m[3][2] = (-fFar * fNear) / (fFar - fNear);
-	matrix.m[2][3] = 1.0f;
-	matrix.m[3][3] = 0.0f;
-	return matrix;
-}
-
-Graphics::mat4x4 Graphics::Matrix_MultiplyMatrix(mat4x4& m1, mat4x4& m2)
-{
-	mat4x4 matrix;
-	for (int16_t c = 0; c < 4; c++)
-		for (int16_t r = 0; r < 4; r++)
-			matrix.m[r][c] = m1.m[r][0] * m2.m[0][c] + m1.m[r][1] * m2.m[1][c] + m1.m[r][2] * m2.m[2][c] + m1.m[r][3] * m2.m[3][c];
-	return matrix;
 }
\ No newline at end of file
@@ -1,4 +1,4 @@
-#ifndef UNICODE
+#if defined(_WIN32) && !defined(UNICODE)
 #error Please enable UNICODE for your compiler! VS: Project Properties -> General -> \
 Character Set -> Use Unicode.
 #endif
@@ -6,8 +6,20 @@ Character Set -> Use Unicode.
 #ifndef _GRAPHICS_H_
 #define _GRAPHICS_H_
 
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
 #include <Windows.h>
+#else
+#define VK_LBUTTON 0x01
+#define VK_ESCAPE 0x1B
+#endif
+
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
 #include <iostream>
 
 #include <chrono>
@@ -19,7 +31,18 @@ Character Set -> Use Unicode.
 #include <cmath>
 #include <algorithm>
 
-constexpr float PI = 3.14159f;
+#include "Clipping.h"
+#include "FrameArena.h"
+#include "FramePacer.h"
+#include "IndexedMesh.h"
+#include "Input.h"
+#include "InputLog.h"
+#include "Math3D.h"
+#include "Profiler.h"
+#include "Surface.h"
+#include "WorkerPool.h"
+
+constexpr float PI = math3d::fPi;
 
 	// Enum of colors for drawing
 enum COLOUR
@@ -40,7 +63,7 @@ enum COLOUR
 	FG_MAGENTA = 0x000D,
 	FG_YELLOW = 0x000E,
 	FG_WHITE = 0x000F,
-	FG_PINK = 0xffc0cb,
+	FG_PINK = FG_MAGENTA,		// Console has no pink (0xffc0cb didn't fit into the attribute)
 	BG_BLACK = 0x0000,
 	BG_DARK_BLUE = 0x0010,
 	BG_DARK_GREEN = 0x0020,
@@ -77,13 +100,34 @@ class Graphics
 	// Main variables for project
 protected:
 	int16_t iConsoleWidth, iConsoleHeight;				// Size of console
-	HANDLE hConsole;									// Current output handle
-	HANDLE m_hConsoleIn;
-	HANDLE hOriginalConsole;							// Original handle (need when we got some error)
-	CHAR_INFO* console;									// Array of characters
-	SMALL_RECT rectWindow;								
+	Framebuffer framebuffer;							// Everything is drawn here
+	sCell* console;										// Array of characters (cells of framebuffer)
+	std::vector<float> vecDepth;						// Depth (z/w) of every cell for RasterTriangleDepth
+	std::unique_ptr<WorkerPool> m_pRasterPool;			// Threads of RasterTrianglesDepthTiled
+	std::unique_ptr<Surface> surface;					// Backend which presents framebuffer
+	FrameArena frameArena;								// Memory of the current frame, reset at the start of every frame
 	std::wstring wsApp_name;
 
+	uint64_t nPixelsWritten;							// Cells written by drawing methods (for benchmarks)
+
+		// Cells drawn since the last CacheBackground / RestoreBackground (inclusive, empty if x1 > x2)
+	struct iDirtyRect
+	{
+		int16_t x1, y1, x2, y2;
+	};
+	iDirtyRect m_dirty;
+	std::vector<sCell> m_vecBackground;					// Cached static background, empty if there is none
+	bool bProfilerOverlay;								// Draw profiler results instead of FPS in the title
+
+		// Title is set only when its text changes, at most every fTitlePeriod
+	float fTitlePeriod;
+	float fTitleTime;
+	wchar_t szTitle[256];
+
+#ifdef _WIN32
+	HANDLE m_hConsoleIn;
+#endif
+
 		// Keyboard using
 	struct sKeyState
 	{
@@ -92,24 +136,37 @@ protected:
 		bool bHeld;
 	};
 
-	int16_t m_keyOldState[256];
-	int16_t m_keyNewState[256];
 	sKeyState m_keys[256];
-
 	sKeyState m_mouse[5];
-	bool m_mouseOldState[5];
-	bool m_mouseNewState[5];
 	bool m_bConsoleInFocus;
 
 	int16_t m_mousePosX;
 	int16_t m_mousePosY;
 
+	InputQueue m_inputQueue;							// Events from the input source, taken at the start of a frame
+	InputThread m_input;
+
+	InputLog* m_pRecordLog;								// Gets input and elapsed time of every frame, if set
+	const InputLog* m_pReplayLog;						// Gives them, if set
+	float m_fReplayStep;								// 0 - recorded elapsed times
+	int32_t m_nReplayFrame;
+	std::FILE* m_pHashDump;								// Hash of every presented frame is written here, if set
+	int32_t m_nDumpFrame;
+
+	FramePacer pacer;									// Clock and pacing of Loop
+	bool bRedraw;										// Next frame of an idle loop is drawn even without input
+
 	// Main methods
 public:
 	Graphics();
 	~Graphics();
 
+#ifdef _WIN32
 	int16_t ConstructConsole(int16_t width, int16_t height, int16_t font_w, int16_t font_h, std::wstring Console_name = L"Light\'s");
+#endif
+	int16_t ConstructHeadless(int16_t width, int16_t height, std::wstring Console_name = L"Light\'s");
+	int16_t ConstructSurface(Surface* new_surface, int16_t width, int16_t height, int16_t font_w, int16_t font_h,
+		std::wstring Console_name = L"Light\'s");
 
 	int16_t GetConsoleWidth();
 	int16_t GetConsoleHeight();
@@ -118,18 +175,48 @@ public:
 	int GetMouseY() { return m_mousePosY; }
 	sKeyState GetMouse(int nMouseButtonID) { return m_mouse[nMouseButtonID]; }
 	bool IsFocused() { return m_bConsoleInFocus; }
+	void SetInputSource(InputSource* source) { m_input.Start(source, m_inputQueue); }	// Takes the source
+	uint64_t GetDroppedInput() const { return m_inputQueue.GetDropped(); }
+
+		// Record & replay of the input. The log must live until the loop ends. Replay
+		// takes the place of the input source, and the loop stops at the end of the log
+	void StartRecording(InputLog* log) { m_pRecordLog = log; }
+	void StartReplay(const InputLog& log, float fTimeStep = 0.0f);
+	int16_t StartHashDump(const char* path);			// Text file: frame number and hash of its cells
+
+	void SetPacing(PACING_MODE mode, float fRate = 60.0f) { pacer.SetMode(mode, fRate); }
+	sFrameStats GetFrameStats() const { return pacer.GetStats(); }
 
 protected:
 	int16_t Error(const wchar_t* msg);
+	void UpdateTitle(float fElapsedTime);
 
 	virtual void OnUserCreate() = 0;
 	virtual void OnUserUpdate(float fElapsedTime) = 0;
+		// PACING_FIXED: called with the fixed step before OnUserUpdate, as many times as
+		// the elapsed time holds. OnUserUpdate then draws between the last two steps
+	virtual void OnUserSimulate(float fStep) {}
+
+	bool IsFixedStep() const { return pacer.GetMode() == PACING_FIXED; }
+	float GetInterpolationAlpha() const { return pacer.GetInterpolationAlpha(); }
+	void RequestRedraw() { bRedraw = true; }
 
 private:
-	void SetConsoleDefault();
+	void HandleInput(bool& bKeyWasPressed);				// bKeyWasPressed is set by any input event
+	bool IsAnyKeyHeld() const;
+	void ApplyKeyEvent(sKeyState& key, bool bDown);
+	bool NextFrameTime(float& fElapsedTime);			// Replay & record of the frame time, false at the end of replay
+	void DumpFrameHash();
 
 public:
 	void Loop();
+	float LoopHeadless(int32_t nFrames, float fTimeStep);			// Returns wall time of all frames in seconds
+	void CloseSurface() { surface.reset(); }						// No Loop after that, until the next Construct
+
+	void ShowProfilerOverlay(bool bShow) { bProfilerOverlay = bShow; }
+
+private:
+	void DrawProfilerOverlay();
 
 //---Draw---//
 	// Drawing variables & structures
@@ -190,19 +277,19 @@ protected:
 			return *this;
 		}
 
-		fPoint2D operator+(const fPoint2D& obj)
+		fPoint2D operator+(const fPoint2D& obj) const
 		{
 			return fPoint2D(x + obj.x, y + obj.y);
 		}
-		fPoint2D operator-(const fPoint2D& obj)
+		fPoint2D operator-(const fPoint2D& obj) const
 		{
 			return fPoint2D(x - obj.x, y - obj.y);
 		}
-		fPoint2D operator*(float value)
+		fPoint2D operator*(float value) const
 		{
 			return fPoint2D(x * value, y * value);
 		}
-		fPoint2D operator/(float value)
+		fPoint2D operator/(float value) const
 		{
 			return fPoint2D(x / value, y / value);
 		}
@@ -217,11 +304,13 @@ protected:
 	struct iEdgeScanLine
 	{
 		int16_t x1, x2, y1, y2;
+		int16_t y_top, y_bottom;						// min & max of y1, y2
 		float del_x, del_y, del_xy, del_yx;
 
 		iEdgeScanLine()
 		{
 			x1 = x2 = y1 = y2 = 0;
+			y_top = y_bottom = 0;
 			del_x = del_y = del_xy = del_yx = 0.0f;
 		}
 
@@ -231,6 +320,8 @@ protected:
 			x2 = obj.x2;
 			y1 = obj.y1;
 			y2 = obj.y2;
+			y_top = obj.y_top;
+			y_bottom = obj.y_bottom;
 			del_x = obj.del_x;
 			del_y = obj.del_y;
 			del_xy = obj.del_xy;
@@ -239,19 +330,7 @@ protected:
 		}
 	};
 		// Structs for 3D graphics
-	struct mat4x4
-	{
-		float m[4][4] = { 0 };
-
-		mat4x4 operator*(mat4x4& _m)
-		{
-			mat4x4 matrix;
-			for (int16_t c = 0; c < 4; c++)
-				for (int16_t r = 0; r < 4; r++)
-					matrix.m[r][c] = m[r][0] * _m.m[0][c] + m[r][1] * _m.m[1][c] + m[r][2] * _m.m[2][c] + m[r][3] * _m.m[3][c];
-			return matrix;
-		}
-	};
+	typedef math3d::mat4 mat4x4;						// Product is in Math3D.h (SSE where there is one)
 	struct fPoint3D										// Point struct, which have X,Y coords
 	{
 		float x, y, z, w;
@@ -259,6 +338,11 @@ protected:
 	public:
 		fPoint3D() : x(0.0f), y(0.0f), z(0.0f), w(1.0f) {}
 		fPoint3D(float x, float y, float z, float w = 1.0f) : x(x), y(y), z(z), w(w) {}
+		fPoint3D(const math3d::vec3& v) : x(v.x), y(v.y), z(v.z), w(1.0f) {}
+		fPoint3D(const math3d::vec4& v) : x(v.x), y(v.y), z(v.z), w(v.w) {}
+
+		math3d::vec3 Vec3() const { return { x, y, z }; }
+		math3d::vec4 Vec4() const { return { x, y, z, w }; }
 
 		fPoint3D& operator=(const fPoint3D& obj)
 		{
@@ -312,7 +396,7 @@ protected:
 			return *this;
 		}
 
-		bool operator==(fPoint3D& obj)
+		bool operator==(const fPoint3D& obj) const
 		{
 			if (fabsf(x - obj.x) < 0.001f)
 				if (fabsf(y - obj.y) < 0.001f)
@@ -321,19 +405,19 @@ protected:
 			return false;
 		}
 
-		fPoint3D operator+(const fPoint3D& obj)
+		fPoint3D operator+(const fPoint3D& obj) const
 		{
 			return fPoint3D(x + obj.x, y + obj.y, z + obj.z, w);
 		}
-		fPoint3D operator-(const fPoint3D& obj)
+		fPoint3D operator-(const fPoint3D& obj) const
 		{
 			return fPoint3D(x - obj.x, y - obj.y, z - obj.z, w);
 		}
-		fPoint3D operator*(float value)
+		fPoint3D operator*(float value) const
 		{
 			return fPoint3D(x * value, y * value, z * value, w);
 		}
-		fPoint3D operator/(float value)
+		fPoint3D operator/(float value) const
 		{
 			return fPoint3D(x / value, y / value, z / value, w);
 		}
@@ -370,19 +454,82 @@ protected:
 public:
 	void Draw(int16_t x, int16_t y, int16_t sym = ' ', int16_t col = BG_WHITE);
 	void DrawLineBresenham(int16_t x1, int16_t y1, int16_t x2, int16_t y2, int16_t sym = ' ', int16_t col = BG_WHITE);
-	void DrawPolygons(std::vector<fPoint2D>& points, int16_t sym = ' ', int16_t col = BG_WHITE);
+	void DrawPolygons(const fPoint2D* points, size_t nPoints, int16_t sym = ' ', int16_t col = BG_WHITE);
+	void DrawSegment(const fPoint2D& p1, const fPoint2D& p2, int16_t sym = ' ', int16_t col = BG_WHITE);	// Cut to the guard band
+	void DrawString(int16_t x, int16_t y, const wchar_t* text, int16_t col = FG_WHITE);
+	int16_t DrawSpan(int16_t x1, int16_t x2, int16_t y, int16_t sym = PIXEL_SOLID, int16_t col = FG_WHITE);	// Returns count of cells
+	int16_t DrawVerticalSpan(int16_t x, int16_t y1, int16_t y2, int16_t sym = PIXEL_SOLID, int16_t col = FG_WHITE);
 
 		// Clear our console
 	void Fill(int16_t x1, int16_t y1, int16_t x2, int16_t y2, int16_t sym = PIXEL_SOLID, int16_t col = FG_BLACK);
+	void FillPattern(int16_t x1, int16_t y1, int16_t x2, int16_t y2, const sCell* pattern, int16_t pattern_w, int16_t pattern_h);
+	void Clear(int16_t sym = PIXEL_SOLID, int16_t col = FG_BLACK);
 	void Clip(int16_t& x, int16_t& y);
 
-	void ShadingPolygonsScanLine(const std::vector<fPoint2D>& points, int16_t sym = ' ', int16_t col = BG_WHITE,
+		// Screen with a screen-sized band around it: lines and polygons are cut to it,
+		// so their coords stay small, and what is left is cut by Clip cell by cell
+	sClipRect GetGuardRect() const
+	{
+		float fWidth = static_cast<float>(iConsoleWidth), fHeight = static_cast<float>(iConsoleHeight);
+		return { -fWidth, -fHeight, 2.0f * fWidth, 2.0f * fHeight };
+	}
+
+		// Static background: CacheBackground remembers the screen, RestoreBackground
+		// puts it back only where something was drawn after that
+	void CacheBackground();
+	bool RestoreBackground();							// false if there is no background
+	void InvalidateBackground();
+
+	void ShadingPolygonsScanLine(const fPoint2D* points, size_t nPoints, int16_t sym = ' ', int16_t col = BG_WHITE,
 		int16_t y_min = -1, int16_t y_max = -1, int16_t x_min = -1, int16_t x_max = -1);
-	void ShadingPolygonsFloodFillRecursion(const std::vector<fPoint2D>& points, int16_t sym = ' ',
+	void ShadingPolygonsFloodFillRecursion(const fPoint2D* points, size_t nPoints, int16_t sym = ' ',
 		int16_t col = BG_WHITE, int16_t col_edges = BG_WHITE);
 
+		// Z-buffer: triangle is drawn only where it is nearer than what is already there
+	void ClearDepth();
+	void RasterTriangleDepth(const triangle& tri, int16_t sym = PIXEL_SOLID, int16_t col = FG_WHITE,
+		int16_t y_min = -1, int16_t y_max = -1, int16_t x_min = -1, int16_t x_max = -1);
+
+		// Same as RasterTriangleDepth for every triangle (with its sym & col), but the screen is cut
+		// into tiles and the tiles are drawn in parallel. The result doesn't depend on the threads
+	void SetRasterThreads(int32_t nThreads);			// 0 - one per core
+	int32_t GetRasterThreads() const { return m_pRasterPool ? m_pRasterPool->GetThreadCount() : 1; }
+	void RasterTrianglesDepthTiled(const triangle* tris, size_t nTris);
+
 private:
-	void FillingFloodFill(CHAR_INFO* console_ptr, int16_t x, int16_t y, int16_t sym, int16_t col, int16_t col_edges);
+		// Seed of a horizontal run for the scanline seed fill
+	struct iSeedSpan
+	{
+		int16_t x, y;
+	};
+
+	std::vector<iSeedSpan> m_vecSeedStack;				// Reused between fills, so it grows only once
+
+	void PushSeedSpans(int16_t x_left, int16_t x_right, int16_t y, int16_t col, int16_t col_edges);
+
+protected:
+		// Scanline seed fill from (x, y) up to the col_edges cells
+	void FillingFloodFill(int16_t x, int16_t y, int16_t sym, int16_t col, int16_t col_edges);
+		// Heap of the seed stack, it keeps the size of the biggest fill so far
+	size_t GetSeedStackBytes() const { return m_vecSeedStack.capacity() * sizeof(iSeedSpan); }
+
+private:
+
+	void MarkDirty(int16_t x1, int16_t y1, int16_t x2, int16_t y2)
+	{
+		m_dirty.x1 = std::min(m_dirty.x1, x1);
+		m_dirty.y1 = std::min(m_dirty.y1, y1);
+		m_dirty.x2 = std::max(m_dirty.x2, x2);
+		m_dirty.y2 = std::max(m_dirty.y2, y2);
+	}
+	void ResetDirty() { m_dirty = { iConsoleWidth, iConsoleHeight, -1, -1 }; }
+
+	static const int16_t iTileSize = 32;				// Cells in the side of a tile
+
+		// Body of RasterTriangleDepth: touches nothing but cells inside the rect, returns count of written cells.
+		// If something is written, bounds gets the scanned part of the rect
+	int32_t RasterTriangleDepthRect(const triangle& tri, int16_t sym, int16_t col, int16_t y_min, int16_t y_max,
+		int16_t x_min, int16_t x_max, iDirtyRect* bounds = nullptr);
 
 	// Actions methods
 private:
@@ -390,29 +537,40 @@ private:
 	bool checkPointAndSegment(const fPoint3D& start, const fPoint3D& p, const fPoint3D& end);
 
 public:
-	std::vector<triangle> RobertsAlgorithm(std::vector<triangle>& vecTrianglesToRaster, fPoint3D& view_point, fPoint3D& barycenter,
-		int16_t sym = PIXEL_SOLID, int16_t col = FG_BLUE, int16_t col_edge = FG_GREY);
-
-	void DrawShadow(std::vector<triangle>& vecTrianglesToRaster, fPoint3D& light);
+		// Visible faces are copied to visible_surfaces (if it isn't nullptr, nTris places), returns their count.
+		// bBackFaces is false when faces turned away are already dropped: only the edge-on test is left.
+		// sides (3 per triangle) are the edges of the mesh the sides of the triangles lie on, UINT32_MAX -
+		// none: an edge is drawn by the first triangle with it and marked in edges_drawn, the next one skips it
+	size_t RobertsAlgorithm(triangle* tris, size_t nTris, fPoint3D& view_point, fPoint3D& barycenter,
+		triangle* visible_surfaces = nullptr, int16_t sym = PIXEL_SOLID, int16_t col = FG_BLUE, int16_t col_edge = FG_GREY,
+		bool bBackFaces = true, const uint32_t* sides = nullptr, uint8_t* edges_drawn = nullptr);
+
+	// Mesh methods
+public:
+	indexedMesh MakeIndexedMesh(const mesh& m);			// Welds equal vertices of triangles
 
 	// Matrix methods (Use this for 3D)
 public:
-	float Vector_DotProduct(fPoint3D& v1, fPoint3D& v2);
-	float Vector_Length(fPoint3D& v);
-	fPoint3D Vector_Normalise(fPoint3D& v);
-	fPoint3D Vector_CrossProduct(fPoint3D& v1, fPoint3D& v2);
+		// Inline wrappers of Math3D.h, so the callers can fold them
+	static float Vector_DotProduct(const fPoint3D& v1, const fPoint3D& v2) { return math3d::Dot(v1.Vec3(), v2.Vec3()); }
+	static float Vector_Length(const fPoint3D& v) { return math3d::Length(v.Vec3()); }
+	static fPoint3D Vector_Normalise(const fPoint3D& v) { return v / Vector_Length(v); }
+	static fPoint3D Vector_CrossProduct(const fPoint3D& v1, const fPoint3D& v2) { return math3d::Cross(v1.Vec3(), v2.Vec3()); }
 	
-	fPoint2D MultiplyMatrixVector(mat3x3& m, fPoint2D& v);
-	fPoint3D MultiplyMatrixVector(mat4x4& m, fPoint3D& v);
-
-	mat4x4 Matrix_MakeIdentity();
-	mat4x4 Matrix_MakeRotationX(float fAngleRad);
-	mat4x4 Matrix_MakeRotationY(float fAngleRad);
-	mat4x4 Matrix_MakeRotationZ(float fAngleRad);
-	mat4x4 Matrix_MakeScale(float x, float y, float z);
-	mat4x4 Matrix_MakeTranslation(float x, float y, float z);
-	mat4x4 Matrix_MakeProjection(float fFovDegrees, float fAspectRatio, float fNear, float fFar);
-	mat4x4 Matrix_MultiplyMatrix(mat4x4& m1, mat4x4& m2);
+	static fPoint2D MultiplyMatrixVector(const mat3x3& m, const fPoint2D& v);
+	static fPoint3D MultiplyMatrixVector(const mat4x4& m, const fPoint3D& v) { return math3d::Transform(m, v.Vec4()); }
+
+	static mat4x4 Matrix_MakeIdentity() { return math3d::MakeIdentity(); }
+	static mat4x4 Matrix_MakeRotationX(float fAngleRad) { return math3d::MakeRotationX(fAngleRad); }
+	static mat4x4 Matrix_MakeRotationY(float fAngleRad) { return math3d::MakeRotationY(fAngleRad); }
+	static mat4x4 Matrix_MakeRotationZ(float fAngleRad) { return math3d::MakeRotationZ(fAngleRad); }
+	static mat4x4 Matrix_MakeScale(float x, float y, float z) { return math3d::MakeScale(x, y, z); }
+	static mat4x4 Matrix_MakeTranslation(float x, float y, float z) { return math3d::MakeTranslation(x, y, z); }
+	static mat4x4 Matrix_MakeProjection(float fFovDegrees, float fAspectRatio, float fNear, float fFar)
+	{
+		return math3d::MakeProjection(fFovDegrees, fAspectRatio, fNear, fFar);
+	}
+	static mat4x4 Matrix_MultiplyMatrix(const mat4x4& m1, const mat4x4& m2) { return math3d::Multiply(m1, m2); }
 };
 
 #endif // !_GRAPHICS_H_
@@ -0,0 +1,229 @@
+#include "IndexedMesh.h"
+
+#include <algorithm>
+#include <cmath>
+
+sMeshView indexedMesh::View() const
+{
+	sMeshView view;
+
+	view.x = vertices.x.data();
+	view.y = vertices.y.data();
+	view.z = vertices.z.data();
+	view.nVertices = static_cast<uint32_t>(vertices.Size());
+
+	view.indices16 = indices16.empty() ? nullptr : indices16.data();
+	view.indices32 = indices32.empty() ? nullptr : indices32.data();
+	view.faces = faces.data();
+	view.nFaces = static_cast<uint32_t>(faces.size());
+	view.planes = planes.empty() ? nullptr : planes.data();
+	view.edges = edges.empty() ? nullptr : edges.data();
+	view.sides = sides.empty() ? nullptr : sides.data();
+	view.nEdges = static_cast<uint32_t>(edges.size());
+
+	return view;
+}
+
+size_t indexedMesh::MemoryUsage() const
+{
+	return vertices.Size() * 3 * sizeof(float) + indices16.size() * sizeof(uint16_t) + indices32.size() * sizeof(uint32_t)
+		+ faces.size() * sizeof(sFaceAttr) + planes.size() * sizeof(sFacePlane) + edges.size() * sizeof(sMeshEdge)
+		+ sides.size() * sizeof(uint32_t);
+}
+
+void indexedMesh::BuildPlanes()
+{
+	BuildFacePlanes(View(), planes);
+}
+
+void indexedMesh::BuildEdges()
+{
+	BuildMeshEdges(View(), edges, sides);
+}
+
+bool BuildFacePlanes(const sMeshView& mesh, std::vector<sFacePlane>& planes)
+{
+	planes.clear();
+	if (!mesh.nFaces)
+		return false;
+
+	// Sorted edges: a closed mesh has every edge twice, the same
+	// winding goes along the shared edge in opposite directions
+	struct sEdge
+	{
+		uint32_t v1, v2;								// v1 < v2
+		bool bReversed;
+	};
+	std::vector<sEdge> edges(3 * static_cast<size_t>(mesh.nFaces));
+	for (uint32_t k = 0; k < mesh.nFaces; k++)
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			uint32_t a = mesh.Index(3 * k + i), b = mesh.Index(3 * k + (i + 1) % 3);
+			edges[3 * k + i] = { std::min(a, b), std::max(a, b), a > b };
+		}
+	std::sort(edges.begin(), edges.end(), [](const sEdge& e1, const sEdge& e2)
+		{
+			return (e1.v1 != e2.v1) ? e1.v1 < e2.v1 : e1.v2 < e2.v2;
+		});
+
+	bool bWinding = true;
+	for (size_t i = 0; i < edges.size(); i += 2)
+	{
+		bool bPair = i + 1 < edges.size() && edges[i].v1 == edges[i + 1].v1 && edges[i].v2 == edges[i + 1].v2;
+		if (!bPair || (i + 2 < edges.size() && edges[i + 2].v1 == edges[i].v1 && edges[i + 2].v2 == edges[i].v2))
+			return false;
+		bWinding = bWinding && edges[i].bReversed != edges[i + 1].bReversed;
+	}
+
+	float cx = 0.0f, cy = 0.0f, cz = 0.0f;
+	for (uint32_t i = 0; i < mesh.nVertices; i++)
+	{
+		cx += mesh.x[i];
+		cy += mesh.y[i];
+		cz += mesh.z[i];
+	}
+	cx /= mesh.nVertices;
+	cy /= mesh.nVertices;
+	cz /= mesh.nVertices;
+
+	// Degenerate faces get a zero plane: no side sees them
+	planes.resize(mesh.nFaces);
+	float fVolume = 0.0f;
+	for (uint32_t k = 0; k < mesh.nFaces; k++)
+	{
+		uint32_t i0 = mesh.Index(3 * k), i1 = mesh.Index(3 * k + 1), i2 = mesh.Index(3 * k + 2);
+		float ax = mesh.x[i1] - mesh.x[i0], ay = mesh.y[i1] - mesh.y[i0], az = mesh.z[i1] - mesh.z[i0];
+		float bx = mesh.x[i2] - mesh.x[i0], by = mesh.y[i2] - mesh.y[i0], bz = mesh.z[i2] - mesh.z[i0];
+		float nx = ay * bz - az * by, ny = az * bx - ax * bz, nz = ax * by - ay * bx;
+
+		float fLength = std::sqrt(nx * nx + ny * ny + nz * nz);
+		if (fLength <= 0.0f)
+		{
+			planes[k] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			continue;
+		}
+
+		sFacePlane& plane = planes[k];
+		plane = { nx / fLength, ny / fLength, nz / fLength, 0.0f };
+		plane.d = -(plane.nx * mesh.x[i0] + plane.ny * mesh.y[i0] + plane.nz * mesh.z[i0]);
+
+		// Tetrahedra from the centroid, signed by the winding
+		fVolume += fLength * (plane.nx * cx + plane.ny * cy + plane.nz * cz + plane.d);
+		if (!bWinding && plane.nx * cx + plane.ny * cy + plane.nz * cz + plane.d > 0.0f)
+			plane = { -plane.nx, -plane.ny, -plane.nz, -plane.d };
+	}
+
+	if (bWinding && fVolume > 0.0f)
+		for (sFacePlane& plane : planes)
+			plane = { -plane.nx, -plane.ny, -plane.nz, -plane.d };
+
+	return true;
+}
+
+bool BuildMeshEdges(const sMeshView& mesh, std::vector<sMeshEdge>& edges, std::vector<uint32_t>& sides)
+{
+	edges.clear();
+	sides.clear();
+	if (!mesh.planes)
+		return false;
+
+	// Sides of the faces as they go around their outward normals: a face wound
+	// the other way round goes backwards. Then the two sides of an edge are neighbours
+	struct sSide
+	{
+		uint32_t v1, v2;								// v1 < v2
+		uint32_t side;									// 3 * face + i
+		bool bReversed;									// Goes from v2 to v1
+	};
+	std::vector<sSide> face_sides(3 * static_cast<size_t>(mesh.nFaces));
+	for (uint32_t k = 0; k < mesh.nFaces; k++)
+	{
+		uint32_t i0 = mesh.Index(3 * k), i1 = mesh.Index(3 * k + 1), i2 = mesh.Index(3 * k + 2);
+		float ax = mesh.x[i1] - mesh.x[i0], ay = mesh.y[i1] - mesh.y[i0], az = mesh.z[i1] - mesh.z[i0];
+		float bx = mesh.x[i2] - mesh.x[i0], by = mesh.y[i2] - mesh.y[i0], bz = mesh.z[i2] - mesh.z[i0];
+		const sFacePlane& plane = mesh.planes[k];
+		bool bFlip = plane.nx * (ay * bz - az * by) + plane.ny * (az * bx - ax * bz) + plane.nz * (ax * by - ay * bx) < 0.0f;
+
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			uint32_t a = mesh.Index(3 * k + i), b = mesh.Index(3 * k + (i + 1) % 3);
+			face_sides[3 * k + i] = { std::min(a, b), std::max(a, b), 3 * k + i, (a > b) != bFlip };
+		}
+	}
+	std::sort(face_sides.begin(), face_sides.end(), [](const sSide& s1, const sSide& s2)
+		{
+			return (s1.v1 != s2.v1) ? s1.v1 < s2.v1 : s1.v2 < s2.v2;
+		});
+
+	// Planes are built only for closed meshes: the sides come in pairs
+	edges.resize(face_sides.size() / 2);
+	sides.resize(face_sides.size());
+	for (size_t i = 0; i + 1 < face_sides.size(); i += 2)
+	{
+		const sSide& side = face_sides[i];
+		uint32_t f1 = side.side / 3, f2 = face_sides[i + 1].side / 3;
+		if (side.bReversed)
+			edges[i / 2] = { side.v2, side.v1, f1, f2 };
+		else
+			edges[i / 2] = { side.v1, side.v2, f1, f2 };
+		sides[side.side] = sides[face_sides[i + 1].side] = static_cast<uint32_t>(i / 2);
+	}
+
+	return true;
+}
+
+MeshWelder::MeshWelder(float fEpsilon)
+{
+	fInvEpsilon = 1.0f / fEpsilon;
+}
+
+uint32_t MeshWelder::AddVertex(float x, float y, float z)
+{
+	// Vertices closer than epsilon fall into the same cell of the grid
+	sKey key = { static_cast<int32_t>(std::lround(x * fInvEpsilon)), static_cast<int32_t>(std::lround(y * fInvEpsilon)),
+		static_cast<int32_t>(std::lround(z * fInvEpsilon)) };
+
+	auto it = mapVertices.find(key);
+	if (it != mapVertices.end())
+		return it->second;
+
+	uint32_t index = static_cast<uint32_t>(vertices.Size());
+	vertices.x.push_back(x);
+	vertices.y.push_back(y);
+	vertices.z.push_back(z);
+	mapVertices.emplace(key, index);
+
+	return index;
+}
+
+void MeshWelder::AddFace(uint32_t i1, uint32_t i2, uint32_t i3, int16_t sym, int16_t col)
+{
+	indices.push_back(i1);
+	indices.push_back(i2);
+	indices.push_back(i3);
+	faces.push_back({ sym, col });
+}
+
+indexedMesh MeshWelder::Build()
+{
+	indexedMesh result;
+
+	result.vertices = std::move(vertices);
+	result.faces = std::move(faces);
+
+	if (result.vertices.Size() <= 0xFFFF)
+		result.indices16.assign(indices.begin(), indices.end());
+	else
+		result.indices32 = std::move(indices);
+
+	result.vertices.x.shrink_to_fit();
+	result.vertices.y.shrink_to_fit();
+	result.vertices.z.shrink_to_fit();
+
+	mapVertices.clear();
+	vertices = sVertexBatch();
+	indices.clear();
+	faces.clear();
+
+	return result;
+}
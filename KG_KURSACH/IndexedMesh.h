@@ -0,0 +1,120 @@
+#ifndef _INDEXED_MESH_H_
+#define _INDEXED_MESH_H_
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "VertexTransform.h"
+
+//###################//
+	// Indexed meshes
+//###################//
+
+	// Attributes of one face
+struct sFaceAttr
+{
+	int16_t sym;
+	int16_t col;
+};
+
+	// Plane of a face: dot(n, p) + d = 0, the normal looks out of the mesh
+struct sFacePlane
+{
+	float nx, ny, nz, d;
+};
+
+	// Edge of a closed mesh and the two faces on its sides. v1 -> v2 goes
+	// counter-clockwise around f1 seen from outside, so f2 goes v2 -> v1
+struct sMeshEdge
+{
+	uint32_t v1, v2;
+	uint32_t f1, f2;
+};
+
+	// Read-only view of an indexed mesh. The render path works only with views,
+	// so the data can live in an indexedMesh or anywhere else (e.g. a mapped file)
+struct sMeshView
+{
+	const float* x;
+	const float* y;
+	const float* z;
+	uint32_t nVertices;
+
+	const uint16_t* indices16;							// 3 per face, one of them is set
+	const uint32_t* indices32;
+	const sFaceAttr* faces;
+	uint32_t nFaces;
+
+	const sFacePlane* planes;							// One per face, nullptr for open meshes (or not built)
+	const sMeshEdge* edges;								// Every edge once, nullptr without planes (or not built)
+	const uint32_t* sides;								// Edge of every side of the faces, 3 per face, with edges
+	uint32_t nEdges;
+
+	uint32_t Index(size_t i) const { return indices16 ? indices16[i] : indices32[i]; }
+};
+
+	// Compact mesh: shared SoA vertices, 16/32-bit index buffer and attributes of faces
+struct indexedMesh
+{
+	sVertexBatch vertices;
+	std::vector<uint16_t> indices16;					// Used while vertices fit in 16 bits
+	std::vector<uint32_t> indices32;
+	std::vector<sFaceAttr> faces;
+	std::vector<sFacePlane> planes;						// Empty until BuildPlanes
+	std::vector<sMeshEdge> edges;						// Empty until BuildEdges
+	std::vector<uint32_t> sides;
+
+	sMeshView View() const;
+	size_t MemoryUsage() const;							// Bytes of all arrays
+	void BuildPlanes();
+	void BuildEdges();									// After BuildPlanes
+};
+
+	// Planes of the faces of a closed mesh (every edge is in two faces), false and no
+	// planes for an open one: its back faces can be seen. With the same winding on
+	// all faces the normals go out by the sign of the volume, else every normal is
+	// turned away from the centroid of the vertices (right for convex meshes)
+bool BuildFacePlanes(const sMeshView& mesh, std::vector<sFacePlane>& planes);
+
+	// Edges with their faces, each of them once, and the edge of every side of the
+	// faces (side i of face k goes from index 3k + i to the next one). Needs the
+	// planes: they tell which way is out, so the edges keep their direction even if
+	// the winding of the faces is mixed. False and nothing for a mesh without planes
+bool BuildMeshEdges(const sMeshView& mesh, std::vector<sMeshEdge>& edges, std::vector<uint32_t>& sides);
+
+	// Builds an indexedMesh from separate triangles, welding equal vertices
+class MeshWelder
+{
+private:
+	struct sKey
+	{
+		int32_t x, y, z;
+
+		bool operator==(const sKey& obj) const { return x == obj.x && y == obj.y && z == obj.z; }
+	};
+	struct sKeyHash
+	{
+		size_t operator()(const sKey& key) const
+		{
+			return (static_cast<size_t>(key.x) * 73856093u) ^ (static_cast<size_t>(key.y) * 19349663u) ^ (static_cast<size_t>(key.z) * 83492791u);
+		}
+	};
+
+	float fInvEpsilon;
+	std::unordered_map<sKey, uint32_t, sKeyHash> mapVertices;
+
+	sVertexBatch vertices;
+	std::vector<uint32_t> indices;
+	std::vector<sFaceAttr> faces;
+
+public:
+	MeshWelder(float fEpsilon = 0.001f);
+
+	uint32_t AddVertex(float x, float y, float z);
+	void AddFace(uint32_t i1, uint32_t i2, uint32_t i3, int16_t sym, int16_t col);
+
+	indexedMesh Build();
+};
+
+#endif // !_INDEXED_MESH_H_
@@ -0,0 +1,218 @@
+#include "Input.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+ConsoleInputSource::ConsoleInputSource(HANDLE hConsoleIn) : hConsoleIn(hConsoleIn)
+{
+	std::memset(bKeyDown, 0, sizeof(bKeyDown));
+	std::memset(bMouseDown, 0, sizeof(bMouseDown));
+}
+
+void ConsoleInputSource::Poll(InputQueue& queue)
+{
+	// Sleeps until console input comes, but not longer than 1 ms, so keys are
+	// checked about 1000 times per second
+	WaitForSingleObject(hConsoleIn, 1);
+
+	// Handle Keyboard Input
+	for (int16_t i = 0; i < 256; i++)
+	{
+		bool bDown = (GetAsyncKeyState(i) & 0x8000) != 0;
+		if (bDown != bKeyDown[i])
+		{
+			bKeyDown[i] = bDown;
+			queue.Push({ EVENT_KEY, static_cast<uint8_t>(i), bDown, 0, 0 });
+		}
+	}
+
+	// Handle Mouse Input - Check for window events
+	INPUT_RECORD inBuf[32];
+	DWORD events = 0;
+	GetNumberOfConsoleInputEvents(hConsoleIn, &events);
+	if (events > 0)
+		ReadConsoleInput(hConsoleIn, inBuf, std::min<DWORD>(events, 32), &events);
+
+	for (DWORD i = 0; i < events; i++)
+	{
+		switch (inBuf[i].EventType)
+		{
+		case FOCUS_EVENT:
+			queue.Push({ EVENT_FOCUS, 0, inBuf[i].Event.FocusEvent.bSetFocus != 0, 0, 0 });
+			break;
+
+		case MOUSE_EVENT:
+		{
+			switch (inBuf[i].Event.MouseEvent.dwEventFlags)
+			{
+			case MOUSE_MOVED:
+				queue.Push({ EVENT_MOUSE_MOVE, 0, false,
+					inBuf[i].Event.MouseEvent.dwMousePosition.X, inBuf[i].Event.MouseEvent.dwMousePosition.Y });
+				break;
+
+			case 0:
+				for (int16_t m = 0; m < 5; m++)
+				{
+					bool bDown = (inBuf[i].Event.MouseEvent.dwButtonState & (1 << m)) != 0;
+					if (bDown != bMouseDown[m])
+					{
+						bMouseDown[m] = bDown;
+						queue.Push({ EVENT_MOUSE_BUTTON, static_cast<uint8_t>(m), bDown, 0, 0 });
+					}
+				}
+				break;
+
+			default:
+				break;
+			}
+		}
+		break;
+
+		default:
+			break;
+		}
+	}
+}
+#endif
+
+ScriptedInputSource::ScriptedInputSource()
+{
+	nNext = 0;
+	nFrame = 0;
+}
+
+void ScriptedInputSource::Poll(InputQueue& queue)
+{
+	for (; nNext < vecEvents.size() && vecEvents[nNext].frame <= nFrame; nNext++)
+		queue.Push(vecEvents[nNext].event);
+	nFrame++;
+}
+
+void ScriptedInputSource::Add(int32_t frame, const sInputEvent& event)
+{
+	// After the events of the same frame, so they come in the order of adding
+	auto it = std::upper_bound(vecEvents.begin(), vecEvents.end(), frame,
+		[](int32_t f, const sScriptEvent& e) { return f < e.frame; });
+	vecEvents.insert(it, { frame, event });
+}
+
+int16_t ScriptedInputSource::Load(const char* path)
+{
+	FILE* file = std::fopen(path, "r");
+	if (!file)
+	{
+		wprintf(L"ERROR: can't open %hs\n", path);
+		return 1;
+	}
+
+	char line[256];
+	int32_t nLine = 0;
+	int16_t result = 0;
+
+	while (std::fgets(line, sizeof(line), file))
+	{
+		nLine++;
+
+		char* comment = std::strchr(line, '#');
+		if (comment)
+			*comment = '\0';
+
+		int32_t frame;
+		char kind[16], arg[16], state[16];
+		int n = std::sscanf(line, "%d %15s %15s %15s", &frame, kind, arg, state);
+		if (n <= 0)
+			continue;
+
+		sInputEvent event = { 0, 0, false, 0, 0 };
+		bool bValid = n >= 3 && frame >= 0;
+
+		if (bValid && !std::strcmp(kind, "key") && n == 4)
+		{
+			// One letter or digit is its virtual key, anything else is the code itself
+			event.type = EVENT_KEY;
+			if (std::strlen(arg) == 1 && std::isalnum(static_cast<unsigned char>(arg[0])))
+				event.code = static_cast<uint8_t>(std::toupper(static_cast<unsigned char>(arg[0])));
+			else
+				event.code = static_cast<uint8_t>(std::atoi(arg));
+			event.bDown = !std::strcmp(state, "down");
+			bValid = event.bDown || !std::strcmp(state, "up");
+		}
+		else if (bValid && !std::strcmp(kind, "mouse") && n == 4)
+		{
+			event.type = EVENT_MOUSE_BUTTON;
+			event.code = static_cast<uint8_t>(std::atoi(arg));
+			event.bDown = !std::strcmp(state, "down");
+			bValid = event.code < 5 && (event.bDown || !std::strcmp(state, "up"));
+		}
+		else if (bValid && !std::strcmp(kind, "move") && n == 4)
+		{
+			event.type = EVENT_MOUSE_MOVE;
+			event.x = static_cast<int16_t>(std::atoi(arg));
+			event.y = static_cast<int16_t>(std::atoi(state));
+		}
+		else if (bValid && !std::strcmp(kind, "focus"))
+		{
+			event.type = EVENT_FOCUS;
+			event.bDown = std::atoi(arg) != 0;
+		}
+		else
+			bValid = false;
+
+		if (!bValid)
+		{
+			wprintf(L"ERROR: %hs:%d: wrong input event\n", path, nLine);
+			result = 1;
+			break;
+		}
+
+		Add(frame, event);
+	}
+
+	std::fclose(file);
+	return result;
+}
+
+InputThread::InputThread()
+{
+	pQueue = nullptr;
+	bRunning = false;
+}
+
+InputThread::~InputThread()
+{
+	Stop();
+}
+
+void InputThread::Start(InputSource* source, InputQueue& queue)
+{
+	Stop();
+
+	pSource.reset(source);
+	pQueue = &queue;
+
+	if (pSource && pSource->IsThreaded())
+	{
+		bRunning = true;
+		thread = std::thread([this]()
+			{
+				while (bRunning.load(std::memory_order_relaxed))
+					pSource->Poll(*pQueue);
+			});
+	}
+}
+
+void InputThread::Stop()
+{
+	bRunning = false;
+	if (thread.joinable())
+		thread.join();
+}
+
+void InputThread::Update()
+{
+	if (pSource && !pSource->IsThreaded())
+		pSource->Poll(*pQueue);
+}
@@ -0,0 +1,163 @@
+#ifndef _INPUT_H_
+#define _INPUT_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#endif
+
+//###################//
+	// Input events
+//###################//
+
+enum INPUT_EVENT
+{
+	EVENT_KEY,											// code - virtual key, bDown
+	EVENT_MOUSE_BUTTON,									// code - button 0 ... 4, bDown
+	EVENT_MOUSE_MOVE,									// x, y in cells
+	EVENT_FOCUS											// bDown - window got the focus
+};
+
+struct sInputEvent
+{
+	uint8_t type;
+	uint8_t code;
+	bool bDown;
+	int16_t x, y;
+};
+
+	// Lock-free queue for one producer thread and one consumer thread. N must be a power of 2.
+	// A full queue drops new items and counts them
+template <typename T, size_t N>
+class SpscRing
+{
+	static_assert((N & (N - 1)) == 0, "SpscRing size must be a power of 2");
+
+private:
+	alignas(64) std::atomic<size_t> nWrite;				// Written by the producer only
+	alignas(64) std::atomic<size_t> nRead;				// Written by the consumer only
+	alignas(64) std::atomic<uint64_t> nDropped;
+	T items[N];
+
+public:
+	SpscRing() : nWrite(0), nRead(0), nDropped(0) {}
+
+	bool Push(const T& item)
+	{
+		size_t w = nWrite.load(std::memory_order_relaxed);
+		if (w - nRead.load(std::memory_order_acquire) == N)
+		{
+			nDropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		items[w & (N - 1)] = item;
+		nWrite.store(w + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool Pop(T& item)
+	{
+		size_t r = nRead.load(std::memory_order_relaxed);
+		if (r == nWrite.load(std::memory_order_acquire))
+			return false;
+		item = items[r & (N - 1)];
+		nRead.store(r + 1, std::memory_order_release);
+		return true;
+	}
+
+	uint64_t GetDropped() const { return nDropped.load(std::memory_order_relaxed); }
+};
+
+typedef SpscRing<sInputEvent, 1024> InputQueue;
+
+//###################//
+	// Input sources
+//###################//
+
+	// Where events come from. Threaded sources are polled by InputThread in a loop
+	// and wait for input inside Poll (a few ms at most); others are polled once at
+	// the start of every frame on the render thread
+class InputSource
+{
+public:
+	virtual ~InputSource() {}
+
+	virtual bool IsThreaded() const { return true; }
+	virtual void Poll(InputQueue& queue) = 0;			// Pushes events since the last call
+};
+
+#ifdef _WIN32
+	// Keyboard by GetAsyncKeyState, mouse and focus from the console input
+class ConsoleInputSource : public InputSource
+{
+private:
+	HANDLE hConsoleIn;
+	bool bKeyDown[256];
+	bool bMouseDown[5];
+
+public:
+	ConsoleInputSource(HANDLE hConsoleIn);
+
+	virtual void Poll(InputQueue& queue) override;
+};
+#endif
+
+	// Events given in advance for every frame, so a run can be repeated exactly
+class ScriptedInputSource : public InputSource
+{
+private:
+	struct sScriptEvent
+	{
+		int32_t frame;
+		sInputEvent event;
+	};
+
+	std::vector<sScriptEvent> vecEvents;				// Sorted by frame
+	size_t nNext;
+	int32_t nFrame;										// Frame of the next Poll
+
+public:
+	ScriptedInputSource();
+
+	virtual bool IsThreaded() const override { return false; }
+	virtual void Poll(InputQueue& queue) override;
+
+	void Add(int32_t frame, const sInputEvent& event);
+
+		// Text file, one event per line:
+		// <frame> key <letter or code> down|up, <frame> mouse <button> down|up,
+		// <frame> move <x> <y>, <frame> focus 0|1. # starts a comment
+	int16_t Load(const char* path);
+};
+
+	// Runs a threaded source on its own thread, so input is taken while a frame is drawn
+class InputThread
+{
+private:
+	std::unique_ptr<InputSource> pSource;
+	InputQueue* pQueue;
+	std::thread thread;
+	std::atomic<bool> bRunning;
+
+public:
+	InputThread();
+	~InputThread();
+
+	InputThread(const InputThread&) = delete;
+	InputThread& operator=(const InputThread&) = delete;
+
+	void Start(InputSource* source, InputQueue& queue);	// Takes the source, stops the previous one
+	void Stop();
+	void Update();										// Polls a source which has no thread
+};
+
+#endif // !_INPUT_H_
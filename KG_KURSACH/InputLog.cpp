@@ -0,0 +1,157 @@
+#include "InputLog.h"
+
+#include <cstdio>
+#include <cstring>
+
+	// File header
+struct sInputLogHeader
+{
+	char magic[4];										// "KGIL"
+	uint32_t version;
+	uint32_t nFrames;
+	uint32_t nEvents;
+};
+
+	// Event as it is stored: fixed size, no padding of the compiler
+struct sStoredEvent
+{
+	uint8_t type;
+	uint8_t code;
+	uint8_t bDown;
+	uint8_t reserved;
+	int16_t x, y;
+};
+
+static_assert(sizeof(sStoredEvent) == 8, "Stored input event must be 8 bytes");
+
+static const uint32_t nInputLogVersion = 1;
+
+void InputLog::Clear()
+{
+	vecFrameTime.clear();
+	vecEventCount.clear();
+	vecEvents.clear();
+}
+
+void InputLog::BeginFrame(float fElapsedTime)
+{
+	vecFrameTime.push_back(fElapsedTime);
+	vecEventCount.push_back(0);
+}
+
+void InputLog::AddEvent(const sInputEvent& event)
+{
+	// Events before the first frame go to it
+	if (vecEventCount.empty())
+		BeginFrame(0.0f);
+
+	// More events in one frame than a count can hold aren't recorded
+	if (vecEventCount.back() == UINT16_MAX)
+		return;
+
+	vecEventCount.back()++;
+	vecEvents.push_back(event);
+}
+
+int16_t InputLog::Save(const char* path) const
+{
+	FILE* file = std::fopen(path, "wb");
+	if (!file)
+	{
+		wprintf(L"ERROR: can't create %hs\n", path);
+		return 1;
+	}
+
+	sInputLogHeader header = { { 'K', 'G', 'I', 'L' }, nInputLogVersion,
+		static_cast<uint32_t>(vecFrameTime.size()), static_cast<uint32_t>(vecEvents.size()) };
+
+	std::vector<sStoredEvent> stored(vecEvents.size());
+	for (size_t i = 0; i < vecEvents.size(); i++)
+	{
+		const sInputEvent& e = vecEvents[i];
+		stored[i] = { e.type, e.code, static_cast<uint8_t>(e.bDown), 0, e.x, e.y };
+	}
+
+	bool bOk = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+		std::fwrite(vecFrameTime.data(), sizeof(float), vecFrameTime.size(), file) == vecFrameTime.size() &&
+		std::fwrite(vecEventCount.data(), sizeof(uint16_t), vecEventCount.size(), file) == vecEventCount.size() &&
+		std::fwrite(stored.data(), sizeof(sStoredEvent), stored.size(), file) == stored.size();
+
+	if (std::fclose(file) || !bOk)
+	{
+		wprintf(L"ERROR: can't write %hs\n", path);
+		return 1;
+	}
+
+	return 0;
+}
+
+int16_t InputLog::Load(const char* path)
+{
+	Clear();
+
+	FILE* file = std::fopen(path, "rb");
+	if (!file)
+	{
+		wprintf(L"ERROR: can't open %hs\n", path);
+		return 1;
+	}
+
+	// The counts of the header are trusted only if the file is as long as they say
+	long nFileSize = (!std::fseek(file, 0, SEEK_END)) ? std::ftell(file) : -1;
+	std::rewind(file);
+
+	sInputLogHeader header;
+	bool bOk = std::fread(&header, sizeof(header), 1, file) == 1 &&
+		!std::memcmp(header.magic, "KGIL", 4) && header.version == nInputLogVersion;
+	bOk = bOk && nFileSize >= 0 && static_cast<uint64_t>(nFileSize) == sizeof(header)
+		+ static_cast<uint64_t>(header.nFrames) * (sizeof(float) + sizeof(uint16_t)) + static_cast<uint64_t>(header.nEvents) * sizeof(sStoredEvent);
+
+	std::vector<sStoredEvent> stored;
+	if (bOk)
+	{
+		vecFrameTime.resize(header.nFrames);
+		vecEventCount.resize(header.nFrames);
+		stored.resize(header.nEvents);
+
+		bOk = std::fread(vecFrameTime.data(), sizeof(float), header.nFrames, file) == header.nFrames &&
+			std::fread(vecEventCount.data(), sizeof(uint16_t), header.nFrames, file) == header.nFrames &&
+			std::fread(stored.data(), sizeof(sStoredEvent), header.nEvents, file) == header.nEvents;
+	}
+	std::fclose(file);
+
+	// Counts must add up to the events
+	uint64_t nCounted = 0;
+	for (uint16_t count : vecEventCount)
+		nCounted += count;
+
+	if (!bOk || nCounted != stored.size())
+	{
+		Clear();
+		wprintf(L"ERROR: %hs isn't an input log\n", path);
+		return 1;
+	}
+
+	vecEvents.resize(stored.size());
+	for (size_t i = 0; i < stored.size(); i++)
+		vecEvents[i] = { stored[i].type, stored[i].code, stored[i].bDown != 0, stored[i].x, stored[i].y };
+
+	return 0;
+}
+
+ReplayInputSource::ReplayInputSource(const InputLog& log) : log(log)
+{
+	nFrame = 0;
+	nNextEvent = 0;
+}
+
+void ReplayInputSource::Poll(InputQueue& queue)
+{
+	if (nFrame >= log.GetFrameCount())
+		return;
+
+	const sInputEvent* events = log.GetEvents();
+	for (uint16_t i = 0; i < log.GetEventCount(nFrame); i++)
+		queue.Push(events[nNextEvent++]);
+	nFrame++;
+}
@@ -0,0 +1,53 @@
+#ifndef _INPUT_LOG_H_
+#define _INPUT_LOG_H_
+
+#include "Input.h"
+
+#include <cstdint>
+#include <vector>
+
+//###################//
+	// Input log
+//###################//
+
+	// Input events and elapsed time of every frame. Saved as a binary file:
+	// header, frame times (float), event counts (uint16_t), then events 8 bytes each
+class InputLog
+{
+private:
+	std::vector<float> vecFrameTime;
+	std::vector<uint16_t> vecEventCount;				// Events of every frame
+	std::vector<sInputEvent> vecEvents;
+
+public:
+	void Clear();
+
+		// Recording: a frame, then its events
+	void BeginFrame(float fElapsedTime);
+	void AddEvent(const sInputEvent& event);
+
+	int32_t GetFrameCount() const { return static_cast<int32_t>(vecFrameTime.size()); }
+	float GetFrameTime(int32_t frame) const { return vecFrameTime[frame]; }
+	uint16_t GetEventCount(int32_t frame) const { return vecEventCount[frame]; }
+	const sInputEvent* GetEvents() const { return vecEvents.data(); }
+
+	int16_t Save(const char* path) const;
+	int16_t Load(const char* path);
+};
+
+	// Gives the events of the log frame by frame, on the render thread
+class ReplayInputSource : public InputSource
+{
+private:
+	const InputLog& log;
+	int32_t nFrame;
+	size_t nNextEvent;
+
+public:
+	ReplayInputSource(const InputLog& log);
+
+	virtual bool IsThreaded() const override { return false; }
+	virtual void Poll(InputQueue& queue) override;
+};
+
+#endif // !_INPUT_LOG_H_
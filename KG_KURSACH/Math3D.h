@@ -0,0 +1,289 @@
+#ifndef _MATH_3D_H_
+#define _MATH_3D_H_
+
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MATH3D_SSE
+#include <xmmintrin.h>
+#endif
+
+//###################//
+	// 3D math
+//###################//
+
+	// Header only, so everything can be inlined and folded. Row vectors, like
+	// the rest of the renderer: v' = v * M, translation is in the last row.
+	// Everything which doesn't need sin/cos/sqrt is constexpr
+namespace math3d
+{
+	constexpr float fPi = 3.14159f;
+
+	struct vec3
+	{
+		float x, y, z;
+
+		constexpr vec3 operator+(const vec3& v) const { return { x + v.x, y + v.y, z + v.z }; }
+		constexpr vec3 operator-(const vec3& v) const { return { x - v.x, y - v.y, z - v.z }; }
+		constexpr vec3 operator*(float f) const { return { x * f, y * f, z * f }; }
+		constexpr vec3 operator/(float f) const { return { x / f, y / f, z / f }; }
+		constexpr vec3 operator-() const { return { -x, -y, -z }; }
+	};
+
+	struct vec4
+	{
+		float x, y, z, w;
+	};
+
+	struct mat4
+	{
+		float m[4][4] = {};
+
+		mat4 operator*(const mat4& b) const;
+	};
+
+	constexpr float Dot(const vec3& a, const vec3& b)
+	{
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+
+	constexpr vec3 Cross(const vec3& a, const vec3& b)
+	{
+		return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+	}
+
+	inline float Length(const vec3& v)
+	{
+		return std::sqrt(Dot(v, v));
+	}
+
+	inline vec3 Normalise(const vec3& v)
+	{
+		return v / Length(v);
+	}
+
+		// Sine and cosine of one angle together (one call where the library has sincosf)
+	inline void SinCos(float a, float& s, float& c)
+	{
+#if defined(__GNUC__) && !defined(__APPLE__)
+		__builtin_sincosf(a, &s, &c);
+#else
+		s = std::sin(a);
+		c = std::cos(a);
+#endif
+	}
+
+//---Matrices---//
+
+	constexpr mat4 MakeIdentity()
+	{
+		mat4 r;
+		r.m[0][0] = r.m[1][1] = r.m[2][2] = r.m[3][3] = 1.0f;
+		return r;
+	}
+
+	constexpr mat4 MakeScale(float x, float y, float z)
+	{
+		mat4 r;
+		r.m[0][0] = x;
+		r.m[1][1] = y;
+		r.m[2][2] = z;
+		r.m[3][3] = 1.0f;
+		return r;
+	}
+
+	constexpr mat4 MakeTranslation(float x, float y, float z)
+	{
+		mat4 r = MakeIdentity();
+		r.m[3][0] = x;
+		r.m[3][1] = y;
+		r.m[3][2] = z;
+		return r;
+	}
+
+		// Planar shadow: points go along the direction of a directional light
+		// onto the plane dot(plane.xyz, p) + plane.w = 0
+	constexpr mat4 MakeShadowProjection(const vec4& plane, const vec3& light)
+	{
+		float k = plane.x * light.x + plane.y * light.y + plane.z * light.z;
+		float n[4] = { plane.x, plane.y, plane.z, plane.w };
+		float l[3] = { light.x / k, light.y / k, light.z / k };
+
+		mat4 r;
+		for (int i = 0; i < 4; i++)
+			for (int j = 0; j < 3; j++)
+				r.m[i][j] = ((i == j) ? 1.0f : 0.0f) - n[i] * l[j];
+		r.m[3][3] = 1.0f;
+		return r;
+	}
+
+		// Rotations from a ready sine and cosine
+	constexpr mat4 MakeRotationX(float s, float c)
+	{
+		mat4 r;
+		r.m[0][0] = 1.0f;
+		r.m[1][1] = c;	r.m[1][2] = s;
+		r.m[2][1] = -s;	r.m[2][2] = c;
+		r.m[3][3] = 1.0f;
+		return r;
+	}
+
+	constexpr mat4 MakeRotationY(float s, float c)
+	{
+		mat4 r;
+		r.m[0][0] = c;	r.m[0][2] = s;
+		r.m[1][1] = 1.0f;
+		r.m[2][0] = -s;	r.m[2][2] = c;
+		r.m[3][3] = 1.0f;
+		return r;
+	}
+
+	constexpr mat4 MakeRotationZ(float s, float c)
+	{
+		mat4 r;
+		r.m[0][0] = c;	r.m[0][1] = s;
+		r.m[1][0] = -s;	r.m[1][1] = c;
+		r.m[2][2] = 1.0f;
+		r.m[3][3] = 1.0f;
+		return r;
+	}
+
+	inline mat4 MakeRotationX(float a) { float s, c; SinCos(a, s, c); return MakeRotationX(s, c); }
+	inline mat4 MakeRotationY(float a) { float s, c; SinCos(a, s, c); return MakeRotationY(s, c); }
+	inline mat4 MakeRotationZ(float a) { float s, c; SinCos(a, s, c); return MakeRotationZ(s, c); }
+
+		// RotationY(ay) * RotationX(ax) * RotationZ(az) * Scale(scale) * Translation(t),
+		// written out: one sincos per angle and no matrix products
+	inline mat4 MakeWorldYXZ(float ax, float ay, float az, float scale, const vec3& t)
+	{
+		float sx, cx, sy, cy, sz, cz;
+		SinCos(ax, sx, cx);
+		SinCos(ay, sy, cy);
+		SinCos(az, sz, cz);
+
+		mat4 r;
+		r.m[0][0] = (cy * cz + sy * sx * sz) * scale;
+		r.m[0][1] = (cy * sz - sy * sx * cz) * scale;
+		r.m[0][2] = sy * cx * scale;
+		r.m[1][0] = -cx * sz * scale;
+		r.m[1][1] = cx * cz * scale;
+		r.m[1][2] = sx * scale;
+		r.m[2][0] = (cy * sx * sz - sy * cz) * scale;
+		r.m[2][1] = (-sy * sz - cy * sx * cz) * scale;
+		r.m[2][2] = cy * cx * scale;
+		r.m[3][0] = t.x;
+		r.m[3][1] = t.y;
+		r.m[3][2] = t.z;
+		r.m[3][3] = 1.0f;
+		return r;
+	}
+
+	inline mat4 MakeProjection(float fFovDegrees, float fAspectRatio, float fNear, float fFar)
+	{
+		float fFovRad = 1.0f / std::tan(fFovDegrees * 0.5f / 180.0f * fPi);
+		mat4 r;
+		r.m[0][0] = fAspectRatio * fFovRad;
+		r.m[1][1] = fFovRad;
+		r.m[2][2] = fFar / (fFar - fNear);
+		r.m[3][2] = (-fFar * fNear) / (fFar - fNear);
+		r.m[2][3] = 1.0f;
+		return r;
+	}
+
+		// Inverse of a matrix without projection (last column 0, 0, 0, 1):
+		// the 3x3 part by cofactors, the translation goes back through it
+	inline mat4 InverseAffine(const mat4& a)
+	{
+		const float (*m)[4] = a.m;
+		float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+		float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+		float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+		float fInvDet = 1.0f / (m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02);
+
+		mat4 r;
+		r.m[0][0] = c00 * fInvDet;
+		r.m[1][0] = c01 * fInvDet;
+		r.m[2][0] = c02 * fInvDet;
+		r.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * fInvDet;
+		r.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * fInvDet;
+		r.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * fInvDet;
+		r.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * fInvDet;
+		r.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * fInvDet;
+		r.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * fInvDet;
+		for (int j = 0; j < 3; j++)
+			r.m[3][j] = -(m[3][0] * r.m[0][j] + m[3][1] * r.m[1][j] + m[3][2] * r.m[2][j]);
+		r.m[3][3] = 1.0f;
+		return r;
+	}
+
+		// Same sums in the same order as the SSE versions, so both give equal results
+	constexpr mat4 MultiplyScalar(const mat4& a, const mat4& b)
+	{
+		mat4 r;
+		for (int i = 0; i < 4; i++)
+			for (int j = 0; j < 4; j++)
+				r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+		return r;
+	}
+
+	constexpr vec4 TransformScalar(const mat4& m, const vec4& v)
+	{
+		return {
+			v.x * m.m[0][0] + v.y * m.m[1][0] + v.z * m.m[2][0] + v.w * m.m[3][0],
+			v.x * m.m[0][1] + v.y * m.m[1][1] + v.z * m.m[2][1] + v.w * m.m[3][1],
+			v.x * m.m[0][2] + v.y * m.m[1][2] + v.z * m.m[2][2] + v.w * m.m[3][2],
+			v.x * m.m[0][3] + v.y * m.m[1][3] + v.z * m.m[2][3] + v.w * m.m[3][3] };
+	}
+
+#ifdef MATH3D_SSE
+		// Row of the result is a sum of rows of b, scaled by the elements of the row of a
+	inline mat4 Multiply(const mat4& a, const mat4& b)
+	{
+		__m128 b0 = _mm_loadu_ps(b.m[0]);
+		__m128 b1 = _mm_loadu_ps(b.m[1]);
+		__m128 b2 = _mm_loadu_ps(b.m[2]);
+		__m128 b3 = _mm_loadu_ps(b.m[3]);
+
+		mat4 r;
+		for (int i = 0; i < 4; i++)
+		{
+			__m128 row = _mm_mul_ps(_mm_set1_ps(a.m[i][0]), b0);
+			row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.m[i][1]), b1));
+			row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.m[i][2]), b2));
+			row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.m[i][3]), b3));
+			_mm_storeu_ps(r.m[i], row);
+		}
+		return r;
+	}
+
+	inline vec4 Transform(const mat4& m, const vec4& v)
+	{
+		__m128 r = _mm_mul_ps(_mm_set1_ps(v.x), _mm_loadu_ps(m.m[0]));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(v.y), _mm_loadu_ps(m.m[1])));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(v.z), _mm_loadu_ps(m.m[2])));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(v.w), _mm_loadu_ps(m.m[3])));
+
+		vec4 out;
+		_mm_storeu_ps(&out.x, r);
+		return out;
+	}
+#else
+	inline mat4 Multiply(const mat4& a, const mat4& b) { return MultiplyScalar(a, b); }
+	inline vec4 Transform(const mat4& m, const vec4& v) { return TransformScalar(m, v); }
+#endif
+
+	inline mat4 mat4::operator*(const mat4& b) const
+	{
+		return Multiply(*this, b);
+	}
+
+	static_assert(sizeof(vec4) == 4 * sizeof(float), "vec4 is stored by one SSE store");
+	static_assert(Dot(Cross(vec3{ 1.0f, 0.0f, 0.0f }, vec3{ 0.0f, 1.0f, 0.0f }), vec3{ 0.0f, 0.0f, 1.0f }) == 1.0f,
+		"Cross must be right-handed");
+	static_assert(TransformScalar(MakeTranslation(1.0f, 2.0f, 3.0f), vec4{ 1.0f, 1.0f, 1.0f, 1.0f }).z == 4.0f,
+		"Translation is in the last row");
+	static_assert(TransformScalar(MakeShadowProjection(vec4{ 0.0f, 1.0f, 0.0f, 1.0f }, vec3{ 1.0f, -1.0f, 0.0f }),
+		vec4{ 0.0f, 1.0f, 0.0f, 1.0f }).x == 2.0f, "Shadow goes along the light down to the plane");
+}
+
+#endif // !_MATH_3D_H_
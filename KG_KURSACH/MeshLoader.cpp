@@ -0,0 +1,397 @@
+#include "MeshLoader.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static int16_t LoaderError(const wchar_t* msg, const char* path)
+{
+	wprintf(L"ERROR: %ls: %hs\n", msg, path);
+	return 1;
+}
+
+//---OBJ---//
+
+static bool IsSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static void SkipSpaces(const char*& p, const char* end)
+{
+	while (p < end && IsSpace(*p))
+		p++;
+}
+
+static bool ParseFloat(const char*& p, const char* end, float& value)
+{
+	SkipSpaces(p, end);
+
+	bool bNegative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		bNegative = (*p++ == '-');
+
+	double result = 0.0;
+	bool bDigits = false;
+
+	while (p < end && *p >= '0' && *p <= '9')
+	{
+		result = result * 10.0 + (*p++ - '0');
+		bDigits = true;
+	}
+
+	if (p < end && *p == '.')
+	{
+		p++;
+		double scale = 0.1;
+		while (p < end && *p >= '0' && *p <= '9')
+		{
+			result += (*p++ - '0') * scale;
+			scale *= 0.1;
+			bDigits = true;
+		}
+	}
+
+	if (bDigits && p < end && (*p == 'e' || *p == 'E'))
+	{
+		p++;
+		bool bNegExp = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			bNegExp = (*p++ == '-');
+
+		int exponent = 0;
+		while (p < end && *p >= '0' && *p <= '9')
+			exponent = exponent * 10 + (*p++ - '0');
+
+		result *= std::pow(10.0, bNegExp ? -exponent : exponent);
+	}
+
+	value = static_cast<float>(bNegative ? -result : result);
+	return bDigits;
+}
+
+static bool ParseInt(const char*& p, const char* end, int64_t& value)
+{
+	bool bNegative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		bNegative = (*p++ == '-');
+
+	bool bDigits = false;
+	value = 0;
+	while (p < end && *p >= '0' && *p <= '9')
+	{
+		value = value * 10 + (*p++ - '0');
+		bDigits = true;
+	}
+
+	if (bNegative)
+		value = -value;
+	return bDigits;
+}
+
+int16_t LoadObj(const char* path, indexedMesh& out, int16_t sym, int16_t col)
+{
+	FILE* file = std::fopen(path, "rb");
+	if (!file)
+		return LoaderError(L"Can't open OBJ file", path);
+
+	out = indexedMesh();
+
+	std::vector<uint32_t> indices;
+	std::vector<uint32_t> polygon;						// Vertices of the current face
+	std::vector<char> buffer(1 << 20);
+	size_t nFilled = 0;
+	bool bEof = false;
+	int16_t result = 0;
+
+	while (!result && (!bEof || nFilled))
+	{
+		if (!bEof)
+		{
+			size_t nRead = std::fread(buffer.data() + nFilled, 1, buffer.size() - nFilled, file);
+			nFilled += nRead;
+			bEof = nRead == 0 || std::feof(file);
+		}
+
+		// Parse only whole lines, the tail goes to the next block
+		const char* begin = buffer.data();
+		const char* end = begin + nFilled;
+		const char* last_line = end;
+
+		if (!bEof)
+		{
+			while (last_line > begin && last_line[-1] != '\n')
+				last_line--;
+			if (last_line == begin)
+			{
+				result = LoaderError(L"Too long line in OBJ file", path);
+				break;
+			}
+		}
+
+		const char* p = begin;
+		while (!result && p < last_line)
+		{
+			const char* eol = static_cast<const char*>(std::memchr(p, '\n', last_line - p));
+			if (!eol)
+				eol = last_line;
+
+			SkipSpaces(p, eol);
+
+			if (eol - p > 1 && p[0] == 'v' && IsSpace(p[1]))
+			{
+				p += 2;
+				float x = 0.0f, y = 0.0f, z = 0.0f;
+				if (!ParseFloat(p, eol, x) || !ParseFloat(p, eol, y) || !ParseFloat(p, eol, z))
+				{
+					result = LoaderError(L"Bad vertex in OBJ file", path);
+					break;
+				}
+
+				out.vertices.x.push_back(x);
+				out.vertices.y.push_back(y);
+				out.vertices.z.push_back(z);
+			}
+			else if (eol - p > 1 && p[0] == 'f' && IsSpace(p[1]))
+			{
+				p += 2;
+				polygon.clear();
+
+				int64_t nVertices = static_cast<int64_t>(out.vertices.Size());
+				int64_t index;
+
+				SkipSpaces(p, eol);
+				while (p < eol && ParseInt(p, eol, index))
+				{
+					// Negative indices count from the last vertex, texture/normal indices are skipped
+					index = (index < 0) ? nVertices + index : index - 1;
+					if (index < 0 || index >= nVertices)
+					{
+						result = LoaderError(L"Bad face index in OBJ file", path);
+						break;
+					}
+					polygon.push_back(static_cast<uint32_t>(index));
+
+					while (p < eol && !IsSpace(*p))
+						p++;
+					SkipSpaces(p, eol);
+				}
+
+				for (size_t i = 2; !result && i < polygon.size(); i++)
+				{
+					indices.push_back(polygon[0]);
+					indices.push_back(polygon[i - 1]);
+					indices.push_back(polygon[i]);
+					out.faces.push_back({ sym, col });
+				}
+			}
+
+			p = eol + 1;
+		}
+
+		nFilled = end - last_line;
+		std::memmove(buffer.data(), last_line, nFilled);
+		if (bEof && nFilled)
+			nFilled = 0;									// Last line was parsed as a whole
+	}
+
+	std::fclose(file);
+
+	if (result)
+		return result;
+
+	if (out.vertices.Size() <= 0xFFFF)
+		out.indices16.assign(indices.begin(), indices.end());
+	else
+		out.indices32 = std::move(indices);
+
+	return 0;
+}
+
+//---Binary---//
+
+static size_t Align4(size_t size)
+{
+	return (size + 3) & ~static_cast<size_t>(3);
+}
+
+int16_t SaveBinaryMesh(const char* path, const sMeshView& mesh)
+{
+	FILE* file = std::fopen(path, "wb");
+	if (!file)
+		return LoaderError(L"Can't create mesh file", path);
+
+	sBinaryMeshHeader header;
+	std::memcpy(header.magic, "KGM1", 4);
+	header.nVertices = mesh.nVertices;
+	header.nFaces = mesh.nFaces;
+	header.nIndexSize = mesh.indices16 ? 2 : 4;
+
+	size_t nIndexBytes = static_cast<size_t>(mesh.nFaces) * 3 * header.nIndexSize;
+	const uint32_t zero = 0;
+
+	bool bOk = std::fwrite(&header, sizeof(header), 1, file) == 1;
+	bOk = bOk && std::fwrite(mesh.x, sizeof(float), mesh.nVertices, file) == mesh.nVertices;
+	bOk = bOk && std::fwrite(mesh.y, sizeof(float), mesh.nVertices, file) == mesh.nVertices;
+	bOk = bOk && std::fwrite(mesh.z, sizeof(float), mesh.nVertices, file) == mesh.nVertices;
+	if (nIndexBytes)
+	{
+		const void* indices = mesh.indices16 ? static_cast<const void*>(mesh.indices16) : static_cast<const void*>(mesh.indices32);
+		bOk = bOk && std::fwrite(indices, 1, nIndexBytes, file) == nIndexBytes;
+		bOk = bOk && std::fwrite(&zero, 1, Align4(nIndexBytes) - nIndexBytes, file) == Align4(nIndexBytes) - nIndexBytes;
+	}
+	bOk = bOk && std::fwrite(mesh.faces, sizeof(sFaceAttr), mesh.nFaces, file) == mesh.nFaces;
+
+	std::fclose(file);
+
+	return bOk ? 0 : LoaderError(L"Can't write mesh file", path);
+}
+
+MappedMesh::MappedMesh()
+{
+	pData = nullptr;
+	nSize = 0;
+#ifdef _WIN32
+	hFile = INVALID_HANDLE_VALUE;
+	hMapping = nullptr;
+#endif
+	std::memset(&view, 0, sizeof(view));
+}
+
+MappedMesh::~MappedMesh()
+{
+	Close();
+}
+
+int16_t MappedMesh::Open(const char* path)
+{
+	Close();
+
+#ifdef _WIN32
+	hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return LoaderError(L"Can't open mesh file", path);
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(hFile, &size) || size.QuadPart < static_cast<long long>(sizeof(sBinaryMeshHeader)))
+	{
+		Close();
+		return LoaderError(L"Bad mesh file", path);
+	}
+	nSize = static_cast<size_t>(size.QuadPart);
+
+	hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	pData = hMapping ? MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return LoaderError(L"Can't open mesh file", path);
+
+	struct stat st;
+	if (fstat(fd, &st) || static_cast<size_t>(st.st_size) < sizeof(sBinaryMeshHeader))
+	{
+		close(fd);
+		return LoaderError(L"Bad mesh file", path);
+	}
+	nSize = static_cast<size_t>(st.st_size);
+
+	pData = mmap(nullptr, nSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);											// The mapping keeps the file
+	if (pData == MAP_FAILED)
+		pData = nullptr;
+#endif
+
+	if (!pData)
+	{
+		Close();
+		return LoaderError(L"Can't map mesh file", path);
+	}
+
+	// Check the header and that every part is inside the file
+	const sBinaryMeshHeader* header = static_cast<const sBinaryMeshHeader*>(pData);
+	size_t nIndexBytes = static_cast<size_t>(header->nFaces) * 3 * header->nIndexSize;
+	size_t nExpected = sizeof(sBinaryMeshHeader) + static_cast<size_t>(header->nVertices) * 3 * sizeof(float)
+		+ Align4(nIndexBytes) + static_cast<size_t>(header->nFaces) * sizeof(sFaceAttr);
+
+	if (std::memcmp(header->magic, "KGM1", 4) || (header->nIndexSize != 2 && header->nIndexSize != 4) || nExpected > nSize)
+	{
+		Close();
+		return LoaderError(L"Bad mesh file", path);
+	}
+
+	const char* p = static_cast<const char*>(pData) + sizeof(sBinaryMeshHeader);
+
+	view.nVertices = header->nVertices;
+	view.nFaces = header->nFaces;
+	view.x = reinterpret_cast<const float*>(p);
+	view.y = view.x + view.nVertices;
+	view.z = view.y + view.nVertices;
+	p += static_cast<size_t>(view.nVertices) * 3 * sizeof(float);
+
+	view.indices16 = (header->nIndexSize == 2) ? reinterpret_cast<const uint16_t*>(p) : nullptr;
+	view.indices32 = (header->nIndexSize == 4) ? reinterpret_cast<const uint32_t*>(p) : nullptr;
+	p += Align4(nIndexBytes);
+
+	view.faces = reinterpret_cast<const sFaceAttr*>(p);
+
+	// Indices are read as they are by the render path: all of them must be vertices
+	for (size_t i = 0; i < 3 * static_cast<size_t>(view.nFaces); i++)
+		if (view.Index(i) >= view.nVertices)
+		{
+			Close();
+			return LoaderError(L"Bad mesh file", path);
+		}
+
+	return 0;
+}
+
+void MappedMesh::Close()
+{
+#ifdef _WIN32
+	if (pData)
+		UnmapViewOfFile(pData);
+	if (hMapping)
+		CloseHandle(hMapping);
+	if (hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(hFile);
+	hFile = INVALID_HANDLE_VALUE;
+	hMapping = nullptr;
+#else
+	if (pData)
+		munmap(pData, nSize);
+#endif
+
+	pData = nullptr;
+	nSize = 0;
+	std::memset(&view, 0, sizeof(view));
+	vecPlanes.clear();
+	vecEdges.clear();
+	vecSides.clear();
+}
+
+void MappedMesh::BuildPlanes()
+{
+	BuildFacePlanes(view, vecPlanes);
+	view.planes = vecPlanes.empty() ? nullptr : vecPlanes.data();
+}
+
+void MappedMesh::BuildEdges()
+{
+	BuildMeshEdges(view, vecEdges, vecSides);
+	view.edges = vecEdges.empty() ? nullptr : vecEdges.data();
+	view.sides = vecSides.empty() ? nullptr : vecSides.data();
+	view.nEdges = static_cast<uint32_t>(vecEdges.size());
+}
@@ -0,0 +1,59 @@
+#ifndef _MESH_LOADER_H_
+#define _MESH_LOADER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "IndexedMesh.h"
+
+//###################//
+	// Mesh files
+//###################//
+
+	// Wavefront OBJ: only "v" and "f" are used, polygons are split into fans.
+	// The file is parsed in blocks straight from the read buffer (no strings per line).
+	// Returns 0 when loaded
+int16_t LoadObj(const char* path, indexedMesh& out, int16_t sym, int16_t col);
+
+	// Binary mesh (.kgm): header, then x[], y[], z[], indices, faces.
+	// Every part is 4-byte aligned, so a mapped file can be drawn as is
+struct sBinaryMeshHeader
+{
+	char magic[4];										// "KGM1"
+	uint32_t nVertices;
+	uint32_t nFaces;
+	uint32_t nIndexSize;								// 2 or 4 bytes
+};
+
+int16_t SaveBinaryMesh(const char* path, const sMeshView& mesh);
+
+	// Read-only memory mapping of a .kgm file
+class MappedMesh
+{
+private:
+	void* pData;
+	size_t nSize;
+#ifdef _WIN32
+	void* hFile;
+	void* hMapping;
+#endif
+	sMeshView view;
+	std::vector<sFacePlane> vecPlanes;					// Not in the file: built after mapping
+	std::vector<sMeshEdge> vecEdges;					// The same
+	std::vector<uint32_t> vecSides;
+
+public:
+	MappedMesh();
+	~MappedMesh();
+	MappedMesh(const MappedMesh&) = delete;
+	MappedMesh& operator=(const MappedMesh&) = delete;
+
+	int16_t Open(const char* path);					// Returns 0 when mapped
+	void Close();
+	void BuildPlanes();
+	void BuildEdges();									// After BuildPlanes
+
+	const sMeshView& View() const { return view; }
+};
+
+#endif // !_MESH_LOADER_H_
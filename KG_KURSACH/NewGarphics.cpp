@@ -1,10 +1,24 @@
 #include "NewGarphics.h"
 
+#include "Silhouette.h"
+
+	// Colours of the faces in turn: every face of every mesh has its own one (while they last),
+	// instances of a mesh look the same. Grey is for the edges
+static int16_t GetFaceColour(uint32_t nFace)
+{
+	static const int16_t colours[] =
+	{
+		FG_DARK_CYAN, FG_DARK_RED, FG_DARK_MAGENTA, FG_DARK_YELLOW, FG_DARK_GREY, FG_BLUE, FG_GREEN,
+		FG_CYAN, FG_RED, FG_MAGENTA, FG_YELLOW, FG_WHITE, FG_DARK_BLUE, FG_DARK_GREEN
+	};
+	return colours[nFace % (sizeof(colours) / sizeof(colours[0]))];
+}
+
 void NewGarphics::OnUserCreate()
 {
-	shapes.resize(2);
+	std::vector<mesh> figures(2);
 
-	shapes[0].tris =
+	figures[0].tris =
 	{
 		// 
 		{ 0.0f, 0.0f, 0.0f,    2.0f, 0.0f, 0.0f,    1.0f, 0.0f, 2.0f },
@@ -20,7 +34,7 @@ void NewGarphics::OnUserCreate()
 
 	};
 
-	shapes[1].tris =
+	figures[1].tris =
 	{
 		// 
 		{ 0.0f, 0.0f, 0.0f,    0.0f, 2.0f, 0.0f,    1.0f, 2.0f, 0.0f },
@@ -56,25 +70,121 @@ void NewGarphics::OnUserCreate()
 			       3-    .
 
 	*/
-	matProj = Matrix_MakeProjection(90.0f, static_cast<float>(GetConsoleHeight()) / static_cast<float>(GetConsoleWidth()), 0.1f, 1000.0f);
+	camera.SetProjection(90.0f, static_cast<float>(GetConsoleHeight()) / static_cast<float>(GetConsoleWidth()), 0.1f, 1000.0f);
 
 	light.x = 1.0f;
 	light.y = -100.0f;
 	light.z = 1.0f;
 	
 	scale = 1.0f;							
-	_x = 0.5f; _y = 0.75f; _z = 4.0f;
+	_x = 1.0f; _y = 0.75f; _z = 4.0f;
 	fThetaX = fThetaY = fThetaZ = 0.0f;
+	bDepthBuffer = false;
+	bTiledRaster = false;
+	bCacheBackground = true;
+	bFrustumCulling = true;
+	bClipping = true;
+	bBackFaceCulling = true;
+	bMeshEdges = true;
+	ground = { 0.0f, 1.0f, 0.0f, 1.0f };	// y = -1: the floor at the depth of the figures
+	shadowMask.Resize(GetConsoleWidth(), GetConsoleHeight());
+	bShadowValid = false;
+	shadowStats = { 0, 0, 0, 0, false };
+	viewPrevious = GetViewState();
+
+	// Shared corners are stored and transformed only once
+	shapes.clear();
+	if (vecModelPaths.empty())
+	{
+		for (auto& figure : figures)
+			shapes.push_back(MakeIndexedMesh(figure));
+	}
+	else
+		LoadModels();
+
+	// Planes of the faces for the back-face test and the edges between
+	// the faces for outlines and silhouettes, once per mesh
+	for (auto& sh : shapes)
+	{
+		sh.BuildPlanes();
+		sh.BuildEdges();
+	}
+	for (auto& mapped : vecMappedShapes)
+	{
+		mapped->BuildPlanes();
+		mapped->BuildEdges();
+	}
+
+	transform_kernel = KERNEL_AUTO;
+	BuildMeshViews();
+	BuildScene();
+
+	bMeasureStages = false;
+	std::fill(fStageTime, fStageTime + STAGE_COUNT, 0.0f);
 }
 
 void NewGarphics::OnUserUpdate(float fElapsedTime)
 {
-	// Clear our console
-	Fill(0, 0, GetConsoleWidth(), GetConsoleHeight());
+	HandleToggles();
+
+	if (!IsFixedStep())
+	{
+		HandleMotion(fElapsedTime);
+		RenderFrame();
+		return;
+	}
+
+	// Motion was done by OnUserSimulate: draw between its last two steps
+	sViewState current = GetViewState();
+	float alpha = GetInterpolationAlpha();
+	auto lerp = [alpha](float a, float b) { return a + (b - a) * alpha; };
+
+	SetViewState({ lerp(viewPrevious.scale, current.scale),
+		lerp(viewPrevious._x, current._x), lerp(viewPrevious._y, current._y), lerp(viewPrevious._z, current._z),
+		lerp(viewPrevious.fThetaX, current.fThetaX), lerp(viewPrevious.fThetaY, current.fThetaY),
+		lerp(viewPrevious.fThetaZ, current.fThetaZ) });
+	RenderFrame();
+	SetViewState(current);
+}
+
+void NewGarphics::OnUserSimulate(float fStep)
+{
+	viewPrevious = GetViewState();
+	HandleMotion(fStep);
+}
+
+NewGarphics::sViewState NewGarphics::GetViewState() const
+{
+	return { scale, _x, _y, _z, fThetaX, fThetaY, fThetaZ };
+}
 
-	// Surface
-	Fill(0, iConsoleHeight / 2, iConsoleWidth, iConsoleHeight, PIXEL_SOLID, FG_PINK);
+void NewGarphics::SetViewState(const sViewState& state)
+{
+	scale = state.scale;
+	_x = state._x; _y = state._y; _z = state._z;
+	fThetaX = state.fThetaX; fThetaY = state.fThetaY; fThetaZ = state.fThetaZ;
+}
+
+void NewGarphics::HandleToggles()
+{
+	// Hidden surfaces: z-buffer or sort + Roberts
+	if (GetKey(L'B').bPressed)
+		bDepthBuffer = !bDepthBuffer;
+	if (GetKey(L'M').bPressed)
+		bTiledRaster = !bTiledRaster;
+	if (GetKey(L'C').bPressed)
+		bFrustumCulling = !bFrustumCulling;
+	if (GetKey(L'V').bPressed)
+		bBackFaceCulling = !bBackFaceCulling;
+	if (GetKey(L'O').bPressed)
+	{
+		bMeshEdges = !bMeshEdges;
+		bShadowValid = false;
+	}
+}
 
+void NewGarphics::HandleMotion(float fElapsedTime)
+{
 	//// Move around axies
 	if (GetKey(L'W').bHeld)
 		fThetaX += 8.0f * fElapsedTime;
@@ -129,86 +239,325 @@ void NewGarphics::OnUserUpdate(float fElapsedTime)
 				_z = (_z > 4.5f) ? _z - 0.1f : _z;
 		}
 	}
+}
 
+void NewGarphics::RenderFrame()
+{
+	// Time of every stage is added to fStageTime when bMeasureStages is set
+	// and goes to the profiler with KG_PROFILE
+	auto tpStage = std::chrono::steady_clock::now();
+	auto stage_done = [this, &tpStage](FRAME_STAGE stage)
+	{
+#ifndef KG_PROFILE
+		if (!bMeasureStages)
+			return;
+#endif
+
+		auto tp = std::chrono::steady_clock::now();
+		if (bMeasureStages)
+			fStageTime[stage] += std::chrono::duration<float>(tp - tpStage).count();
+#ifdef KG_PROFILE
+		Profiler::Get().AddScope(GetStageName(stage), tpStage, tp);
+#endif
+		tpStage = tp;
+	};
 
-	mat4x4 matRotX, matRotY, matRotZ;
-	matRotX = Matrix_MakeRotationX(fThetaX * 0.5f);
-	matRotY = Matrix_MakeRotationY(fThetaY * 0.5f);
-	matRotZ = Matrix_MakeRotationZ(fThetaZ * 0.5f);
+	// Background is the same every frame: put back only what the last frame covered
+	if (!bCacheBackground || !RestoreBackground())
+	{
+		// Clear our console
+		Clear();
 
-	mat4x4 ScalingMatrix;
-	ScalingMatrix = Matrix_MakeScale(scale, scale, scale);
+		// Surface
+		Fill(0, iConsoleHeight / 2, iConsoleWidth, iConsoleHeight, PIXEL_SOLID, FG_PINK);
 
-	mat4x4 TranslationMatrix;
-	TranslationMatrix = Matrix_MakeTranslation(0.0f, 0.0f, _z);
+		if (bCacheBackground)
+			CacheBackground();
+	}
 
-	mat4x4 WorldMatrix;
-	WorldMatrix = Matrix_MakeIdentity();
-	WorldMatrix = matRotY * matRotX * matRotZ * ScalingMatrix * TranslationMatrix;
+	if (bDepthBuffer)
+		ClearDepth();
 
-	std::vector<triangle> vecTrianglesToRaster;
+	stage_done(STAGE_CLEAR);
 
-	float  t = 0.0f;					// move X coor for another figure
-	int16_t tri_color = FG_DARK_GREEN;
-	int16_t count_tris = 0;
-	for (auto& sh: shapes) 
+	// Matrices are built again only if the controls changed something.
+	// World, view and projection together: every vertex is multiplied only once
+	camera.SetWorld(fThetaX * 0.5f, fThetaY * 0.5f, fThetaZ * 0.5f, scale, { 0.0f, 0.0f, _z });
+	float fWidth = static_cast<float>(GetConsoleWidth()), fHeight = static_cast<float>(GetConsoleHeight());
+	camera.SetViewport({ _x, _y, 0.5f * fWidth, 0.5f * fHeight }, fWidth, fHeight);
+	const mat4x4& WorldViewProjMatrix = camera.GetWorldViewProj();
+
+	stage_done(STAGE_MATRICES);
+
+	// Whole groups out of the view are dropped before any vertex is transformed
+	scene.Update();
+	size_t nInstances = scene.Cull(bFrustumCulling ? &camera.GetFrustum() : nullptr);
+
+	// Instances are painted from the farthest one, z-buffer takes them as they are
+	struct sInstance
 	{
-		// Take all triangles
-		for (auto tri : sh.tris)
+		float depth;
+		int32_t node;
+		uint32_t nFirstVertex;			// In projected
+		uint32_t nFirstFace;			// In vecFrontFaces
+		uint32_t nMaxTris;				// Clipping can cut a face into several triangles
+	};
+	sInstance* instances = frameArena.Allocate<sInstance>(nInstances);
+	size_t nAllVertices = 0, nAllFaces = 0;
+	for (size_t n = 0; n < nInstances; n++)
+	{
+		const SceneGraph::sNode& node = scene.GetNode(scene.GetVisible()[n]);
+		math3d::vec3 center = node.sphere.center;
+		instances[n] = { math3d::Transform(WorldViewProjMatrix, { center.x, center.y, center.z, 1.0f }).w, scene.GetVisible()[n], 0, 0, 0 };
+		nAllVertices += vecShapeViews[node.nMesh].nVertices;
+		nAllFaces += vecShapeViews[node.nMesh].nFaces;
+	}
+	if (!bDepthBuffer)
+		std::sort(instances, instances + nInstances, [](const sInstance& i1, const sInstance& i2)
+			{
+				return (i1.depth != i2.depth) ? i1.depth > i2.depth : i1.node < i2.node;
+			});
+
+	stage_done(STAGE_CULL);
+
+	// Shadows lie on the ground, under all figures
+	sClipRect screen_rect = { -0.5f, -0.5f, fWidth - 0.5f, fHeight - 0.5f };
+	UpdateShadowMask(screen_rect);
+	DrawShadows();
+	stage_done(STAGE_SHADOW);
+
+	// All vertices are transformed first: only their clip codes tell how many triangles
+	// the faces give, and triangles are allocated once for the frame
+	const sViewport& viewport = camera.GetViewport();
+	sClipRect guard_rect = GetGuardRect();
+	projected.Resize(nAllVertices);
+	vecClipCodes.resize(nAllVertices);
+	vecFrontFaces.resize(nAllFaces);
+	clipStats = { 0, 0, 0, 0, 0 };
+
+	// Camera in the space of the scene, before the world matrix of the figures
+	math3d::vec4 eye = math3d::Transform(math3d::InverseAffine(camera.GetWorld() * camera.GetView()), { 0.0f, 0.0f, 0.0f, 1.0f });
+
+	size_t nMaxTris = 0, nAllTris = 0;
+	uint32_t nFirstVertex = 0, nFirstFace = 0;
+	for (size_t n = 0; n < nInstances; n++)
+	{
+		sInstance& inst = instances[n];
+		const SceneGraph::sNode& node = scene.GetNode(inst.node);
+		const sMeshView& sh = vecShapeViews[node.nMesh];
+		const mat4x4& matrix = scene.GetMatrix(inst.node, WorldViewProjMatrix, camera.GetBuildCount());
+
+		// Faces turned away from the camera are dropped before the projection: the
+		// camera goes into the space of the mesh, then it is one dot product per face.
+		// Open meshes have no planes, RobertsAlgorithm tests their faces
+		inst.nFirstFace = nFirstFace;
+		uint8_t* front = vecFrontFaces.data() + nFirstFace;
+		inst.nMaxTris = sh.nFaces;
+		if (bBackFaceCulling && sh.planes)
+		{
+			math3d::vec4 local_eye = math3d::Transform(math3d::InverseAffine(node.world), eye);
+			for (uint32_t k = 0; k < sh.nFaces; k++)
+			{
+				const sFacePlane& plane = sh.planes[k];
+				front[k] = plane.nx * local_eye.x + plane.ny * local_eye.y + plane.nz * local_eye.z + plane.d > 0.0f;
+				inst.nMaxTris -= !front[k];
+			}
+		}
+		else
+			std::fill(front, front + sh.nFaces, static_cast<uint8_t>(1));
+		nFirstFace += sh.nFaces;
+
+		//   3D -> 2D
+		//   Z  ,   ,   ,  .
+		// X/Y are inverted so put them back and scale to the size of the console
+		inst.nFirstVertex = nFirstVertex;
+		TransformBatch(matrix.m, viewport, sh.x, sh.y, sh.z, sh.nVertices, projected.x.data() + nFirstVertex,
+			projected.y.data() + nFirstVertex, projected.z.data() + nFirstVertex, projected.w.data() + nFirstVertex, transform_kernel);
+		PROFILE_COUNT(COUNTER_TRIS_TRANSFORMED, sh.nFaces);
+
+		// A face gives up to 7 triangles if it crosses the near or far plane
+		// (9 vertices after the guard band too), 5 if only the guard band
+		if (bClipping)
 		{
-			triangle triProjected, triTransformed;
+			const uint8_t* codes = vecClipCodes.data() + nFirstVertex;
+			for (uint32_t v = 0; v < sh.nVertices; v++)
+			{
+				uint32_t i = nFirstVertex + v;
+				vecClipCodes[i] = GetClipCode(projected.x[i], projected.y[i], projected.z[i], projected.w[i], screen_rect, guard_rect);
+			}
 
-			for (int16_t i = 0; i < 3; i++)
+			for (uint32_t k = 0; k < sh.nFaces; k++)
 			{
-				triTransformed.points[i] = MultiplyMatrixVector(WorldMatrix, tri.points[i]);
+				if (!front[k])
+					continue;
+				uint8_t code_or = codes[sh.Index(3 * k)] | codes[sh.Index(3 * k + 1)] | codes[sh.Index(3 * k + 2)];
+				if (code_or & (CLIP_NEAR | CLIP_FAR))
+					inst.nMaxTris += 6;
+				else if ((code_or & CLIP_GUARD) && bDepthBuffer)
+					inst.nMaxTris += 4;
+			}
+		}
 
-				//   3D -> 2D
-				triProjected.points[i] = MultiplyMatrixVector(matProj, triTransformed.points[i]);
+		nMaxTris = std::max<size_t>(nMaxTris, inst.nMaxTris);
+		nAllTris += inst.nMaxTris;
+		nFirstVertex += sh.nVertices;
+	}
+
+	stage_done(STAGE_TRANSFORM);
+
+	// Triangles live in the frame arena: in z-buffer mode all of them, else one figure at a time
+	triangle* tris = frameArena.Allocate<triangle>(bDepthBuffer ? nAllTris : nMaxTris);
+	size_t nTris = 0;
 
-				//   Z  ,   ,   ,  .
-				triProjected.points[i] = triProjected.points[i] / triProjected.points[i].w;
+	// Painter mode: depths, edges of the sides and the sorted copy of one figure
+	float* depths = bDepthBuffer ? nullptr : frameArena.Allocate<float>(nMaxTris);
+	uint32_t* tri_sides = bDepthBuffer ? nullptr : frameArena.Allocate<uint32_t>(3 * nMaxTris);
+	triangle* sorted = bDepthBuffer ? nullptr : frameArena.Allocate<triangle>(nMaxTris);
+	uint32_t* sorted_sides = bDepthBuffer ? nullptr : frameArena.Allocate<uint32_t>(3 * nMaxTris);
+	depthSort.ResetStats();
 
-				// X/Y are inverted so put them back
-				triProjected.points[i].x *= -1.0f;
-				triProjected.points[i].y *= -1.0f;
+	int16_t count_tris = 0;
+	for (size_t n = 0; n < nInstances; n++)
+	{
+		const sInstance& inst = instances[n];
+		int32_t nMesh = scene.GetNode(inst.node).nMesh;
+		const sMeshView& sh = vecShapeViews[nMesh];
+		const float* px = projected.x.data() + inst.nFirstVertex;
+		const float* py = projected.y.data() + inst.nFirstVertex;
+		const float* pz = projected.z.data() + inst.nFirstVertex;
+		const float* pw = projected.w.data() + inst.nFirstVertex;
+		const uint8_t* codes = vecClipCodes.data() + inst.nFirstVertex;
+		const uint8_t* front = vecFrontFaces.data() + inst.nFirstFace;
+		bool bFrontOnly = bBackFaceCulling && sh.planes;
+
+		// Painter mode draws every edge of the mesh once: the sides of the triangles
+		// know their edges. Pieces of cut faces have new sides, drawn every time
+		const uint32_t* mesh_sides = (bMeshEdges && !bDepthBuffer) ? sh.sides : nullptr;
+
+		auto add_triangle = [&](const fPoint3D& p1, const fPoint3D& p2, const fPoint3D& p3, int16_t col, const uint32_t* sides)
+		{
+			triangle tri;
+			tri.points[0] = p1;
+			tri.points[1] = p2;
+			tri.points[2] = p3;
+			tri.col = col;
+			if (tri_sides)
+				for (int16_t i = 0; i < 3; i++)
+					tri_sides[3 * nTris + i] = sides ? sides[i] : UINT32_MAX;
+			tris[nTris++] = tri;
+
+			// Counting barycenter
+			barycenter += p1;
+			barycenter += p2;
+			barycenter += p3;
+			count_tris++;
+			clipStats.nOutput++;
+		};
+
+		// Take all triangles
+		for (uint32_t k = 0; k < sh.nFaces; k++)
+		{
+			uint32_t v[3] = { sh.Index(3 * k), sh.Index(3 * k + 1), sh.Index(3 * k + 2) };
+			int16_t col = GetFaceColour(vecMeshFirstFace[nMesh] + k);
+			clipStats.nTriangles++;
+			if (!front[k])
+			{
+				clipStats.nBackFaces++;
+				continue;
 			}
 
-			// Scaling to the size of the console
-			for (int16_t i = 0; i < 3; i++)
+			uint8_t code_or = 0;
+			if (bClipping)
 			{
-				triProjected.points[i].x += _x + t;
-				triProjected.points[i].y += _y;
+				// Out of the view by one side: nothing to draw
+				if (codes[v[0]] & codes[v[1]] & codes[v[2]])
+				{
+					clipStats.nRejected++;
+					continue;
+				}
+				code_or = codes[v[0]] | codes[v[1]] | codes[v[2]];
+			}
+
+			if (!(code_or & (CLIP_NEAR | CLIP_FAR)) && !((code_or & CLIP_GUARD) && bDepthBuffer))
+			{
+				add_triangle(fPoint3D(px[v[0]], py[v[0]], pz[v[0]], pw[v[0]]), fPoint3D(px[v[1]], py[v[1]], pz[v[1]], pw[v[1]]),
+					fPoint3D(px[v[2]], py[v[2]], pz[v[2]], pw[v[2]]), col, mesh_sides ? mesh_sides + 3 * k : nullptr);
+				continue;
+			}
 
-				triProjected.points[i].x *= 0.5f * static_cast<float>(GetConsoleWidth());
-				triProjected.points[i].y *= 0.5f * static_cast<float>(GetConsoleHeight());
+			// Cut in homogeneous space by the near and far planes, then by the guard band.
+			// Painter mode keeps big triangles whole: cut pieces would show their edges
+			math3d::vec4 polygon[16], temp[16];
+			size_t nPoints = 0;
 
-				// Counting barycenter
-				barycenter += triProjected.points[i];
+			if (code_or & (CLIP_NEAR | CLIP_FAR))
+			{
+				const mat4x4& matrix = scene.GetMatrix(inst.node, WorldViewProjMatrix, camera.GetBuildCount());
+				for (int16_t i = 0; i < 3; i++)
+					temp[i] = math3d::Transform(matrix, { sh.x[v[i]], sh.y[v[i]], sh.z[v[i]], 1.0f });
+
+				nPoints = ClipPolygonDepth(temp, 3, polygon);
+				for (size_t i = 0; i < nPoints; i++)
+					polygon[i] = ProjectClipVertex(polygon[i], viewport);
+			}
+			else
+			{
+				for (int16_t i = 0; i < 3; i++)
+					polygon[i] = { px[v[i]], py[v[i]], pz[v[i]], pw[v[i]] };
+				nPoints = 3;
 			}
-			count_tris++;
 
-			// Change color
-			tri_color++;
-			if (tri_color == FG_GREY) tri_color++;
-			triProjected.col = tri_color;
+			// What is left in front of the camera can still be out of the view by one side
+			uint8_t poly_and = (nPoints > 0) ? 0xFF : CLIP_NEAR, poly_or = 0;
+			for (size_t i = 0; i < nPoints; i++)
+			{
+				uint8_t code = GetClipCode(polygon[i].x, polygon[i].y, polygon[i].z, polygon[i].w, screen_rect, guard_rect);
+				poly_and &= code;
+				poly_or |= code;
+			}
+			if (poly_and)
+			{
+				clipStats.nRejected++;
+				continue;
+			}
+			clipStats.nClipped++;
 
-			vecTrianglesToRaster.push_back(triProjected);
+			if (bDepthBuffer && (poly_or & CLIP_GUARD))
+			{
+				std::copy(polygon, polygon + nPoints, temp);
+				nPoints = ClipPolygonRect(temp, nPoints, guard_rect, polygon);
+			}
+
+			for (size_t i = 2; i < nPoints; i++)
+				add_triangle(polygon[0], polygon[i - 1], polygon[i], col, nullptr);
 		}
 
 		// Get barycenter of figure
-		barycenter /= count_tris * 3;
+		if (count_tris)
+			barycenter /= count_tris * 3;
 
-		// Sort triangles from back to front
-		std::sort(vecTrianglesToRaster.begin(), vecTrianglesToRaster.end(), [](triangle& t1, triangle& t2)
-			{
-				float z1 = (t1.points[0].z + t1.points[1].z + t1.points[2].z) / 3.0f;
-				float z2 = (t2.points[0].z + t2.points[1].z + t2.points[2].z) / 3.0f;
-				return z1 > z2; // was >
-			});
+		stage_done(STAGE_CLIP);
+
+		if (bDepthBuffer)
+		{
+			// Figures hide each other, so all of them are drawn together after the loop
+			count_tris = 0;
+			barycenter = 0.0f;
+			continue;
+		}
+
+		// Sort triangles from back to front by the average depth, computed once per triangle.
+		// The figure keeps its order for the next frame
+		for (size_t k = 0; k < nTris; k++)
+			depths[k] = (tris[k].points[0].z + tris[k].points[1].z + tris[k].points[2].z) / 3.0f;
+		const uint32_t* order = depthSort.Sort(depths, nTris, inst.node);
 
 		// Round all coord of points
-		for (auto& tri : vecTrianglesToRaster)
+		for (size_t k = 0; k < nTris; k++)
 		{
+			triangle& tri = sorted[k];
+			tri = tris[order[k]];
+			std::copy(tri_sides + 3 * order[k], tri_sides + 3 * order[k] + 3, sorted_sides + 3 * k);
 			for (int16_t i = 0; i < 3; i++)
 			{
 				tri.points[i].x = roundf(tri.points[i].x);
@@ -216,16 +565,255 @@ void NewGarphics::OnUserUpdate(float fElapsedTime)
 			}
 		}
 
+		stage_done(STAGE_SORT);
+
 		// Draw
-		DrawShadow(vecTrianglesToRaster, light);
-		std::vector<triangle> vecVisibleSurfaces;
 		fPoint3D view_point = { static_cast<float>(iConsoleWidth) / 2.0f, static_cast<float>(iConsoleHeight) / 2.0f, -100.0f };
 
-		vecVisibleSurfaces = RobertsAlgorithm(vecTrianglesToRaster, view_point, barycenter, PIXEL_SOLID, FG_BLUE);
-		
-		t += 1.0f;
+		{
+			ArenaScope scope(frameArena);
+			uint8_t* edges_drawn = mesh_sides ? frameArena.Allocate<uint8_t>(sh.nEdges) : nullptr;
+			RobertsAlgorithm(sorted, nTris, view_point, barycenter, nullptr, PIXEL_SOLID, FG_BLUE, FG_GREY, !bFrontOnly,
+				mesh_sides ? sorted_sides : nullptr, edges_drawn);
+		}
+		stage_done(STAGE_ROBERTS);
+
 		count_tris = 0;
 		barycenter = 0.0f;
-		vecTrianglesToRaster.clear();
+		nTris = 0;
+	}
+
+	PROFILE_COUNT(COUNTER_TRIS_BACKFACING, clipStats.nBackFaces);
+	PROFILE_COUNT(COUNTER_TRIS_CLIPPED, clipStats.nClipped);
+	PROFILE_COUNT(COUNTER_TRIS_REJECTED, clipStats.nRejected);
+
+	if (bDepthBuffer)
+	{
+		if (bTiledRaster)
+			RasterTrianglesDepthTiled(tris, nTris);
+		else
+		{
+			for (size_t k = 0; k < nTris; k++)
+				RasterTriangleDepth(tris[k], tris[k].sym, tris[k].col);
+		}
+		stage_done(STAGE_RASTER);
+	}
+}
+
+void NewGarphics::BuildMeshViews()
+{
+	vecShapeViews.clear();
+	for (auto& sh : shapes)
+		vecShapeViews.push_back(sh.View());
+	for (auto& mapped : vecMappedShapes)
+		vecShapeViews.push_back(mapped->View());
+
+	vecMeshFirstFace.clear();
+	uint32_t nFaces = 0;
+	for (auto& sh : vecShapeViews)
+	{
+		vecMeshFirstFace.push_back(nFaces);
+		nFaces += sh.nFaces;
+	}
+
+	scene.SetMeshes(vecShapeViews);
+}
+
+void NewGarphics::UpdateShadowMask(const sClipRect& screen_rect)
+{
+	shadowStats.bRebuilt = false;
+
+	// The mask is on the screen: the viewport moves it as well as the matrices
+	if (bShadowValid && nShadowCameraBuilds == camera.GetBuildCount() && nShadowViewports == camera.GetViewportCount()
+		&& nShadowSceneStamp == scene.GetStamp() && shadowLight.x == light.x && shadowLight.y == light.y && shadowLight.z == light.z)
+		return;
+
+	bShadowValid = true;
+	nShadowCameraBuilds = camera.GetBuildCount();
+	nShadowViewports = camera.GetViewportCount();
+	nShadowSceneStamp = scene.GetStamp();
+	shadowLight = light;
+	shadowStats = { 0, 0, 0, 0, true };
+	shadowMask.Clear();
+
+	// The light must go down to the ground
+	math3d::vec3 light_dir = light.Vec3();
+	if (ground.x * light_dir.x + ground.y * light_dir.y + ground.z * light_dir.z >= 0.0f)
+		return;
+
+	// Only instances whose shadow can be in the view
+	mat4x4 shadow = math3d::MakeShadowProjection(ground, light_dir);
+	scene.CullProjected(camera.GetFrustum(), shadow, vecShadowCasters);
+	mat4x4 ShadowViewProjMatrix = shadow * camera.GetWorldViewProj();
+	const sViewport& viewport = camera.GetViewport();
+	shadowStats.nCasters = static_cast<uint32_t>(vecShadowCasters.size());
+
+	for (int32_t nNode : vecShadowCasters)
+	{
+		const SceneGraph::sNode& node = scene.GetNode(nNode);
+		const sMeshView& sh = vecShapeViews[node.nMesh];
+		mat4x4 matrix = node.world * ShadowViewProjMatrix;
+		ArenaScope scope(frameArena);
+
+		// Faces turned to the light cover the whole shadow of a closed mesh. The light
+		// goes into the space of the mesh, open meshes give all their faces
+		math3d::vec4 local_light = math3d::Transform(math3d::InverseAffine(node.world), { light_dir.x, light_dir.y, light_dir.z, 0.0f });
+		uint8_t* lit = frameArena.Allocate<uint8_t>(sh.nFaces);
+		for (uint32_t k = 0; k < sh.nFaces; k++)
+		{
+			const sFacePlane* plane = sh.planes ? &sh.planes[k] : nullptr;
+			lit[k] = !plane || plane->nx * local_light.x + plane->ny * local_light.y + plane->nz * local_light.z < 0.0f;
+			shadowStats.nFaces += lit[k];
+		}
+
+		// Edges between the lit and the dark faces go around the same shadow: their
+		// loops are filled instead of all the faces. They must be in front of the
+		// camera all the way round, else the faces are cut one by one
+		if (bMeshEdges && sh.edges)
+		{
+			uint32_t* silhouette = frameArena.Allocate<uint32_t>(2 * static_cast<size_t>(sh.nEdges));
+			size_t nEdges = FindSilhouetteEdges(sh, lit, silhouette);
+			math3d::vec4* points = frameArena.Allocate<math3d::vec4>(2 * nEdges);
+
+			bool bInside = true;
+			for (size_t i = 0; i < 2 * nEdges && bInside; i++)
+			{
+				uint32_t v = silhouette[i];
+				points[i] = math3d::Transform(matrix, { sh.x[v], sh.y[v], sh.z[v], 1.0f });
+				bInside = points[i].w > 0.0f && points[i].z >= 0.0f && points[i].z <= points[i].w;
+			}
+
+			if (bInside)
+			{
+				for (size_t i = 0; i < 2 * nEdges; i++)
+					points[i] = ProjectClipVertex(points[i], viewport);
+				shadowMask.FillEdges(points, nEdges);
+				shadowStats.nEdges += static_cast<uint32_t>(nEdges);
+				continue;
+			}
+		}
+
+		for (uint32_t k = 0; k < sh.nFaces; k++)
+		{
+			if (!lit[k])
+				continue;
+
+			// Ground in front of the camera, then the screen
+			math3d::vec4 clip[3], polygon[5], cut[9];
+			for (int16_t i = 0; i < 3; i++)
+			{
+				uint32_t v = sh.Index(3 * k + i);
+				clip[i] = math3d::Transform(matrix, { sh.x[v], sh.y[v], sh.z[v], 1.0f });
+			}
+			size_t nPoints = ClipPolygonDepth(clip, 3, polygon);
+			for (size_t i = 0; i < nPoints; i++)
+				polygon[i] = ProjectClipVertex(polygon[i], viewport);
+			nPoints = ClipPolygonRect(polygon, nPoints, screen_rect, cut);
+
+			shadowMask.FillPolygon(cut, nPoints);
+		}
+	}
+
+	shadowStats.nArea = shadowMask.GetArea();
+}
+
+void NewGarphics::DrawShadows()
+{
+	// Every shadow cell once, in spans
+	shadowMask.ForEachSpan([this](int16_t y, int16_t x1, int16_t x2) { DrawSpan(x1, x2, y, PIXEL_SOLID, BG_GREY); });
+}
+
+void NewGarphics::BuildScene()
+{
+	// Side by side along X with a gap between the boxes, the row is centered on
+	// the origin, so the controls turn it around its middle. X of the projection
+	// is inverted: the first mesh is on the left
+	const float fGap = 1.0f;
+
+	float fRowWidth = -fGap;
+	for (size_t i = 0; i < vecShapeViews.size(); i++)
+	{
+		const sBoundingBox& box = scene.GetMeshBounds(static_cast<int32_t>(i));
+		if (!box.IsEmpty())
+			fRowWidth += (box.max.x - box.min.x) + fGap;
+	}
+
+	scene.Clear();
+	float x = 0.5f * fRowWidth;
+	for (size_t i = 0; i < vecShapeViews.size(); i++)
+	{
+		const sBoundingBox& box = scene.GetMeshBounds(static_cast<int32_t>(i));
+		if (box.IsEmpty())
+			continue;
+		scene.AddNode(scene.GetRoot(), static_cast<int32_t>(i),
+			math3d::MakeTranslation(x - box.max.x, 0.0f, -0.5f * (box.min.z + box.max.z)));
+		x -= (box.max.x - box.min.x) + fGap;
+	}
+
+	ReserveSortMemory();
+}
+
+void NewGarphics::ReserveSortMemory()
+{
+	// A face cut by the near or far plane gives up to 7 triangles. Histories are
+	// as long as the meshes: figures cut by the planes are sorted from scratch
+	uint32_t nMaxFaces = 0;
+	for (auto& sh : vecShapeViews)
+		nMaxFaces = std::max(nMaxFaces, sh.nFaces);
+	depthSort.Reserve(7 * static_cast<size_t>(nMaxFaces));
+
+	depthSort.ClearHistory();
+	for (size_t i = 0; i < scene.GetNodeCount(); i++)
+	{
+		int32_t nMesh = scene.GetNode(static_cast<int32_t>(i)).nMesh;
+		if (nMesh >= 0)
+			depthSort.ReserveHistory(static_cast<int32_t>(i), vecShapeViews[nMesh].nFaces);
+	}
+}
+
+void NewGarphics::AddModel(const char* path)
+{
+	vecModelPaths.push_back(path);
+}
+
+void NewGarphics::LoadModels()
+{
+	// Models which can't be loaded are skipped (the loader prints why)
+	vecMappedShapes.clear();
+
+	for (auto& path : vecModelPaths)
+	{
+		size_t dot = path.rfind('.');
+		std::string extension = (dot == std::string::npos) ? "" : path.substr(dot);
+
+		if (extension == ".kgm")
+		{
+			std::unique_ptr<MappedMesh> mapped(new MappedMesh());
+			if (!mapped->Open(path.c_str()))
+				vecMappedShapes.push_back(std::move(mapped));
+		}
+		else
+		{
+			indexedMesh model;
+			if (!LoadObj(path.c_str(), model, PIXEL_SOLID, FG_WHITE))
+				shapes.push_back(std::move(model));
+		}
+	}
+}
+
+const char* NewGarphics::GetStageName(FRAME_STAGE stage)
+{
+	switch (stage)
+	{
+	case STAGE_CLEAR:		return "Clear";
+	case STAGE_MATRICES:	return "Matrices";
+	case STAGE_CULL:		return "Cull";
+	case STAGE_CLIP:		return "Clip";
+	case STAGE_TRANSFORM:	return "Transform";
+	case STAGE_SORT:		return "Sort";
+	case STAGE_SHADOW:		return "Shadow";
+	case STAGE_ROBERTS:		return "Roberts";
+	case STAGE_RASTER:		return "Raster";
+	default:				return "?";
 	}
 }
@@ -1,28 +1,120 @@
 #ifndef _NEW_GRAPHICS_H_
 #define _NEW_GRAPHICS_H_
 
+#include "Camera.h"
+#include "Clipping.h"
+#include "DepthSort.h"
 #include "Graphics.h"
+#include "MeshLoader.h"
+#include "SceneGraph.h"
+#include "ShadowMask.h"
+#include "VertexTransform.h"
+
+#include <string>
 
 class NewGarphics : public Graphics
 {
+public:
+		// Stages of one frame, which can be measured separately
+	enum FRAME_STAGE
+	{
+		STAGE_CLEAR,					// Clear screen & surface
+		STAGE_MATRICES,					// World matrix setup
+		STAGE_CULL,						// Scene graph update & frustum culling
+		STAGE_TRANSFORM,				// Transform & projection of triangles
+		STAGE_CLIP,						// Near/far planes & guard band
+		STAGE_SORT,						// Sort from back to front & rounding
+		STAGE_SHADOW,					// Shadow mask & its spans
+		STAGE_ROBERTS,					// RobertsAlgorithm with filling
+		STAGE_RASTER,					// Z-buffer (instead of sort & Roberts)
+		STAGE_COUNT
+	};
+
 	// Variables
-private:
+protected:
 
-	std::vector<mesh> shapes;			// figures;
+	std::vector<indexedMesh> shapes;	// figures;
+	std::vector<std::unique_ptr<MappedMesh>> vecMappedShapes;	// Figures drawn straight from .kgm files
+	std::vector<std::string> vecModelPaths;	// Loaded instead of the built-in figures
+	std::vector<sMeshView> vecShapeViews;	// Meshes the scene nodes refer to (views of shapes)
+	std::vector<uint32_t> vecMeshFirstFace;	// Faces of the meshes before this one, for colours
+	SceneGraph scene;					// Instances of the meshes, what RenderFrame draws
+	sProjectedBatch projected;			// Vertices of all visible instances after projection
+	std::vector<uint8_t> vecClipCodes;	// CLIP_CODE of every vertex in projected
+	std::vector<uint8_t> vecFrontFaces;	// 1 for faces of the visible instances the camera sees
+	TRANSFORM_KERNEL transform_kernel;
 
 	float scale;						// For scaling
 	float _x, _y, _z;					// For Moving
 	float fThetaX, fThetaY, fThetaZ;
+	bool bDepthBuffer;					// Draw with z-buffer instead of sort + Roberts (key B)
+	bool bTiledRaster;					// Z-buffer in tiles by all cores (key M)
+	bool bCacheBackground;				// Restore the cached background instead of clearing
+	bool bFrustumCulling;				// Draw only instances in the view (key C)
+	bool bClipping;						// Clip triangles by the near/far planes and the guard band
+	bool bBackFaceCulling;				// Drop faces of closed meshes turned away before projection (key V)
+	bool bMeshEdges;					// Edges of closed meshes: outlines once per edge, shadows from silhouettes (key O)
+	sClipStats clipStats;				// Of the last frame
+	DepthSort depthSort;				// Painter's order of the triangles of every figure
 
-	mat4x4 matProj;						// Matrix that converts from view space to screen space
+		// Shadows of the figures on the ground, built again only when the light,
+		// the figures or the camera changed
+	struct sShadowStats
+	{
+		uint32_t nCasters;				// Instances whose shadow can be seen
+		uint32_t nFaces;				// Their faces turned to the light
+		uint32_t nEdges;				// Silhouette edges filled instead of the faces
+		uint32_t nArea;					// Cells in the shadow
+		bool bRebuilt;					// In this frame
+	};
+	math3d::vec4 ground;				// Plane the shadows lie on
+	ShadowMask shadowMask;
+	std::vector<int32_t> vecShadowCasters;
+	uint64_t nShadowCameraBuilds, nShadowViewports, nShadowSceneStamp;
+	fPoint3D shadowLight;
+	bool bShadowValid;
+	sShadowStats shadowStats;
+
+	Camera camera;						// World, projection and viewport, rebuilt only when changed
 
 	fPoint3D light;
 	fPoint3D barycenter;
 
+		// Everything the controls move, so a frame can be drawn between two simulation steps
+	struct sViewState
+	{
+		float scale;
+		float _x, _y, _z;
+		float fThetaX, fThetaY, fThetaZ;
+	};
+	sViewState viewPrevious;			// Before the last OnUserSimulate
+
+	bool bMeasureStages;				// Add time of every stage to fStageTime
+	float fStageTime[STAGE_COUNT];		// Seconds
+
+public:
+	void AddModel(const char* path);	// .obj or .kgm, call before Loop
+
 	// Overrided methods
-private:
+protected:
 	virtual void OnUserCreate() override;
 	virtual void OnUserUpdate(float fElapsedTime) override;
+	virtual void OnUserSimulate(float fStep) override;
+
+	void HandleToggles();				// Once per frame
+	void HandleMotion(float fElapsedTime);	// Once per frame, or per step of the fixed timestep
+	sViewState GetViewState() const;
+	void SetViewState(const sViewState& state);
+	void RenderFrame();
+	void BuildMeshViews();				// Call after shapes are changed
+	void UpdateShadowMask(const sClipRect& screen_rect);
+	void DrawShadows();
+	void BuildScene();					// One instance of every mesh, in a row
+	void ReserveSortMemory();			// After the scene is built: sorts of the frames don't allocate
+	void LoadModels();
+
+public:
+	static const char* GetStageName(FRAME_STAGE stage);
 };
 
 #endif // !_NEW_GRAPHICS_H_
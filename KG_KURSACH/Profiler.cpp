@@ -0,0 +1,166 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+std::atomic<int64_t> Profiler::nAllocations(0);
+
+#ifdef KG_PROFILE
+	// Every heap allocation of the program is counted
+void* operator new(size_t size)
+{
+	Profiler::nAllocations.fetch_add(1, std::memory_order_relaxed);
+
+	if (void* ptr = std::malloc(size ? size : 1))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	std::free(ptr);
+}
+#endif
+
+Profiler::Profiler()
+{
+	tpStart = tpFrame = clock::now();
+	fFrameTime = fLastFrameTime = 0.0f;
+
+	std::fill(nCounters, nCounters + COUNTER_COUNT, 0);
+	std::fill(nLastCounters, nLastCounters + COUNTER_COUNT, 0);
+	nAllocationsAtFrame = 0;
+
+	// Enough for all scopes of a frame, so profiling itself doesn't allocate
+	vecScopes.reserve(64);
+	vecLastScopes.reserve(64);
+
+	bTrace = false;
+	nMaxTraceEvents = 0;
+}
+
+Profiler& Profiler::Get()
+{
+	static Profiler profiler;
+	return profiler;
+}
+
+void Profiler::BeginFrame()
+{
+	tpFrame = clock::now();
+	vecScopes.clear();
+	std::fill(nCounters, nCounters + COUNTER_COUNT, 0);
+	nAllocationsAtFrame = nAllocations.load(std::memory_order_relaxed);
+
+	if (bTrace && vecTrace.size() < nMaxTraceEvents)
+		vecTraceFrames.push_back(std::chrono::duration<double, std::micro>(tpFrame - tpStart).count());
+}
+
+void Profiler::EndFrame()
+{
+	nCounters[COUNTER_ALLOCATIONS] = nAllocations.load(std::memory_order_relaxed) - nAllocationsAtFrame;
+
+	fLastFrameTime = std::chrono::duration<float>(clock::now() - tpFrame).count();
+	vecLastScopes.swap(vecScopes);
+	std::copy(nCounters, nCounters + COUNTER_COUNT, nLastCounters);
+
+	if (bTrace && vecTraceCounters.size() < vecTraceFrames.size() * COUNTER_COUNT)
+		vecTraceCounters.insert(vecTraceCounters.end(), nCounters, nCounters + COUNTER_COUNT);
+}
+
+void Profiler::AddScope(const char* name, clock::time_point tp1, clock::time_point tp2)
+{
+	float fTime = std::chrono::duration<float>(tp2 - tp1).count();
+
+	// Scopes are few, so linear search by the name pointer is enough
+	auto it = std::find_if(vecScopes.begin(), vecScopes.end(), [name](const sScopeStat& s) { return s.name == name; });
+	if (it == vecScopes.end())
+		vecScopes.push_back({ name, fTime, 1 });
+	else
+	{
+		it->fTime += fTime;
+		it->nCalls++;
+	}
+
+	if (bTrace && vecTrace.size() < nMaxTraceEvents)
+	{
+		double ts = std::chrono::duration<double, std::micro>(tp1 - tpStart).count();
+		double dur = std::chrono::duration<double, std::micro>(tp2 - tp1).count();
+		vecTrace.push_back({ name, ts, dur });
+	}
+}
+
+void Profiler::StartTrace(size_t max_events)
+{
+	bTrace = true;
+	nMaxTraceEvents = max_events;
+
+	vecTrace.clear();
+	vecTraceFrames.clear();
+	vecTraceCounters.clear();
+	vecTrace.reserve(max_events);
+}
+
+bool Profiler::WriteChromeTrace(const char* path)
+{
+	FILE* file = std::fopen(path, "w");
+	if (!file)
+		return false;
+
+	std::fprintf(file, "{\"traceEvents\":[\n");
+
+	bool bFirst = true;
+	auto separator = [&bFirst, file]()
+	{
+		if (!bFirst)
+			std::fprintf(file, ",\n");
+		bFirst = false;
+	};
+
+	for (auto& event : vecTrace)
+	{
+		separator();
+		std::fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+			event.name, event.ts, event.dur);
+	}
+
+	// Counters of every frame are put at its start
+	size_t nFrames = vecTraceCounters.size() / COUNTER_COUNT;
+	for (size_t f = 0; f < nFrames; f++)
+		for (int16_t c = 0; c < COUNTER_COUNT; c++)
+		{
+			separator();
+			std::fprintf(file, "{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"value\":%lld}}",
+				GetCounterName(static_cast<PROFILE_COUNTER>(c)), vecTraceFrames[f],
+				static_cast<long long>(vecTraceCounters[f * COUNTER_COUNT + c]));
+		}
+
+	std::fprintf(file, "\n]}\n");
+	std::fclose(file);
+
+	return true;
+}
+
+const char* Profiler::GetCounterName(PROFILE_COUNTER counter)
+{
+	switch (counter)
+	{
+	case COUNTER_TRIS_TRANSFORMED:	return "tris transformed";
+	case COUNTER_TRIS_CULLED:		return "tris culled";
+	case COUNTER_SPANS_FILLED:		return "spans filled";
+	case COUNTER_PIXELS_FILLED:		return "pixels filled";
+	case COUNTER_ALLOCATIONS:		return "allocations";
+	case COUNTER_MATRIX_BUILDS:		return "matrix builds";
+	case COUNTER_TRIS_CLIPPED:		return "tris clipped";
+	case COUNTER_TRIS_REJECTED:		return "tris rejected";
+	case COUNTER_TRIS_BACKFACING:	return "tris back-facing";
+	default:						return "?";
+	}
+}
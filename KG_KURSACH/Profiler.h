@@ -0,0 +1,111 @@
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+//###################//
+	// Frame profiler
+//###################//
+
+	// Scoped timers and counters are compiled only with KG_PROFILE defined
+	// (Project Properties -> C/C++ -> Preprocessor), otherwise the macros are empty.
+	// Only the render thread may use them.
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#ifdef KG_PROFILE
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_COUNT(counter, n) Profiler::Get().Count(counter, n)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_COUNT(counter, n)
+#endif
+
+enum PROFILE_COUNTER
+{
+	COUNTER_TRIS_TRANSFORMED,
+	COUNTER_TRIS_CULLED,
+	COUNTER_SPANS_FILLED,
+	COUNTER_PIXELS_FILLED,
+	COUNTER_ALLOCATIONS,
+	COUNTER_MATRIX_BUILDS,
+	COUNTER_TRIS_CLIPPED,
+	COUNTER_TRIS_REJECTED,
+	COUNTER_TRIS_BACKFACING,
+	COUNTER_COUNT
+};
+
+class Profiler
+{
+public:
+	using clock = std::chrono::steady_clock;
+
+	struct sScopeStat
+	{
+		const char* name;
+		float fTime;									// Seconds in the frame
+		uint32_t nCalls;
+	};
+
+private:
+	struct sTraceEvent
+	{
+		const char* name;
+		double ts, dur;									// Microseconds from start
+	};
+
+	clock::time_point tpStart;
+	clock::time_point tpFrame;
+	float fFrameTime, fLastFrameTime;
+
+	std::vector<sScopeStat> vecScopes, vecLastScopes;
+	int64_t nCounters[COUNTER_COUNT];
+	int64_t nLastCounters[COUNTER_COUNT];
+	int64_t nAllocationsAtFrame;
+
+	bool bTrace;
+	size_t nMaxTraceEvents;
+	std::vector<sTraceEvent> vecTrace;
+	std::vector<double> vecTraceFrames;					// Start of every frame
+	std::vector<int64_t> vecTraceCounters;				// COUNTER_COUNT values per frame
+
+	Profiler();
+
+public:
+	static Profiler& Get();
+	static std::atomic<int64_t> nAllocations;			// Counted by operator new with KG_PROFILE
+
+	void BeginFrame();
+	void EndFrame();
+
+	void AddScope(const char* name, clock::time_point tp1, clock::time_point tp2);
+	void Count(PROFILE_COUNTER counter, int64_t n) { nCounters[counter] += n; }
+
+		// Chrome trace (chrome://tracing, ui.perfetto.dev)
+	void StartTrace(size_t max_events = 1 << 20);
+	bool WriteChromeTrace(const char* path);
+
+		// Results of the last finished frame
+	float GetFrameTime() const { return fLastFrameTime; }
+	const std::vector<sScopeStat>& GetFrameScopes() const { return vecLastScopes; }
+	int64_t GetFrameCounter(PROFILE_COUNTER counter) const { return nLastCounters[counter]; }
+
+	static const char* GetCounterName(PROFILE_COUNTER counter);
+};
+
+class ProfileScope
+{
+private:
+	const char* name;
+	Profiler::clock::time_point tpStart;
+
+public:
+	ProfileScope(const char* name) : name(name), tpStart(Profiler::clock::now()) {}
+	~ProfileScope() { Profiler::Get().AddScope(name, tpStart, Profiler::clock::now()); }
+};
+
+#endif // !_PROFILER_H_
@@ -0,0 +1,279 @@
+#include "SceneGraph.h"
+
+#include <algorithm>
+#include <cfloat>
+
+static const sBoundingBox EMPTY_BOX = { { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+
+SceneGraph::SceneGraph()
+{
+	nStamp = 0;
+	Clear();
+}
+
+void SceneGraph::Clear()
+{
+	vecNodes.clear();
+	vecVisible.clear();
+	stats = { 0, 0, 0, 0 };
+
+	// Root: a group without a transform
+	sNode root;
+	root.local = root.world = root.matrix = math3d::MakeIdentity();
+	root.nMatrixStamp = UINT64_MAX;
+	root.nParent = root.nFirstChild = root.nLastChild = root.nNextSibling = -1;
+	root.nMesh = -1;
+	root.box = EMPTY_BOX;
+	root.sphere = { { 0.0f, 0.0f, 0.0f }, -1.0f };
+	root.bDirty = true;
+	root.bChanged = false;
+	vecNodes.push_back(root);
+	bDirty = true;
+	nStamp++;
+}
+
+void SceneGraph::SetMeshes(const std::vector<sMeshView>& meshes)
+{
+	vecMeshBounds.clear();
+	for (auto& mesh : meshes)
+	{
+		sBoundingBox box = EMPTY_BOX;
+		for (uint32_t i = 0; i < mesh.nVertices; i++)
+		{
+			box.min = { std::min(box.min.x, mesh.x[i]), std::min(box.min.y, mesh.y[i]), std::min(box.min.z, mesh.z[i]) };
+			box.max = { std::max(box.max.x, mesh.x[i]), std::max(box.max.y, mesh.y[i]), std::max(box.max.z, mesh.z[i]) };
+		}
+		vecMeshBounds.push_back(box);
+	}
+
+	for (auto& node : vecNodes)
+		node.bDirty = true;
+	bDirty = true;
+	nStamp++;
+}
+
+int32_t SceneGraph::AddNode(int32_t nParent, int32_t nMesh, const math3d::mat4& local)
+{
+	int32_t nNode = static_cast<int32_t>(vecNodes.size());
+
+	sNode node;
+	node.local = local;
+	node.world = node.matrix = math3d::MakeIdentity();
+	node.nMatrixStamp = UINT64_MAX;
+	node.nParent = nParent;
+	node.nFirstChild = node.nLastChild = node.nNextSibling = -1;
+	node.nMesh = nMesh;
+	node.box = EMPTY_BOX;
+	node.sphere = { { 0.0f, 0.0f, 0.0f }, -1.0f };
+	node.bDirty = true;
+	node.bChanged = false;
+
+	sNode& parent = vecNodes[nParent];
+	if (parent.nLastChild >= 0)
+		vecNodes[parent.nLastChild].nNextSibling = nNode;
+	else
+		parent.nFirstChild = nNode;
+	parent.nLastChild = nNode;
+	vecNodes.push_back(node);
+
+	// The visible list mustn't grow during frames
+	vecVisible.reserve(vecNodes.size());
+	bDirty = true;
+	return nNode;
+}
+
+void SceneGraph::SetLocal(int32_t nNode, const math3d::mat4& local)
+{
+	vecNodes[nNode].local = local;
+	vecNodes[nNode].bDirty = true;
+	bDirty = true;
+}
+
+void SceneGraph::Update()
+{
+	if (!bDirty)
+		return;
+
+	// Parents first: a world matrix changes with the local one or with the parent
+	for (auto& node : vecNodes)
+	{
+		bool bParentChanged = (node.nParent >= 0) && vecNodes[node.nParent].bChanged;
+		node.bChanged = node.bDirty || bParentChanged;
+		if (!node.bChanged)
+			continue;
+
+		node.world = (node.nParent >= 0) ? node.local * vecNodes[node.nParent].world : node.local;
+		node.nMatrixStamp = UINT64_MAX;
+		node.bDirty = false;
+	}
+
+	// Children first: bounds of a parent take in the bounds of its children
+	for (size_t i = vecNodes.size(); i-- > 0;)
+	{
+		sNode& node = vecNodes[i];
+		if (!node.bChanged)
+			continue;
+
+		UpdateBounds(node);
+		if (node.nParent >= 0)
+			vecNodes[node.nParent].bChanged = true;
+		node.bChanged = false;
+	}
+
+	bDirty = false;
+	nStamp++;
+}
+
+void SceneGraph::UpdateBounds(sNode& node)
+{
+	sBoundingBox box = EMPTY_BOX;
+
+	// Box of the mesh in the world: all 8 corners are transformed
+	if (node.nMesh >= 0 && !vecMeshBounds[node.nMesh].IsEmpty())
+	{
+		const sBoundingBox& local = vecMeshBounds[node.nMesh];
+		for (int16_t c = 0; c < 8; c++)
+		{
+			math3d::vec4 corner = { (c & 1) ? local.max.x : local.min.x, (c & 2) ? local.max.y : local.min.y,
+				(c & 4) ? local.max.z : local.min.z, 1.0f };
+			math3d::vec4 p = math3d::Transform(node.world, corner);
+			box.min = { std::min(box.min.x, p.x), std::min(box.min.y, p.y), std::min(box.min.z, p.z) };
+			box.max = { std::max(box.max.x, p.x), std::max(box.max.y, p.y), std::max(box.max.z, p.z) };
+		}
+	}
+
+	for (int32_t c = node.nFirstChild; c >= 0; c = vecNodes[c].nNextSibling)
+	{
+		const sBoundingBox& child = vecNodes[c].box;
+		if (child.IsEmpty())
+			continue;
+		box.min = { std::min(box.min.x, child.min.x), std::min(box.min.y, child.min.y), std::min(box.min.z, child.min.z) };
+		box.max = { std::max(box.max.x, child.max.x), std::max(box.max.y, child.max.y), std::max(box.max.z, child.max.z) };
+	}
+
+	node.box = box;
+	if (box.IsEmpty())
+		node.sphere = { { 0.0f, 0.0f, 0.0f }, -1.0f };
+	else
+		node.sphere = { (box.min + box.max) * 0.5f, math3d::Length(box.max - box.min) * 0.5f };
+}
+
+size_t SceneGraph::Cull(const sFrustum* frustum)
+{
+	vecVisible.clear();
+	stats = { 0, 0, 0, 0 };
+
+	if (frustum)
+		CullNode(GetRoot(), *frustum);
+	else
+		AcceptNode(GetRoot());
+
+	stats.nVisible = static_cast<uint32_t>(vecVisible.size());
+	return vecVisible.size();
+}
+
+void SceneGraph::CullNode(int32_t nNode, const sFrustum& frustum)
+{
+	const sNode& node = vecNodes[nNode];
+	if (node.sphere.radius < 0.0f)
+		return;
+
+	stats.nTested++;
+
+	// Sphere first, the box only where the sphere crosses a plane
+	bool bInside = true;
+	for (int16_t p = 0; p < 6; p++)
+	{
+		const math3d::vec4& plane = frustum.planes[p];
+		math3d::vec3 normal = { plane.x, plane.y, plane.z };
+		float fDistance = math3d::Dot(normal, node.sphere.center) + plane.w;
+
+		if (fDistance >= node.sphere.radius)
+			continue;
+		bInside = false;
+		if (fDistance < -node.sphere.radius)
+		{
+			stats.nRejected++;
+			return;
+		}
+
+		// Corner of the box farthest along the normal
+		math3d::vec3 corner = { (plane.x >= 0.0f) ? node.box.max.x : node.box.min.x,
+			(plane.y >= 0.0f) ? node.box.max.y : node.box.min.y, (plane.z >= 0.0f) ? node.box.max.z : node.box.min.z };
+		if (math3d::Dot(normal, corner) + plane.w < 0.0f)
+		{
+			stats.nRejected++;
+			return;
+		}
+	}
+
+	if (bInside)
+	{
+		stats.nAccepted++;
+		AcceptNode(nNode);
+		return;
+	}
+
+	if (node.nMesh >= 0)
+		vecVisible.push_back(nNode);
+	for (int32_t c = node.nFirstChild; c >= 0; c = vecNodes[c].nNextSibling)
+		CullNode(c, frustum);
+}
+
+void SceneGraph::AcceptNode(int32_t nNode)
+{
+	const sNode& node = vecNodes[nNode];
+	if (node.nMesh >= 0)
+		vecVisible.push_back(nNode);
+	for (int32_t c = node.nFirstChild; c >= 0; c = vecNodes[c].nNextSibling)
+		AcceptNode(c);
+}
+
+void SceneGraph::CullProjected(const sFrustum& frustum, const math3d::mat4& projection, std::vector<int32_t>& nodes) const
+{
+	nodes.clear();
+	CullProjectedNode(GetRoot(), frustum, projection, nodes);
+}
+
+void SceneGraph::CullProjectedNode(int32_t nNode, const sFrustum& frustum, const math3d::mat4& projection, std::vector<int32_t>& nodes) const
+{
+	const sNode& node = vecNodes[nNode];
+	if (node.box.IsEmpty())
+		return;
+
+	// The projection is linear: the box of the 8 projected corners holds everything under the node
+	sBoundingBox box = EMPTY_BOX;
+	for (int16_t i = 0; i < 8; i++)
+	{
+		math3d::vec4 corner = { (i & 1) ? node.box.max.x : node.box.min.x, (i & 2) ? node.box.max.y : node.box.min.y,
+			(i & 4) ? node.box.max.z : node.box.min.z, 1.0f };
+		corner = math3d::Transform(projection, corner);
+		box.min = { std::min(box.min.x, corner.x), std::min(box.min.y, corner.y), std::min(box.min.z, corner.z) };
+		box.max = { std::max(box.max.x, corner.x), std::max(box.max.y, corner.y), std::max(box.max.z, corner.z) };
+	}
+
+	for (int16_t p = 0; p < 6; p++)
+	{
+		const math3d::vec4& plane = frustum.planes[p];
+		math3d::vec3 corner = { (plane.x >= 0.0f) ? box.max.x : box.min.x,
+			(plane.y >= 0.0f) ? box.max.y : box.min.y, (plane.z >= 0.0f) ? box.max.z : box.min.z };
+		if (math3d::Dot({ plane.x, plane.y, plane.z }, corner) + plane.w < 0.0f)
+			return;
+	}
+
+	if (node.nMesh >= 0)
+		nodes.push_back(nNode);
+	for (int32_t c = node.nFirstChild; c >= 0; c = vecNodes[c].nNextSibling)
+		CullProjectedNode(c, frustum, projection, nodes);
+}
+
+const math3d::mat4& SceneGraph::GetMatrix(int32_t nNode, const math3d::mat4& viewProj, uint64_t nStamp)
+{
+	sNode& node = vecNodes[nNode];
+	if (node.nMatrixStamp != nStamp)
+	{
+		node.matrix = node.world * viewProj;
+		node.nMatrixStamp = nStamp;
+	}
+	return node.matrix;
+}
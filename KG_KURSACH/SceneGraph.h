@@ -0,0 +1,107 @@
+#ifndef _SCENE_GRAPH_H_
+#define _SCENE_GRAPH_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "Camera.h"
+#include "IndexedMesh.h"
+#include "Math3D.h"
+
+//###################//
+	// Scene graph
+//###################//
+
+struct sBoundingBox
+{
+	math3d::vec3 min, max;								// min > max - empty
+
+	bool IsEmpty() const { return min.x > max.x; }
+};
+
+struct sBoundingSphere
+{
+	math3d::vec3 center;
+	float radius;										// < 0 - empty
+};
+
+	// What Cull looked at in the last frame
+struct sCullStats
+{
+	uint32_t nTested;									// Nodes tested against the frustum
+	uint32_t nRejected;									// Subtrees which were outside
+	uint32_t nAccepted;									// Subtrees which were inside, their nodes aren't tested
+	uint32_t nVisible;									// Instances which go to the vertex stage
+};
+
+	// Tree of transforms. Every node has a local matrix, the world matrix is
+	// local * parent world (row vectors) and a node can draw one mesh. Nodes keep
+	// the bounds of themselves with all children, so Cull drops whole subtrees
+	// before any vertex is transformed. Nodes live in one array and a parent is
+	// always before its children, so Update is two plain passes over it
+class SceneGraph
+{
+public:
+	struct sNode
+	{
+		math3d::mat4 local;
+		math3d::mat4 world;
+		math3d::mat4 matrix;							// world * view * projection, see GetMatrix
+		uint64_t nMatrixStamp;							// Stamp of the view * projection in matrix
+
+		int32_t nParent;								// -1 for the root
+		int32_t nFirstChild, nLastChild, nNextSibling;	// -1 - none, children are in the order of AddNode
+		int32_t nMesh;									// -1 - only a group
+
+		sBoundingBox box;								// World bounds with the children
+		sBoundingSphere sphere;
+
+		bool bDirty;									// local changed
+		bool bChanged;									// world or bounds changed in this Update
+	};
+
+private:
+	std::vector<sNode> vecNodes;
+	std::vector<sBoundingBox> vecMeshBounds;			// In the space of the mesh
+	std::vector<int32_t> vecVisible;					// Nodes with meshes which passed Cull
+	bool bDirty;										// Some node needs Update
+	uint64_t nStamp;									// Changes when any node or mesh changes
+	sCullStats stats;
+
+public:
+	SceneGraph();
+
+	void Clear();										// Only the root is left
+	void SetMeshes(const std::vector<sMeshView>& meshes);	// Bounds of the meshes nodes can refer to
+
+	int32_t GetRoot() const { return 0; }
+	int32_t AddNode(int32_t nParent, int32_t nMesh, const math3d::mat4& local);
+	void SetLocal(int32_t nNode, const math3d::mat4& local);
+
+	void Update();										// World matrices and bounds of what changed
+		// Fills the visible list: every node with a mesh, or only those
+		// in the frustum if it is set. Call after Update
+	size_t Cull(const sFrustum* frustum);
+
+		// world * viewProj, built again only when the node moved or the stamp changed
+	const math3d::mat4& GetMatrix(int32_t nNode, const math3d::mat4& viewProj, uint64_t nStamp);
+
+	const std::vector<int32_t>& GetVisible() const { return vecVisible; }
+	const sNode& GetNode(int32_t nNode) const { return vecNodes[nNode]; }
+	const sBoundingBox& GetMeshBounds(int32_t nMesh) const { return vecMeshBounds[nMesh]; }
+	size_t GetNodeCount() const { return vecNodes.size(); }
+	const sCullStats& GetCullStats() const { return stats; }
+	uint64_t GetStamp() const { return nStamp; }
+
+		// Nodes with meshes whose bounds after the projection (e.g. a planar shadow)
+		// can be in the frustum. Groups are tested first, like in Cull
+	void CullProjected(const sFrustum& frustum, const math3d::mat4& projection, std::vector<int32_t>& nodes) const;
+
+private:
+	void UpdateBounds(sNode& node);
+	void CullNode(int32_t nNode, const sFrustum& frustum);
+	void AcceptNode(int32_t nNode);						// Whole subtree is visible
+	void CullProjectedNode(int32_t nNode, const sFrustum& frustum, const math3d::mat4& projection, std::vector<int32_t>& nodes) const;
+};
+
+#endif // !_SCENE_GRAPH_H_
@@ -0,0 +1,170 @@
+#include "ShadowMask.h"
+
+#include <algorithm>
+#include <cmath>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+ShadowMask::ShadowMask()
+{
+	iWidth = iHeight = 0;
+	nWordsPerRow = 0;
+	iRowMin = 0;
+	iRowMax = -1;
+}
+
+void ShadowMask::Resize(int16_t iWidth, int16_t iHeight)
+{
+	this->iWidth = iWidth;
+	this->iHeight = iHeight;
+	nWordsPerRow = (static_cast<size_t>(iWidth) + 63) / 64;
+	vecBits.assign(nWordsPerRow * iHeight, 0);
+	vecRowMin.assign(iHeight, iWidth);
+	vecRowMax.assign(iHeight, -1);
+	iRowMin = iHeight;
+	iRowMax = -1;
+}
+
+void ShadowMask::Clear()
+{
+	// Only the rows with bits
+	for (int16_t y = iRowMin; y <= iRowMax; y++)
+	{
+		if (vecRowMin[y] <= vecRowMax[y])
+			std::fill(&vecBits[y * nWordsPerRow + (vecRowMin[y] >> 6)], &vecBits[y * nWordsPerRow + (vecRowMax[y] >> 6)] + 1, 0);
+		vecRowMin[y] = iWidth;
+		vecRowMax[y] = -1;
+	}
+	iRowMin = iHeight;
+	iRowMax = -1;
+}
+
+void ShadowMask::FillPolygon(const math3d::vec4* points, size_t nPoints)
+{
+	if (nPoints < 3)
+		return;
+
+	float fMinY = points[0].y, fMaxY = points[0].y;
+	for (size_t i = 1; i < nPoints; i++)
+	{
+		fMinY = std::min(fMinY, points[i].y);
+		fMaxY = std::max(fMaxY, points[i].y);
+	}
+
+	// Rows whose centres are inside, the polygon is convex: one span per row
+	int16_t y1 = static_cast<int16_t>(std::max(0.0f, std::ceil(fMinY - 0.5f)));
+	int16_t y2 = static_cast<int16_t>(std::min(static_cast<float>(iHeight - 1), std::floor(fMaxY - 0.5f)));
+	for (int16_t y = y1; y <= y2; y++)
+	{
+		float fy = static_cast<float>(y) + 0.5f;
+		float fLeft = static_cast<float>(iWidth), fRight = -1.0f;
+
+		for (size_t i = 0; i < nPoints; i++)
+		{
+			const math3d::vec4& a = points[i];
+			const math3d::vec4& b = points[(i + 1 < nPoints) ? i + 1 : 0];
+			if ((a.y <= fy) == (b.y <= fy))
+				continue;
+
+			float fx = a.x + (fy - a.y) * (b.x - a.x) / (b.y - a.y);
+			fLeft = std::min(fLeft, fx);
+			fRight = std::max(fRight, fx);
+		}
+
+		int16_t x1 = static_cast<int16_t>(std::max(0.0f, std::ceil(fLeft - 0.5f)));
+		int16_t x2 = static_cast<int16_t>(std::min(static_cast<float>(iWidth - 1), std::floor(fRight - 0.5f)));
+		if (x1 <= x2)
+			SetSpan(y, x1, x2);
+	}
+}
+
+void ShadowMask::FillEdges(const math3d::vec4* points, size_t nEdges)
+{
+	// Every edge gives one crossing to every row whose centre it goes over
+	vecCrossings.clear();
+	for (size_t i = 0; i < nEdges; i++)
+	{
+		const math3d::vec4& a = points[2 * i];
+		const math3d::vec4& b = points[2 * i + 1];
+		if (a.y == b.y)
+			continue;
+
+		int16_t dir = (a.y < b.y) ? 1 : -1;
+		const math3d::vec4& top = (dir > 0) ? a : b;
+		const math3d::vec4& bottom = (dir > 0) ? b : a;
+		float fy1 = std::max(0.0f, std::ceil(top.y - 0.5f));
+		float fy2 = std::min(static_cast<float>(iHeight - 1), std::ceil(bottom.y - 0.5f) - 1.0f);
+		if (fy1 > fy2)
+			continue;
+
+		float dxdy = (bottom.x - top.x) / (bottom.y - top.y);
+		for (int16_t y = static_cast<int16_t>(fy1); y <= static_cast<int16_t>(fy2); y++)
+			vecCrossings.push_back({ y, dir, top.x + (static_cast<float>(y) + 0.5f - top.y) * dxdy });
+	}
+
+	std::sort(vecCrossings.begin(), vecCrossings.end(), [](const sCrossing& c1, const sCrossing& c2)
+		{
+			return (c1.y != c2.y) ? c1.y < c2.y : c1.x < c2.x;
+		});
+
+	// Along a row the winding goes up and down at the crossings: inside while it isn't 0
+	int16_t nWinding = 0;
+	float fLeft = 0.0f;
+	for (const sCrossing& crossing : vecCrossings)
+	{
+		if (!nWinding)
+			fLeft = crossing.x;
+		nWinding += crossing.dir;
+		if (nWinding)
+			continue;
+
+		// Crossings can be far off the screen: the span is cut in float, so both
+		// ends are on the screen before the casts or the span is skipped
+		float fx1 = std::max(0.0f, std::ceil(fLeft - 0.5f));
+		float fx2 = std::min(static_cast<float>(iWidth - 1), std::floor(crossing.x - 0.5f));
+		if (fx1 <= fx2)
+			SetSpan(crossing.y, static_cast<int16_t>(fx1), static_cast<int16_t>(fx2));
+	}
+}
+
+void ShadowMask::SetSpan(int16_t y, int16_t x1, int16_t x2)
+{
+	uint64_t* row = &vecBits[y * nWordsPerRow];
+	size_t w1 = x1 >> 6, w2 = x2 >> 6;
+	uint64_t first = ~0ull << (x1 & 63);
+	uint64_t last = ~0ull >> (63 - (x2 & 63));
+
+	if (w1 == w2)
+		row[w1] |= first & last;
+	else
+	{
+		row[w1] |= first;
+		for (size_t w = w1 + 1; w < w2; w++)
+			row[w] = ~0ull;
+		row[w2] |= last;
+	}
+
+	vecRowMin[y] = std::min(vecRowMin[y], x1);
+	vecRowMax[y] = std::max(vecRowMax[y], x2);
+	iRowMin = std::min(iRowMin, y);
+	iRowMax = std::max(iRowMax, y);
+}
+
+uint32_t ShadowMask::GetArea() const
+{
+	uint32_t nArea = 0;
+	ForEachSpan([&nArea](int16_t, int16_t x1, int16_t x2) { nArea += x2 - x1 + 1; });
+	return nArea;
+}
+
+int16_t ShadowMask::CountTrailingZeros(uint64_t word)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, word);
+	return static_cast<int16_t>(index);
+#else
+	return static_cast<int16_t>(__builtin_ctzll(word));
+#endif
+}
@@ -0,0 +1,100 @@
+#ifndef _SHADOW_MASK_H_
+#define _SHADOW_MASK_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Math3D.h"
+
+//###################//
+	// Shadow mask
+//###################//
+
+	// One bit per cell of the screen: is the cell in a shadow. Shadows of all
+	// figures are merged into it, so a cell is drawn once however many
+	// triangles cover it. Rows keep the columns they have bits in, and drawing
+	// goes only through the set spans: its cost is the area of the shadow
+class ShadowMask
+{
+private:
+		// Where an edge crosses the centre of a row, dir is +1 going down, -1 up
+	struct sCrossing
+	{
+		int16_t y, dir;
+		float x;
+	};
+
+	int16_t iWidth, iHeight;
+	size_t nWordsPerRow;
+	std::vector<uint64_t> vecBits;
+	std::vector<int16_t> vecRowMin, vecRowMax;			// Columns with bits, min > max - empty row
+	int16_t iRowMin, iRowMax;							// Rows with bits
+	std::vector<sCrossing> vecCrossings;				// Of FillEdges
+
+public:
+	ShadowMask();
+
+	void Resize(int16_t iWidth, int16_t iHeight);		// Also clears
+	void Clear();
+
+		// Convex polygon in screen coords (x, y of the points): cells with the
+		// centre inside are set. The points must be cut to the screen before
+		// (as UpdateShadowMask does with screen_rect): the spans are clamped on one
+		// side only, points far off the screen would set bits outside the mask
+	void FillPolygon(const math3d::vec4* points, size_t nPoints);
+
+		// Directed edges (points 2i -> 2i + 1) of closed loops, e.g. a silhouette, any
+		// shape: cells with the centre where the loops go round a nonzero number of
+		// times are set. Points may be far off the screen (the spans are cut to it),
+		// but not behind the camera
+	void FillEdges(const math3d::vec4* points, size_t nEdges);
+
+	bool Get(int16_t x, int16_t y) const { return (vecBits[y * nWordsPerRow + (x >> 6)] >> (x & 63)) & 1; }
+	uint32_t GetArea() const;							// Cells in the shadow
+
+		// Calls span(y, x1, x2) for every run of set cells (x2 inclusive)
+	template <typename SPAN>
+	void ForEachSpan(SPAN&& span) const
+	{
+		for (int16_t y = iRowMin; y <= iRowMax; y++)
+		{
+			int16_t x = vecRowMin[y], x_end = vecRowMax[y];
+			const uint64_t* row = &vecBits[y * nWordsPerRow];
+			while (x <= x_end)
+			{
+				// Start of a run, then its end, a word at a time
+				uint64_t word = row[x >> 6] >> (x & 63);
+				if (!word)
+				{
+					x = static_cast<int16_t>((x | 63) + 1);
+					continue;
+				}
+				x = static_cast<int16_t>(x + CountTrailingZeros(word));
+				if (x > x_end)
+					break;
+
+				// The run goes on into the next word only if it fills this one to the end
+				int16_t x1 = x;
+				for (;;)
+				{
+					int16_t nLeft = static_cast<int16_t>(64 - (x & 63));
+					uint64_t ones = ~(row[x >> 6] >> (x & 63));
+					int16_t nRun = ones ? std::min(CountTrailingZeros(ones), nLeft) : nLeft;
+					x = static_cast<int16_t>(x + nRun);
+					if (nRun < nLeft || x > x_end)
+						break;
+				}
+				span(y, x1, static_cast<int16_t>(std::min<int16_t>(x, static_cast<int16_t>(x_end + 1)) - 1));
+			}
+		}
+	}
+
+private:
+	void SetSpan(int16_t y, int16_t x1, int16_t x2);
+
+	static int16_t CountTrailingZeros(uint64_t word);	// word != 0
+};
+
+#endif // !_SHADOW_MASK_H_
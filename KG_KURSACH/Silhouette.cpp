@@ -0,0 +1,21 @@
+#include "Silhouette.h"
+
+size_t FindSilhouetteEdges(const sMeshView& mesh, const uint8_t* flags, uint32_t* out)
+{
+	size_t nOut = 0;
+	for (uint32_t i = 0; i < mesh.nEdges; i++)
+	{
+		const sMeshEdge& edge = mesh.edges[i];
+		bool b1 = flags[edge.f1] != 0, b2 = flags[edge.f2] != 0;
+		if (b1 == b2)
+			continue;
+
+		// f2 goes along the edge the other way
+		out[2 * nOut] = b1 ? edge.v1 : edge.v2;
+		out[2 * nOut + 1] = b1 ? edge.v2 : edge.v1;
+		nOut++;
+	}
+
+	return nOut;
+}
+
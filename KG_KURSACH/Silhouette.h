@@ -0,0 +1,21 @@
+#ifndef _SILHOUETTE_H_
+#define _SILHOUETTE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "IndexedMesh.h"
+
+//###################//
+	// Silhouettes
+//###################//
+
+	// Edges between a flagged face and a face without the flag (e.g. turned to the
+	// light and away from it), one pass over the edges of the mesh (sMeshView::edges).
+	// The flagged face is on the left: v1 -> v2 goes counter-clockwise around it, so
+	// the edges make closed loops around the flagged part of the mesh, all of them
+	// the same way round. out gets 2 vertex indices per edge and must hold
+	// 2 * nEdges of them, the count of the edges is returned
+size_t FindSilhouetteEdges(const sMeshView& mesh, const uint8_t* flags, uint32_t* out);
+
+#endif // !_SILHOUETTE_H_
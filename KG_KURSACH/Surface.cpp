@@ -0,0 +1,67 @@
+#include "Surface.h"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define KG_SSE2
+#include <emmintrin.h>
+#endif
+
+void Framebuffer::Create(int16_t w, int16_t h)
+{
+	width = w;
+	height = h;
+	cells.assign(static_cast<size_t>(w) * h, sCell{ 0, 0 });
+}
+
+static_assert(sizeof(sCell) == sizeof(uint32_t), "FillCells stores sCell as uint32_t");
+
+void FillCells(sCell* cells, size_t n, sCell value)
+{
+	// sCell is 4 bytes, so a row is filled like an array of uint32_t
+	uint32_t pattern;
+	std::memcpy(&pattern, &value, sizeof(pattern));
+
+	size_t i = 0;
+#ifdef KG_SSE2
+	__m128i pattern4 = _mm_set1_epi32(static_cast<int>(pattern));
+	for (; i + 8 <= n; i += 8)
+	{
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(cells + i), pattern4);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(cells + i + 4), pattern4);
+	}
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(cells + i), pattern4);
+#endif
+	for (; i < n; i++)
+		cells[i] = value;
+}
+
+uint64_t HashCells(const sCell* cells, size_t n, uint64_t hash)
+{
+	for (size_t i = 0; i < n; i++)
+	{
+		hash = (hash ^ static_cast<uint16_t>(cells[i].sym)) * 1099511628211ull;
+		hash = (hash ^ static_cast<uint16_t>(cells[i].col)) * 1099511628211ull;
+	}
+	return hash;
+}
+
+FramebufferSurface::FramebufferSurface()
+{
+	pLastFrame = nullptr;
+	nFramesPresented = 0;
+}
+
+int16_t FramebufferSurface::Create(int16_t width, int16_t height, int16_t font_w, int16_t font_h, const std::wstring& name)
+{
+	pLastFrame = nullptr;
+	nFramesPresented = 0;
+	return 0;
+}
+
+void FramebufferSurface::Present(const Framebuffer& framebuffer)
+{
+	pLastFrame = &framebuffer;
+	nFramesPresented++;
+}
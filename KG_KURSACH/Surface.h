@@ -0,0 +1,61 @@
+#ifndef _SURFACE_H_
+#define _SURFACE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+	// One character cell of the screen (same layout as the Win32 CHAR_INFO)
+struct sCell
+{
+	int16_t sym;
+	int16_t col;
+};
+
+	// In-memory framebuffer: plain row-major array of cells, no platform types
+struct Framebuffer
+{
+	int16_t width = 0;
+	int16_t height = 0;
+	std::vector<sCell> cells;
+
+	void Create(int16_t w, int16_t h);
+};
+
+	// n copies of value, with 16-byte stores where SSE2 is available
+void FillCells(sCell* cells, size_t n, sCell value);
+	// FNV-1a of the cells, hash of the previous cells can be continued
+uint64_t HashCells(const sCell* cells, size_t n, uint64_t hash = 14695981039346656037ull);
+
+//###################//
+	// Output backends
+//###################//
+
+class Surface
+{
+public:
+	virtual ~Surface() {}
+
+	virtual int16_t Create(int16_t width, int16_t height, int16_t font_w, int16_t font_h, const std::wstring& name) = 0;
+	virtual void Present(const Framebuffer& framebuffer) = 0;
+	virtual void SetTitle(const wchar_t* title) {}
+};
+
+	// Headless backend: frames stay in memory, nothing is shown
+class FramebufferSurface : public Surface
+{
+private:
+	const Framebuffer* pLastFrame;
+	uint64_t nFramesPresented;
+
+public:
+	FramebufferSurface();
+
+	virtual int16_t Create(int16_t width, int16_t height, int16_t font_w, int16_t font_h, const std::wstring& name) override;
+	virtual void Present(const Framebuffer& framebuffer) override;
+
+	const Framebuffer* GetLastFrame() const { return pLastFrame; }
+	uint64_t GetFramesPresented() const { return nFramesPresented; }
+};
+
+#endif // !_SURFACE_H_
@@ -0,0 +1,159 @@
+#include "VertexTransform.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define KG_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define KG_TARGET_AVX
+#else
+#define KG_TARGET_AVX __attribute__((target("avx")))
+#endif
+#endif
+
+static void TransformScalar(const float m[4][4], const sViewport& vp, const float* x, const float* y, const float* z,
+	size_t first, size_t n, float* ox, float* oy, float* oz, float* ow)
+{
+	for (size_t i = first; i < n; i++)
+	{
+		float tx = x[i] * m[0][0] + y[i] * m[1][0] + z[i] * m[2][0] + m[3][0];
+		float ty = x[i] * m[0][1] + y[i] * m[1][1] + z[i] * m[2][1] + m[3][1];
+		float tz = x[i] * m[0][2] + y[i] * m[1][2] + z[i] * m[2][2] + m[3][2];
+		float tw = x[i] * m[0][3] + y[i] * m[1][3] + z[i] * m[2][3] + m[3][3];
+
+		ox[i] = (vp.offset_x - tx / tw) * vp.scale_x;
+		oy[i] = (vp.offset_y - ty / tw) * vp.scale_y;
+		oz[i] = tz / tw;
+		ow[i] = tw;
+	}
+}
+
+#ifdef KG_X86
+static void TransformSSE(const float m[4][4], const sViewport& vp, const float* x, const float* y, const float* z,
+	size_t n, float* ox, float* oy, float* oz, float* ow)
+{
+	__m128 m00 = _mm_set1_ps(m[0][0]), m10 = _mm_set1_ps(m[1][0]), m20 = _mm_set1_ps(m[2][0]), m30 = _mm_set1_ps(m[3][0]);
+	__m128 m01 = _mm_set1_ps(m[0][1]), m11 = _mm_set1_ps(m[1][1]), m21 = _mm_set1_ps(m[2][1]), m31 = _mm_set1_ps(m[3][1]);
+	__m128 m02 = _mm_set1_ps(m[0][2]), m12 = _mm_set1_ps(m[1][2]), m22 = _mm_set1_ps(m[2][2]), m32 = _mm_set1_ps(m[3][2]);
+	__m128 m03 = _mm_set1_ps(m[0][3]), m13 = _mm_set1_ps(m[1][3]), m23 = _mm_set1_ps(m[2][3]), m33 = _mm_set1_ps(m[3][3]);
+	__m128 off_x = _mm_set1_ps(vp.offset_x), off_y = _mm_set1_ps(vp.offset_y);
+	__m128 scale_x = _mm_set1_ps(vp.scale_x), scale_y = _mm_set1_ps(vp.scale_y);
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+
+		__m128 tx = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, m00), _mm_mul_ps(vy, m10)), _mm_mul_ps(vz, m20)), m30);
+		__m128 ty = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, m01), _mm_mul_ps(vy, m11)), _mm_mul_ps(vz, m21)), m31);
+		__m128 tz = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, m02), _mm_mul_ps(vy, m12)), _mm_mul_ps(vz, m22)), m32);
+		__m128 tw = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, m03), _mm_mul_ps(vy, m13)), _mm_mul_ps(vz, m23)), m33);
+
+		_mm_storeu_ps(ox + i, _mm_mul_ps(_mm_sub_ps(off_x, _mm_div_ps(tx, tw)), scale_x));
+		_mm_storeu_ps(oy + i, _mm_mul_ps(_mm_sub_ps(off_y, _mm_div_ps(ty, tw)), scale_y));
+		_mm_storeu_ps(oz + i, _mm_div_ps(tz, tw));
+		_mm_storeu_ps(ow + i, tw);
+	}
+
+	TransformScalar(m, vp, x, y, z, i, n, ox, oy, oz, ow);
+}
+
+KG_TARGET_AVX static void TransformAVX(const float m[4][4], const sViewport& vp, const float* x, const float* y, const float* z,
+	size_t n, float* ox, float* oy, float* oz, float* ow)
+{
+	__m256 m00 = _mm256_set1_ps(m[0][0]), m10 = _mm256_set1_ps(m[1][0]), m20 = _mm256_set1_ps(m[2][0]), m30 = _mm256_set1_ps(m[3][0]);
+	__m256 m01 = _mm256_set1_ps(m[0][1]), m11 = _mm256_set1_ps(m[1][1]), m21 = _mm256_set1_ps(m[2][1]), m31 = _mm256_set1_ps(m[3][1]);
+	__m256 m02 = _mm256_set1_ps(m[0][2]), m12 = _mm256_set1_ps(m[1][2]), m22 = _mm256_set1_ps(m[2][2]), m32 = _mm256_set1_ps(m[3][2]);
+	__m256 m03 = _mm256_set1_ps(m[0][3]), m13 = _mm256_set1_ps(m[1][3]), m23 = _mm256_set1_ps(m[2][3]), m33 = _mm256_set1_ps(m[3][3]);
+	__m256 off_x = _mm256_set1_ps(vp.offset_x), off_y = _mm256_set1_ps(vp.offset_y);
+	__m256 scale_x = _mm256_set1_ps(vp.scale_x), scale_y = _mm256_set1_ps(vp.scale_y);
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 vx = _mm256_loadu_ps(x + i), vy = _mm256_loadu_ps(y + i), vz = _mm256_loadu_ps(z + i);
+
+		__m256 tx = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, m00), _mm256_mul_ps(vy, m10)), _mm256_mul_ps(vz, m20)), m30);
+		__m256 ty = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, m01), _mm256_mul_ps(vy, m11)), _mm256_mul_ps(vz, m21)), m31);
+		__m256 tz = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, m02), _mm256_mul_ps(vy, m12)), _mm256_mul_ps(vz, m22)), m32);
+		__m256 tw = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, m03), _mm256_mul_ps(vy, m13)), _mm256_mul_ps(vz, m23)), m33);
+
+		_mm256_storeu_ps(ox + i, _mm256_mul_ps(_mm256_sub_ps(off_x, _mm256_div_ps(tx, tw)), scale_x));
+		_mm256_storeu_ps(oy + i, _mm256_mul_ps(_mm256_sub_ps(off_y, _mm256_div_ps(ty, tw)), scale_y));
+		_mm256_storeu_ps(oz + i, _mm256_div_ps(tz, tw));
+		_mm256_storeu_ps(ow + i, tw);
+	}
+
+	TransformScalar(m, vp, x, y, z, i, n, ox, oy, oz, ow);
+}
+#endif
+
+TRANSFORM_KERNEL GetBestTransformKernel()
+{
+	static TRANSFORM_KERNEL best = []()
+	{
+#ifdef KG_X86
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		bool bAVX = (info[2] & (1 << 28)) != 0;					// CPU has AVX
+		bool bOSXSAVE = (info[2] & (1 << 27)) != 0;				// OS saves YMM registers
+		if (bAVX && bOSXSAVE && (_xgetbv(0) & 0x6) == 0x6)
+			return KERNEL_AVX;
+#else
+		if (__builtin_cpu_supports("avx"))
+			return KERNEL_AVX;
+#endif
+		return KERNEL_SSE;										// SSE2 is baseline on x86 targets
+#else
+		return KERNEL_SCALAR;
+#endif
+	}();
+
+	return best;
+}
+
+const wchar_t* GetTransformKernelName(TRANSFORM_KERNEL kernel)
+{
+	switch (kernel)
+	{
+	case KERNEL_SCALAR:	return L"scalar";
+	case KERNEL_SSE:	return L"SSE";
+	case KERNEL_AVX:	return L"AVX";
+	default:			return L"auto";
+	}
+}
+
+void TransformBatch(const float m[4][4], const sViewport& viewport, const sVertexBatch& in, sProjectedBatch& out,
+	TRANSFORM_KERNEL kernel)
+{
+	out.Resize(in.Size());
+	TransformBatch(m, viewport, in.x.data(), in.y.data(), in.z.data(), in.Size(),
+		out.x.data(), out.y.data(), out.z.data(), out.w.data(), kernel);
+}
+
+void TransformBatch(const float m[4][4], const sViewport& viewport, const float* x, const float* y, const float* z, size_t n,
+	float* out_x, float* out_y, float* out_z, float* out_w, TRANSFORM_KERNEL kernel)
+{
+	if (kernel == KERNEL_AUTO)
+		kernel = GetBestTransformKernel();
+
+	// A kernel the CPU can't run falls back to the best one it can
+	if (kernel > GetBestTransformKernel())
+		kernel = GetBestTransformKernel();
+
+	switch (kernel)
+	{
+#ifdef KG_X86
+	case KERNEL_AVX:
+		TransformAVX(m, viewport, x, y, z, n, out_x, out_y, out_z, out_w);
+		break;
+	case KERNEL_SSE:
+		TransformSSE(m, viewport, x, y, z, n, out_x, out_y, out_z, out_w);
+		break;
+#endif
+	default:
+		TransformScalar(m, viewport, x, y, z, 0, n, out_x, out_y, out_z, out_w);
+		break;
+	}
+}
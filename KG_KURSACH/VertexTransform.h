@@ -0,0 +1,54 @@
+#ifndef _VERTEX_TRANSFORM_H_
+#define _VERTEX_TRANSFORM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//###################//
+	// Batched vertex transform
+//###################//
+
+	// Vertices of a mesh in SoA layout (w is always 1)
+struct sVertexBatch
+{
+	std::vector<float> x, y, z;
+
+	size_t Size() const { return x.size(); }
+	void Resize(size_t n) { x.resize(n); y.resize(n); z.resize(n); }
+};
+
+	// Projected vertices: console x, y, depth z/w and clip w
+struct sProjectedBatch
+{
+	std::vector<float> x, y, z, w;
+
+	size_t Size() const { return x.size(); }
+	void Resize(size_t n) { x.resize(n); y.resize(n); z.resize(n); w.resize(n); }
+};
+
+	// NDC -> console: x = (-x/w + offset_x) * scale_x (X/Y of the projection are inverted)
+struct sViewport
+{
+	float offset_x, offset_y;
+	float scale_x, scale_y;
+};
+
+enum TRANSFORM_KERNEL
+{
+	KERNEL_SCALAR,
+	KERNEL_SSE,
+	KERNEL_AVX,
+	KERNEL_AUTO									// The best one the CPU supports
+};
+
+	// m is the combined world * projection matrix (row vector convention, like mat4x4)
+void TransformBatch(const float m[4][4], const sViewport& viewport, const sVertexBatch& in, sProjectedBatch& out,
+	TRANSFORM_KERNEL kernel = KERNEL_AUTO);
+void TransformBatch(const float m[4][4], const sViewport& viewport, const float* x, const float* y, const float* z, size_t n,
+	float* out_x, float* out_y, float* out_z, float* out_w, TRANSFORM_KERNEL kernel = KERNEL_AUTO);
+
+TRANSFORM_KERNEL GetBestTransformKernel();
+const wchar_t* GetTransformKernelName(TRANSFORM_KERNEL kernel);
+
+#endif // !_VERTEX_TRANSFORM_H_
@@ -0,0 +1,97 @@
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(int32_t nThreads)
+{
+	if (nThreads <= 0)
+		nThreads = static_cast<int32_t>(std::thread::hardware_concurrency());
+	if (nThreads <= 0)
+		nThreads = 1;
+
+	pfnTask = nullptr;
+	pTaskContext = nullptr;
+	nTasks = 0;
+	nNextTask = 0;
+	nBusyWorkers = 0;
+	nGeneration = 0;
+	bStop = false;
+
+	for (int32_t i = 1; i < nThreads; i++)
+		vecThreads.emplace_back(&WorkerPool::WorkerMain, this);
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		bStop = true;
+	}
+	cvStart.notify_all();
+
+	for (auto& thread : vecThreads)
+		thread.join();
+}
+
+void WorkerPool::RunTasks(int32_t nTasks, void (*pfnTask)(void*, int32_t), void* pTaskContext)
+{
+	if (nTasks <= 0)
+		return;
+
+	// Nothing to share
+	if (vecThreads.empty() || nTasks == 1)
+	{
+		for (int32_t i = 0; i < nTasks; i++)
+			pfnTask(pTaskContext, i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->pfnTask = pfnTask;
+		this->pTaskContext = pTaskContext;
+		this->nTasks = nTasks;
+		nNextTask = 0;
+		nBusyWorkers = static_cast<int32_t>(vecThreads.size());
+		nGeneration++;
+	}
+	cvStart.notify_all();
+
+	TakeTasks();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	cvDone.wait(lock, [this]() { return nBusyWorkers == 0; });
+	this->pfnTask = nullptr;
+}
+
+void WorkerPool::WorkerMain()
+{
+	uint64_t nSeenGeneration = 0;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cvStart.wait(lock, [this, nSeenGeneration]() { return bStop || nGeneration != nSeenGeneration; });
+			if (bStop)
+				return;
+			nSeenGeneration = nGeneration;
+		}
+
+		TakeTasks();
+
+		bool bLast;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			bLast = (--nBusyWorkers == 0);
+		}
+		if (bLast)
+			cvDone.notify_one();
+	}
+}
+
+void WorkerPool::TakeTasks()
+{
+	// Tasks are handed out one by one, so fast threads take more of them
+	int32_t i;
+	while ((i = nNextTask.fetch_add(1, std::memory_order_relaxed)) < nTasks)
+		pfnTask(pTaskContext, i);
+}
@@ -0,0 +1,59 @@
+#ifndef _WORKER_POOL_H_
+#define _WORKER_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+//###################//
+	// Worker pool
+//###################//
+
+	// Fixed set of threads which run numbered tasks. Every task is taken
+	// by exactly one thread, the calling thread works too
+class WorkerPool
+{
+private:
+	std::vector<std::thread> vecThreads;
+
+	std::mutex mutex;
+	std::condition_variable cvStart;
+	std::condition_variable cvDone;
+
+	void (*pfnTask)(void*, int32_t);					// Task of the current Run
+	void* pTaskContext;
+	int32_t nTasks;
+	std::atomic<int32_t> nNextTask;
+	int32_t nBusyWorkers;								// Workers which haven't finished the current Run
+	uint64_t nGeneration;								// Changes on every Run
+	bool bStop;
+
+public:
+	WorkerPool(int32_t nThreads = 0);					// 0 - one thread per core
+	~WorkerPool();
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+		// Calls task(0) ... task(nTasks - 1) and returns when all of them are done.
+		// The task is called through a pointer, so nothing is allocated
+	template <typename TASK>
+	void Run(int32_t nTasks, TASK&& task)
+	{
+		using task_t = typename std::remove_reference<TASK>::type;
+		RunTasks(nTasks, [](void* context, int32_t i) { (*static_cast<task_t*>(context))(i); }, &task);
+	}
+
+	int32_t GetThreadCount() const { return static_cast<int32_t>(vecThreads.size()) + 1; }
+
+private:
+	void RunTasks(int32_t nTasks, void (*pfnTask)(void*, int32_t), void* pTaskContext);
+	void WorkerMain();
+	void TakeTasks();
+};
+
+#endif // !_WORKER_POOL_H_
@@ -1,11 +1,251 @@
 #include "NewGarphics.h"
+#include "AnsiSurface.h"
+#include "Benchmark.h"
 
-int main()
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+	// Optional number after an option
+static bool NextIsNumber(int i, int argc, char* argv[])
+{
+	return i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]));
+}
+
+int main(int argc, char* argv[])
 {
 	NewGarphics game;
-	
-	if (!game.ConstructConsole(360, 200, 2, 2, L"Light's"))
-		game.Loop();
 
-	return 0;
-}
\ No newline at end of file
+	bool bHeadless = false;
+	int32_t nFrames = 600;
+	const char* trace_path = nullptr;
+	bool bAnsi = false;
+	const char* input_path = nullptr;
+	const char* record_path = nullptr;
+	const char* replay_path = nullptr;
+	const char* hashes_path = nullptr;
+	float fTimeStep = 0.0f;								// 0 - 1/60 for headless runs, recorded times for replay
+	bool bPaced = false;								// Headless frames go through Loop with pacing
+	PACING_MODE pacing = PACING_IDLE;
+	float fRate = 60.0f;
+
+#ifndef _WIN32
+	bHeadless = true;									// No console to show frames in
+#endif
+
+	// KG_KURSACH --bench [frames] | --bench transform | --bench load [triangles] | --bench threads [frames]
+	//            --bench alloc [frames] | --bench clear [frames] | --bench present [frames] | --bench ansi [frames]
+	//            --bench math [repeats] | --bench scene [instances] [frames] | --bench clip [frames]
+	//            --bench backface [frames] | --bench depthsort [max triangles] | --bench shadow [frames]
+	//            --bench edges [frames] | --bench fill [repeats]
+	if (argc > 1 && !std::strcmp(argv[1], "--bench"))
+	{
+		if (argc > 2 && !std::strcmp(argv[2], "fill"))
+			return RunFillBenchmark(argc > 3 ? std::atoi(argv[3]) : 200);
+		if (argc > 2 && !std::strcmp(argv[2], "transform"))
+			return RunTransformBenchmark();
+		if (argc > 2 && !std::strcmp(argv[2], "scene"))
+			return RunSceneBenchmark(argc > 3 ? std::atoi(argv[3]) : 10000, argc > 4 ? std::atoi(argv[4]) : 30);
+		if (argc > 2 && !std::strcmp(argv[2], "clip"))
+			return RunClipBenchmark(argc > 3 ? std::atoi(argv[3]) : 30);
+		if (argc > 2 && !std::strcmp(argv[2], "backface"))
+			return RunBackFaceBenchmark(argc > 3 ? std::atoi(argv[3]) : 100);
+		if (argc > 2 && !std::strcmp(argv[2], "depthsort"))
+			return RunDepthSortBenchmark(argc > 3 ? std::atoi(argv[3]) : 1000000);
+		if (argc > 2 && !std::strcmp(argv[2], "shadow"))
+			return RunShadowBenchmark(argc > 3 ? std::atoi(argv[3]) : 100);
+		if (argc > 2 && !std::strcmp(argv[2], "edges"))
+			return RunEdgeBenchmark(argc > 3 ? std::atoi(argv[3]) : 100);
+		if (argc > 2 && !std::strcmp(argv[2], "math"))
+			return RunMathBenchmark(argc > 3 ? std::atoi(argv[3]) : 2000000);
+		if (argc > 2 && !std::strcmp(argv[2], "load"))
+			return RunLoadBenchmark(argc > 3 ? std::atoi(argv[3]) : 2000000);
+		if (argc > 2 && !std::strcmp(argv[2], "threads"))
+			return RunThreadBenchmark(argc > 3 ? std::atoi(argv[3]) : 100);
+		if (argc > 2 && !std::strcmp(argv[2], "alloc"))
+			return RunAllocationCheck(argc > 3 ? std::atoi(argv[3]) : 100);
+		if (argc > 2 && !std::strcmp(argv[2], "clear"))
+			return RunClearBenchmark(argc > 3 ? std::atoi(argv[3]) : 300);
+		if (argc > 2 && !std::strcmp(argv[2], "present"))
+			return RunPresentBenchmark(argc > 3 ? std::atoi(argv[3]) : 300);
+#ifndef _WIN32
+		if (argc > 2 && !std::strcmp(argv[2], "ansi"))
+			return RunAnsiBenchmark(argc > 3 ? std::atoi(argv[3]) : 300);
+#endif
+
+		return RunBenchmarks(argc > 2 ? std::atoi(argv[2]) : 300);
+	}
+
+	// KG_KURSACH --convert model.obj model.kgm
+	if (argc > 3 && !std::strcmp(argv[1], "--convert"))
+	{
+		indexedMesh model;
+		if (LoadObj(argv[2], model, PIXEL_SOLID, FG_WHITE))
+			return 1;
+		return SaveBinaryMesh(argv[3], model.View());
+	}
+
+	for (int i = 1; i < argc; i++)
+	{
+		// --headless [frames]
+		if (!std::strcmp(argv[i], "--headless"))
+		{
+			bHeadless = true;
+			if (NextIsNumber(i, argc, argv))
+				nFrames = std::atoi(argv[++i]);
+		}
+
+		// --trace file.json [frames]: headless run written as a Chrome trace
+		else if (!std::strcmp(argv[i], "--trace") && i + 1 < argc)
+		{
+#ifndef KG_PROFILE
+			wprintf(L"Profiling is compiled out: build with KG_PROFILE defined\n");
+			return 1;
+#endif
+			bHeadless = true;
+			trace_path = argv[++i];
+			if (NextIsNumber(i, argc, argv))
+				nFrames = std::atoi(argv[++i]);
+			Profiler::Get().StartTrace();
+		}
+
+#ifndef _WIN32
+		// --ansi [frames]: headless frames shown in the terminal
+		else if (!std::strcmp(argv[i], "--ansi"))
+		{
+			bHeadless = true;
+			bAnsi = true;
+			if (NextIsNumber(i, argc, argv))
+				nFrames = std::atoi(argv[++i]);
+		}
+#endif
+
+		// --input script.txt: keys and mouse of the headless frames
+		else if (!std::strcmp(argv[i], "--input") && i + 1 < argc)
+		{
+			bHeadless = true;
+			input_path = argv[++i];
+		}
+
+		// --record log.kgi: input and frame times are saved when the run ends (Esc in the console)
+		else if (!std::strcmp(argv[i], "--record") && i + 1 < argc)
+			record_path = argv[++i];
+
+		// --replay log.kgi: frames of a recorded run, all of them
+		else if (!std::strcmp(argv[i], "--replay") && i + 1 < argc)
+			replay_path = argv[++i];
+
+		// --step seconds: fixed time of every frame, for headless runs and replay
+		else if (!std::strcmp(argv[i], "--step") && i + 1 < argc)
+			fTimeStep = static_cast<float>(std::atof(argv[++i]));
+
+		// --pace uncapped|capped|fixed|idle [rate]: pacing of Loop (idle at 60 by default).
+		// Headless and terminal runs go through Loop too, in real time
+		else if (!std::strcmp(argv[i], "--pace") && i + 1 < argc)
+		{
+			if (!FramePacer::ParseMode(argv[++i], pacing))
+			{
+				wprintf(L"Unknown pacing: %hs\n", argv[i]);
+				return 1;
+			}
+			if (NextIsNumber(i, argc, argv))
+				fRate = static_cast<float>(std::atof(argv[++i]));
+			bPaced = true;
+		}
+
+		// --hashes file.txt: hash of every frame, to compare runs with diff
+		else if (!std::strcmp(argv[i], "--hashes") && i + 1 < argc)
+			hashes_path = argv[++i];
+
+		// --model file.obj|file.kgm (can be repeated)
+		else if (!std::strcmp(argv[i], "--model") && i + 1 < argc)
+			game.AddModel(argv[++i]);
+
+		else
+		{
+			wprintf(L"Unknown option: %hs\n", argv[i]);
+			return 1;
+		}
+	}
+
+	InputLog record_log, replay_log;
+
+	// Input goes after the surface: the console sets its own source
+	auto setup_input = [&]() -> int16_t
+	{
+		if (input_path)
+		{
+			ScriptedInputSource* script = new ScriptedInputSource();
+			game.SetInputSource(script);
+			if (script->Load(input_path))
+				return 1;
+		}
+		if (replay_path)
+		{
+			if (replay_log.Load(replay_path))
+				return 1;
+			game.StartReplay(replay_log, fTimeStep);
+			nFrames = replay_log.GetFrameCount();
+		}
+		if (record_path)
+			game.StartRecording(&record_log);
+		if (hashes_path && game.StartHashDump(hashes_path))
+			return 1;
+		return 0;
+	};
+
+	int16_t error = 1;
+
+	if (bHeadless)
+	{
+#ifndef _WIN32
+		if (bAnsi)
+			error = game.ConstructSurface(new AnsiSurface(), 360, 200, 1, 1, L"Light's");
+		else
+#endif
+			error = game.ConstructHeadless(360, 200, L"Light's");
+
+		if (!error)
+			error = setup_input();
+
+		game.SetPacing(pacing, fRate);
+		if (!error && bPaced)
+		{
+			auto tp1 = std::chrono::steady_clock::now();
+			game.Loop();
+			float fSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - tp1).count();
+			game.CloseSurface();
+
+			sFrameStats stats = game.GetFrameStats();
+			wprintf(L"%llu loops, %llu frames drawn in %.3f s (%hs %.0f): frame %.2f ms, p99 %.2f ms, max %.2f ms, busy %.1f%%\n",
+				static_cast<unsigned long long>(stats.nFrames), static_cast<unsigned long long>(stats.nRendered), fSeconds,
+				FramePacer::GetModeName(pacing), fRate, stats.fMean, stats.fP99, stats.fMax, stats.fBusy * 100.0f);
+		}
+		else if (!error)
+		{
+			float fSeconds = game.LoopHeadless(nFrames, (fTimeStep > 0.0f) ? fTimeStep : 1.0f / 60.0f);
+			game.CloseSurface();						// Terminal is given back before the results
+			wprintf(L"%d frames in %.3f s (%.2f FPS)\n", nFrames, fSeconds, nFrames / fSeconds);
+
+			if (trace_path && !Profiler::Get().WriteChromeTrace(trace_path))
+				wprintf(L"Can't write %hs\n", trace_path);
+		}
+	}
+
+#ifdef _WIN32
+	else
+	{
+		error = game.ConstructConsole(360, 200, 2, 2, L"Light's");
+		if (!error)
+			error = setup_input();
+		game.SetPacing(pacing, fRate);
+		if (!error)
+			game.Loop();
+	}
+#endif
+
+	if (!error && record_path)
+		error = record_log.Save(record_path);
+
+	return error;
+}